@@ -0,0 +1,186 @@
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdlib>
+#include <metropolis.hpp>
+#include <model.hpp>
+#include <new>
+#include <poisson_kernel.hpp>
+#include <util.hpp>
+
+/* Count every heap allocation in the benchmark binary, so that the
+ * benchmarks can report how many allocations each step makes. */
+static std::atomic<size_t> allocation_count{0};
+
+void *operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) { return p; }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+/**
+ * A round robin of `team_count` teams, with scores that vary from match to
+ * match.
+ */
+static auto make_round_robin(size_t team_count) -> std::vector<match_t> {
+  std::vector<match_t> matches;
+  for (size_t i = 0; i < team_count; ++i) {
+    for (size_t j = i + 1; j < team_count; ++j) {
+      size_t l_goals = (i * 7 + j * 3) % 4;
+      size_t r_goals = (i * 5 + j * 11) % 3;
+      if (l_goals == r_goals) { l_goals += 1; }
+      matches.push_back({i,
+                         j,
+                         l_goals,
+                         r_goals,
+                         l_goals > r_goals ? match_winner_t::left
+                                           : match_winner_t::right});
+    }
+  }
+  return matches;
+}
+
+template <typename Proposal, typename Prior>
+static void metropolis_steps(benchmark::State &state,
+                             Proposal          proposal,
+                             Prior             prior) {
+  poisson_likelihood_model_t lhm(
+      make_round_robin(static_cast<size_t>(state.range(0))));
+  metropolis_kernel_t<Proposal, Prior> kernel{
+      lhm, proposal, prior, params_t(lhm.param_count(), 0.5)};
+  random_engine_t gen(1);
+
+  size_t allocations = allocation_count.load();
+  for (auto _ : state) { benchmark::DoNotOptimize(kernel.step(gen)); }
+  state.counters["allocs_per_step"] =
+      benchmark::Counter(static_cast<double>(allocation_count.load() -
+                                             allocations),
+                         benchmark::Counter::kAvgIterations);
+}
+
+static void BM_metropolis_step_function(benchmark::State &state) {
+  metropolis_steps(state,
+                   function_proposal_t{update_win_probs_beta_with_scale},
+                   uniform_log_prior());
+}
+
+BENCHMARK(BM_metropolis_step_function)->RangeMultiplier(4)->Range(4, 64);
+
+static void BM_metropolis_step_inplace(benchmark::State &state) {
+  metropolis_steps(
+      state, win_probs_beta_with_scale_proposal_t{}, flat_log_prior_t{});
+}
+
+BENCHMARK(BM_metropolis_step_inplace)->RangeMultiplier(4)->Range(4, 64);
+
+/**
+ * Eight seasons of a round robin, so every pair of teams meets repeatedly.
+ */
+static void BM_poisson_log_likelihood(benchmark::State &state) {
+  auto season = make_round_robin(static_cast<size_t>(state.range(0)));
+  std::vector<match_t> matches;
+  for (size_t s = 0; s < 8; ++s) {
+    matches.insert(matches.end(), season.begin(), season.end());
+  }
+  poisson_likelihood_model_t lhm(matches);
+  params_t                   params(lhm.param_count(), 0.5);
+  for (size_t i = 0; i < params.size(); ++i) { params[i] += 0.01 * i; }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lhm.log_likelihood(params));
+  }
+}
+
+BENCHMARK(BM_poisson_log_likelihood)->RangeMultiplier(4)->Range(4, 64);
+
+/**
+ * The win probabilities of `range(0)` teams, with strengths spread over 2.
+ */
+static void BM_poisson_win_probs(benchmark::State &state) {
+  auto teams = static_cast<size_t>(state.range(0));
+  poisson_likelihood_model_t lhm(make_round_robin(teams));
+  params_t                   params(lhm.param_count(), 0.5);
+  std::vector<size_t>        indices(teams);
+  for (size_t i = 0; i < teams; ++i) {
+    params[i]  = 2.0 * static_cast<double>(i) / static_cast<double>(teams);
+    indices[i] = i;
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lhm.generate_win_probs(params, indices));
+  }
+}
+
+BENCHMARK(BM_poisson_win_probs)->RangeMultiplier(4)->Range(4, 64);
+
+/**
+ * A sparse schedule, like a college season, where each of `range(0)` teams
+ * plays 14 others.
+ */
+static void BM_simple_log_likelihood(benchmark::State &state) {
+  auto                 teams = static_cast<size_t>(state.range(0));
+  std::vector<match_t> matches;
+  for (size_t i = 0; i < teams; ++i) {
+    for (size_t k = 1; k <= 7; ++k) {
+      size_t j = (i + k * k * 13) % teams;
+      matches.push_back({i,
+                         j,
+                         0,
+                         0,
+                         (i + k) % 3 == 0 ? match_winner_t::right
+                                          : match_winner_t::left});
+    }
+  }
+  simple_likelihood_model_t lhm(matches);
+  params_t                  params(lhm.param_count(), 0.5);
+  for (size_t i = 0; i < teams; ++i) { params[i] += 0.001 * i; }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lhm.log_likelihood(params));
+  }
+}
+
+BENCHMARK(BM_simple_log_likelihood)->RangeMultiplier(4)->Range(16, 256);
+
+/**
+ * The log likelihood kernel alone, over `range(1)` pairs, for each
+ * instruction set the CPU supports.
+ */
+static void BM_poisson_pairs_kernel(benchmark::State &state) {
+  auto level = static_cast<simd_level_t>(state.range(0));
+  if (level > detect_simd_level()) {
+    state.SkipWithError("Not supported by this CPU");
+    return;
+  }
+
+  auto            pair_count = static_cast<size_t>(state.range(1));
+  constexpr int   teams      = 1000;
+  poisson_pairs_t pairs;
+  for (size_t i = 0; i < pair_count; ++i) {
+    pairs.l_team.push_back(static_cast<int32_t>(i % teams));
+    pairs.r_team.push_back(static_cast<int32_t>((i * 7 + 1) % teams));
+    pairs.matches.push_back(static_cast<double>(1 + i % 3));
+    pairs.l_goals.push_back(static_cast<double>(i % 5));
+    pairs.r_goals.push_back(static_cast<double>(i % 4));
+  }
+  params_t team_strs(teams + 1);
+  for (size_t i = 0; i < team_strs.size(); ++i) {
+    team_strs[i] = 0.001 * static_cast<double>(i % 100);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(poisson_pairs_log_likelihood(
+        pairs, team_strs, 0, pairs.size(), level));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(pair_count));
+}
+
+BENCHMARK(BM_poisson_pairs_kernel)
+    ->ArgsProduct({{static_cast<int64_t>(simd_level_t::scalar),
+                    static_cast<int64_t>(simd_level_t::avx2),
+                    static_cast<int64_t>(simd_level_t::avx512)},
+                   {1 << 10, 1 << 16, 1 << 20}});
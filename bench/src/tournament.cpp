@@ -1,5 +1,6 @@
 #include <benchmark/benchmark.h>
 #include <bits/stdint-uintn.h>
+#include <cmath>
 #include <cstddef>
 #include <tournament.hpp>
 #include <util.hpp>
@@ -242,5 +243,30 @@ static void BM_skellam_cmf(benchmark::State &state) {
   for (auto _ : state) { benchmark::DoNotOptimize(skellam_cmf(k, u1, u2)); }
 }
 
+/* Win, tie and loss probabilities for a match with a strength difference of
+ * `range(0)` tenths, the way the Poisson model generates them */
+static auto skellam_match_rates(benchmark::State &state)
+    -> std::pair<double, double> {
+  double d = static_cast<double>(state.range(0)) / 10.0;
+  return {std::exp(d), std::exp(-d)};
+}
+
+static void BM_skellam_match_series(benchmark::State &state) {
+  auto [u1, u2] = skellam_match_rates(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(skellam_cmf(-1, u2, u1));
+    benchmark::DoNotOptimize(skellam_pmf(0, u2, u1));
+  }
+}
+
+static void BM_skellam_match_outcomes(benchmark::State &state) {
+  auto [u1, u2] = skellam_match_rates(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(skellam_outcome_probs(u1, u2));
+  }
+}
+
 BENCHMARK(BM_skellam_pmf)->DenseRange(-3, 3, 1);
 BENCHMARK(BM_skellam_cmf)->DenseRange(-3, 3, 1);
+BENCHMARK(BM_skellam_match_series)->DenseRange(0, 30, 10);
+BENCHMARK(BM_skellam_match_outcomes)->DenseRange(0, 30, 10);
@@ -0,0 +1,87 @@
+#include "checkpoint.hpp"
+
+#include <cstring>
+#include <fstream>
+
+constexpr char checkpoint_magic[] = "PHYCHKP1";
+
+void write_binary_string(std::ostream &os, const std::string &s) {
+  write_binary_vector(os, std::vector<char>(s.begin(), s.end()));
+}
+
+auto read_binary_string(std::istream &is) -> std::string {
+  auto v = read_binary_vector<char>(is);
+  return {v.begin(), v.end()};
+}
+
+void chain_checkpoint_t::write(const std::filesystem::path &path) const {
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+    os.write(checkpoint_magic, sizeof(checkpoint_magic) - 1);
+    write_binary_value(os, iters);
+    write_binary_value(os, burnin_iters);
+    write_binary_vector(os, params);
+    write_binary_value(os, cur_lh);
+    write_binary_string(os, rng_state);
+    write_binary_value(os, step);
+    write_binary_value(os, successes);
+    write_binary_value(os, samples);
+    write_binary_string(os, proposal_state);
+    write_binary_value(os, result_count);
+    write_binary_value<uint64_t>(os, outputs.size());
+    for (const auto &[output_path, size] : outputs) {
+      write_binary_string(os, output_path);
+      write_binary_value<uint64_t>(os, size);
+    }
+    if (!os) {
+      throw std::runtime_error{"Failed to write checkpoint " +
+                               tmp_path.string()};
+    }
+  }
+  std::filesystem::rename(tmp_path, path);
+}
+
+auto chain_checkpoint_t::read(const std::filesystem::path &path)
+    -> chain_checkpoint_t {
+  std::ifstream is(path, std::ios::binary);
+  if (!is) {
+    throw std::runtime_error{"Failed to open checkpoint " + path.string()};
+  }
+  char magic[sizeof(checkpoint_magic) - 1];
+  is.read(magic, sizeof(magic));
+  if (!is || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) {
+    throw std::runtime_error{path.string() + " is not a checkpoint"};
+  }
+
+  chain_checkpoint_t cp;
+  cp.iters          = read_binary_value<uint64_t>(is);
+  cp.burnin_iters   = read_binary_value<uint64_t>(is);
+  cp.params         = read_binary_vector<double>(is);
+  cp.cur_lh         = read_binary_value<double>(is);
+  cp.rng_state      = read_binary_string(is);
+  cp.step           = read_binary_value<uint64_t>(is);
+  cp.successes      = read_binary_value<uint64_t>(is);
+  cp.samples        = read_binary_value<uint64_t>(is);
+  cp.proposal_state = read_binary_string(is);
+  cp.result_count   = read_binary_value<uint64_t>(is);
+  auto output_count = read_binary_value<uint64_t>(is);
+  for (uint64_t i = 0; i < output_count; ++i) {
+    auto output_path = read_binary_string(is);
+    auto size        = read_binary_value<uint64_t>(is);
+    cp.outputs.emplace_back(output_path, size);
+  }
+  return cp;
+}
+
+void chain_checkpoint_t::truncate_outputs() const {
+  for (const auto &[path, size] : outputs) {
+    if (!std::filesystem::exists(path) ||
+        std::filesystem::file_size(path) < size) {
+      throw std::runtime_error{"Output file " + path +
+                               " is shorter than at the checkpoint"};
+    }
+    std::filesystem::resize_file(path, size);
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "util.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Helpers to write plain values and vectors of them in binary form.
+ */
+template <typename T> void write_binary_value(std::ostream &os, const T &v) {
+  os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <typename T> auto read_binary_value(std::istream &is) -> T {
+  T v{};
+  is.read(reinterpret_cast<char *>(&v), sizeof(T));
+  if (!is) { throw std::runtime_error{"Unexpected end of binary data"}; }
+  return v;
+}
+
+template <typename T>
+void write_binary_vector(std::ostream &os, const std::vector<T> &v) {
+  write_binary_value<uint64_t>(os, v.size());
+  os.write(reinterpret_cast<const char *>(v.data()),
+           static_cast<std::streamsize>(v.size() * sizeof(T)));
+}
+
+template <typename T>
+auto read_binary_vector(std::istream &is) -> std::vector<T> {
+  std::vector<T> v(read_binary_value<uint64_t>(is));
+  is.read(reinterpret_cast<char *>(v.data()),
+          static_cast<std::streamsize>(v.size() * sizeof(T)));
+  if (!is) { throw std::runtime_error{"Unexpected end of binary data"}; }
+  return v;
+}
+
+void write_binary_string(std::ostream &os, const std::string &s);
+auto read_binary_string(std::istream &is) -> std::string;
+
+/**
+ * The complete state of a random walk chain, along with the state of its
+ * outputs, so that an interrupted run can continue exactly where it was
+ * checkpointed.
+ */
+struct chain_checkpoint_t {
+  /* Settings of the run, to check that a resumed run matches */
+  uint64_t iters;
+  uint64_t burnin_iters;
+
+  /* State of the chain. `step` is the next step to take. */
+  params_t    params;
+  double      cur_lh;
+  std::string rng_state;
+  uint64_t    step;
+  uint64_t    successes;
+  uint64_t    samples;
+  std::string proposal_state;
+
+  /* State of the results, and the size of every output file */
+  uint64_t                                       result_count;
+  std::vector<std::pair<std::string, uintmax_t>> outputs;
+
+  /**
+   * Write the checkpoint to `path`. The file is replaced atomically, so an
+   * interruption leaves the previous checkpoint intact.
+   */
+  void write(const std::filesystem::path &path) const;
+
+  static auto read(const std::filesystem::path &path) -> chain_checkpoint_t;
+
+  /**
+   * Cut the output files back to their size at the checkpoint, discarding
+   * anything written after it.
+   */
+  void truncate_outputs() const;
+};
+
+template <typename Engine> auto save_engine(const Engine &gen) -> std::string {
+  std::ostringstream os;
+  os << gen;
+  return os.str();
+}
+
+template <typename Engine>
+void restore_engine(Engine &gen, const std::string &state) {
+  std::istringstream is(state);
+  is >> gen;
+  if (!is) { throw std::runtime_error{"Failed to restore the RNG state"}; }
+}
+
+#endif
@@ -255,6 +255,11 @@ static cli_option_t args[] = {
                                       "Odds of teams winning as a csv file"),
     option_with_argument<std::string>(
         "probs", "Pairwise win probabilities as a csv file"),
+    option_with_argument<std::string>(
+        "samples-file",
+        "Evaluate the posterior samples in this .samples.params.bin file, "
+        "written by an earlier MCMC run, instead of running MCMC. Requires "
+        "the matches of the earlier run"),
     option_flag("single", "Compute the tournament in single mode."),
     option_flag("sim", "Compute the tournament in simulation mode."),
     option_flag("dynamic", "Enable or disable dynamic computation"),
@@ -264,16 +269,111 @@ static cli_option_t args[] = {
         "samples", "Number of samples to take for the MCMC exploration"),
     option_with_argument<double>(
         "burnin", "Proportion of samples to discard for MCMC burnin"),
+    option_with_argument<size_t>(
+        "chains",
+        "Number of independent MCMC chains to run concurrently. The samples "
+        "are split between the chains"),
+    option_with_argument<size_t>(
+        "temperatures",
+        "Use parallel tempering with this many replicas per chain. Only the "
+        "cold replica is sampled"),
+    option_with_argument<double>(
+        "max-temperature",
+        "Temperature of the hottest replica for parallel tempering. The "
+        "ladder is geometric between 1 and this value. Default is 10"),
+    option_flag("hmc",
+                "Sample with Hamiltonian Monte Carlo instead of a random walk. "
+                "Requires the Poisson model"),
+    option_with_argument<size_t>(
+        "leapfrog-steps",
+        "Number of leapfrog steps per HMC trajectory. Default is 20"),
+    option_flag("adapt",
+                "Tune the scale of the MCMC proposal for each parameter during "
+                "burnin"),
+    option_with_argument<double>(
+        "target-acceptance",
+        "Acceptance rate targeted by the proposal tuning. Default is 0.44"),
+    option_flag("adaptive-covariance",
+                "Also learn the covariance of the parameters during burnin, "
+                "and use it for block proposals. Implies --adapt, and "
+                "requires the Poisson model"),
+    option_with_argument<size_t>(
+        "eval-threads",
+        "Evaluate the tournament for recorded samples on this many worker "
+        "threads per chain, so the chains do not wait for the evaluation. "
+        "Default is 0, which evaluates on the chain's thread"),
+    option_with_argument<size_t>(
+        "checkpoint-interval",
+        "Write a checkpoint of the MCMC chain every this many samples, so the "
+        "run can be continued with --resume. Default is 0, no checkpoints"),
+    option_flag("resume",
+                "Continue an interrupted MCMC run from its last checkpoint, "
+                "appending to its sample files. Use the same options as the "
+                "interrupted run"),
+    option_flag("diagnostics",
+                "Track the effective sample size, Monte Carlo standard error "
+                "and split R-hat of every win probability while sampling, and "
+                "write them to a json file"),
+    option_with_argument<size_t>(
+        "diagnostics-interval",
+        "Log a summary of the diagnostics every this many samples. Default "
+        "is 1000"),
+    option_with_argument<double>(
+        "target-ess",
+        "Stop sampling once every win probability has at least this "
+        "effective sample size. --samples becomes the maximum. Implies "
+        "--diagnostics"),
+    option_with_argument<double>(
+        "target-mcse",
+        "Stop sampling once the Monte Carlo standard error of every win "
+        "probability is at most this. --samples becomes the maximum. Implies "
+        "--diagnostics"),
+    option_flag("optimize",
+                "Instead of sampling, find the maximum a posteriori parameters "
+                "and write the tournament win probabilities they give"),
+    option_flag("warm-start",
+                "Find the maximum a posteriori parameters first, and start the "
+                "MCMC chains from them"),
+    option_flag("laplace",
+                "Instead of running MCMC chains, draw the samples from a "
+                "normal approximation of the posterior at the maximum a "
+                "posteriori parameters. Much faster, but only approximate. "
+                "Requires the Poisson model"),
+    option_with_argument<size_t>(
+        "bootstrap",
+        "Instead of sampling, fit this many bootstrap replicates of the match "
+        "history by maximum a posteriori optimization, and summarise the "
+        "win probabilities they give. Default is 0, no bootstrap"),
     option_with_argument<bool>(
         "poisson", "Use a Poisson based liklihood model for the MCMC search"),
     option_with_argument<std::string>(
         "bestofs",
         "Set the number of best ofs for the tournament. Given as a comma "
         "separated list."),
+    option_with_argument<std::string>(
+        "groups",
+        "File describing a group stage played before the knockout bracket. "
+        "Dynamic mode only, and with matches only together with --optimize"),
     option_flag(
         "node-probs",
         "Record node probabilities in addition to tournament probabilities"),
     option_flag("sample-matrix", "Sample the matrix during the MCMC search"),
+    option_flag("meeting-probs",
+                "Write the probability that each pair of teams meet in each "
+                "round as a binary file (dynamic mode with probs or odds)"),
+    option_with_argument<double>(
+        "prune-epsilon",
+        "Approximate the dynamic mode by dropping win probabilities below "
+        "this threshold at every match. A bound on the error is reported."),
+    option_with_argument<std::string>(
+        "pool-points",
+        "Points for a correct pick in each round of a bracket pool, first "
+        "round first. Given as a comma separated list. Enables computing the "
+        "optimal pool bracket in dynamic mode."),
+    option_with_argument<std::string>(
+        "pool-bracket",
+        "Bracket to score with the pool points. Each line lists the winners "
+        "of one round, comma separated, first round first."),
     option_flag("dummy", "Make dummy data"),
     option_flag("verbose", "Enable more output"),
     option_flag("debug", "Enable debug output"),
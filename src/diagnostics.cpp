@@ -0,0 +1,284 @@
+#include "diagnostics.hpp"
+
+#include "debug.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/* Batches are merged pairwise when there are more than this many, so there
+ * are always between half this and this many batches. */
+constexpr size_t max_batches = 64;
+
+/* Batch means of very small batches ignore most of the autocorrelation, so
+ * the asymptotic variance is not estimated until the batches are this big. */
+constexpr size_t min_batch_size = 16;
+
+void batch_statistics_t::add(double x) {
+  if (_count == 0) { _shift = x; }
+  double y = x - _shift;
+  if (_count > 0) { _lag_sum += _last * y; }
+  _last   = y;
+  _count += 1;
+
+  if (_batches.empty() || _batches.back().count == _batch_size) {
+    _batches.emplace_back();
+  }
+  auto &b   = _batches.back();
+  b.sum    += y;
+  b.sum_sq += y * y;
+  b.count  += 1;
+
+  if (_batches.size() > max_batches) { merge_batches(); }
+}
+
+void batch_statistics_t::merge_batches() {
+  std::vector<batch_t> merged;
+  merged.reserve(_batches.size() / 2 + 1);
+  for (size_t i = 0; i < _batches.size(); i += 2) {
+    batch_t b = _batches[i];
+    if (i + 1 < _batches.size()) {
+      b.sum    += _batches[i + 1].sum;
+      b.sum_sq += _batches[i + 1].sum_sq;
+      b.count  += _batches[i + 1].count;
+    }
+    merged.push_back(b);
+  }
+  _batches     = std::move(merged);
+  _batch_size *= 2;
+}
+
+auto batch_statistics_t::summarize(const batch_t &b) -> sample_summary_t {
+  sample_summary_t s;
+  s.count = b.count;
+  if (b.count == 0) { return s; }
+  auto n = static_cast<double>(b.count);
+  s.mean = b.sum / n;
+  if (b.count > 1) {
+    s.variance = std::max(0.0, (b.sum_sq - b.sum * s.mean) / (n - 1));
+  }
+  return s;
+}
+
+auto batch_statistics_t::summary() const -> sample_summary_t {
+  batch_t total;
+  for (const auto &b : _batches) {
+    total.sum    += b.sum;
+    total.sum_sq += b.sum_sq;
+    total.count  += b.count;
+  }
+  auto s  = summarize(total);
+  s.mean += _shift;
+  return s;
+}
+
+auto batch_statistics_t::asymptotic_variance() const -> std::optional<double> {
+  if (_batch_size < min_batch_size) { return {}; }
+
+  size_t full = _batches.size();
+  if (_batches.back().count != _batch_size) { full -= 1; }
+  if (full < 2) { return {}; }
+
+  auto   b    = static_cast<double>(_batch_size);
+  double mean = 0.0;
+  for (size_t i = 0; i < full; ++i) { mean += _batches[i].sum / b; }
+  mean /= static_cast<double>(full);
+
+  double ss = 0.0;
+  for (size_t i = 0; i < full; ++i) {
+    double d  = _batches[i].sum / b - mean;
+    ss       += d * d;
+  }
+  return b * ss / static_cast<double>(full - 1);
+}
+
+auto batch_statistics_t::lag1_autocorrelation() const -> double {
+  if (_count < 3) { return 0.0; }
+  auto s = summary();
+  if (s.variance == 0.0) { return 0.0; }
+  double mean = s.mean - _shift;
+  return (_lag_sum / static_cast<double>(_count - 1) - mean * mean) /
+         s.variance;
+}
+
+auto batch_statistics_t::halves() const
+    -> std::pair<sample_summary_t, sample_summary_t> {
+  size_t full = _batches.size();
+  if (full > 0 && _batches.back().count != _batch_size) { full -= 1; }
+  size_t half = full / 2;
+
+  batch_t first, second;
+  for (size_t i = 0; i < half; ++i) {
+    first.sum     += _batches[i].sum;
+    first.sum_sq  += _batches[i].sum_sq;
+    first.count   += _batches[i].count;
+    second.sum    += _batches[half + i].sum;
+    second.sum_sq += _batches[half + i].sum_sq;
+    second.count  += _batches[half + i].count;
+  }
+  auto a  = summarize(first);
+  auto b  = summarize(second);
+  a.mean += _shift;
+  b.mean += _shift;
+  return {a, b};
+}
+
+convergence_monitor_t::convergence_monitor_t(std::vector<std::string> names,
+                                             stopping_rule_t          rule) :
+    _names{std::move(names)}, _rule{rule} {}
+
+void convergence_monitor_t::add(size_t                     chain,
+                                const std::vector<double> &values) {
+  if (chain >= _chains.size()) {
+    _chains.resize(chain + 1, std::vector<batch_statistics_t>(_names.size()));
+  }
+  for (size_t q = 0; q < _names.size() && q < values.size(); ++q) {
+    _chains[chain][q].add(values[q]);
+  }
+}
+
+auto convergence_monitor_t::diagnose(size_t quantity) const
+    -> quantity_diagnostics_t {
+  constexpr double infinity = std::numeric_limits<double>::infinity();
+
+  quantity_diagnostics_t d{_names[quantity], 0.0, 0.0, 0.0, 0.0, {}};
+
+  double total_count      = 0.0;
+  double mean_variance    = 0.0;
+  bool   variance_unknown = false;
+  std::vector<sample_summary_t> split;
+
+  for (const auto &chain : _chains) {
+    const auto &stats = chain[quantity];
+    if (stats.count() == 0) { continue; }
+    auto s = stats.summary();
+    auto n = static_cast<double>(s.count);
+    total_count       += n;
+    d.mean            += n * s.mean;
+    d.autocorrelation += n * stats.lag1_autocorrelation();
+
+    auto asymptotic = stats.asymptotic_variance();
+    if (s.variance == 0.0) {
+      d.ess += n;
+    } else if (asymptotic.has_value() && asymptotic.value() > 0.0) {
+      d.ess         += n * s.variance / asymptotic.value();
+      mean_variance += n * asymptotic.value();
+    } else {
+      variance_unknown = true;
+    }
+
+    auto [first, second] = stats.halves();
+    if (first.count > 1) {
+      split.push_back(first);
+      split.push_back(second);
+    }
+  }
+
+  if (total_count == 0.0) {
+    d.mcse = infinity;
+    return d;
+  }
+  d.mean            /= total_count;
+  d.autocorrelation /= total_count;
+  d.mcse =
+      variance_unknown ? infinity : std::sqrt(mean_variance) / total_count;
+
+  if (split.size() >= 2) {
+    double m = static_cast<double>(split.size());
+    double n = 0.0, w = 0.0, grand_mean = 0.0;
+    for (const auto &s : split) {
+      n          += static_cast<double>(s.count);
+      w          += s.variance;
+      grand_mean += s.mean;
+    }
+    n          /= m;
+    w          /= m;
+    grand_mean /= m;
+    double b = 0.0;
+    for (const auto &s : split) {
+      b += (s.mean - grand_mean) * (s.mean - grand_mean);
+    }
+    b *= n / (m - 1);
+    if (w > 0.0) {
+      d.rhat = std::sqrt(((n - 1) / n * w + b / n) / w);
+    } else if (b == 0.0) {
+      d.rhat = 1.0;
+    }
+  }
+  return d;
+}
+
+auto convergence_monitor_t::diagnostics() const
+    -> std::vector<quantity_diagnostics_t> {
+  std::vector<quantity_diagnostics_t> ret;
+  ret.reserve(_names.size());
+  for (size_t q = 0; q < _names.size(); ++q) { ret.push_back(diagnose(q)); }
+  return ret;
+}
+
+auto convergence_monitor_t::converged() const -> bool {
+  if (!_rule.enabled()) { return false; }
+  for (const auto &d : diagnostics()) {
+    if (_rule.target_ess.has_value() && d.ess < _rule.target_ess.value()) {
+      return false;
+    }
+    if (_rule.target_mcse.has_value() && d.mcse > _rule.target_mcse.value()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void convergence_monitor_t::report() const {
+  auto diag = diagnostics();
+  if (diag.empty()) { return; }
+  auto min_ess = std::min_element(
+      diag.begin(), diag.end(), [](const auto &a, const auto &b) {
+        return a.ess < b.ess;
+      });
+  auto max_mcse = std::max_element(
+      diag.begin(), diag.end(), [](const auto &a, const auto &b) {
+        return a.mcse < b.mcse;
+      });
+  double max_rhat = 0.0;
+  for (const auto &d : diag) {
+    if (d.rhat.has_value()) { max_rhat = std::max(max_rhat, d.rhat.value()); }
+  }
+  debug_print(EMIT_LEVEL_PROGRESS,
+              "Min ESS: %.0f (%s), max MCSE: %.2e (%s), max split R-hat: %.3f",
+              min_ess->ess,
+              min_ess->name.c_str(),
+              max_mcse->mcse,
+              max_mcse->name.c_str(),
+              max_rhat);
+}
+
+static void write_json_number(std::ostream &os, double value) {
+  if (std::isfinite(value)) {
+    os << value;
+  } else {
+    os << "null";
+  }
+}
+
+void convergence_monitor_t::write_json(std::ostream &os) const {
+  os << "{\"converged\": " << (converged() ? "true" : "false")
+     << ", \"quantities\": [";
+  auto diag = diagnostics();
+  for (size_t i = 0; i < diag.size(); ++i) {
+    const auto &d = diag[i];
+    if (i != 0) { os << ", "; }
+    os << "{\"name\": \"" << d.name << "\", \"mean\": ";
+    write_json_number(os, d.mean);
+    os << ", \"ess\": ";
+    write_json_number(os, d.ess);
+    os << ", \"mcse\": ";
+    write_json_number(os, d.mcse);
+    os << ", \"lag1-autocorrelation\": ";
+    write_json_number(os, d.autocorrelation);
+    os << ", \"split-rhat\": ";
+    write_json_number(
+        os, d.rhat.value_or(std::numeric_limits<double>::quiet_NaN()));
+    os << "}";
+  }
+  os << "]}";
+}
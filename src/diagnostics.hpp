@@ -0,0 +1,136 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Summary statistics of a stretch of samples.
+ */
+struct sample_summary_t {
+  size_t count    = 0;
+  double mean     = 0.0;
+  double variance = 0.0;
+};
+
+/**
+ * Streaming statistics of one scalar quantity of one chain.
+ *
+ * The samples are grouped into batches, whose size doubles whenever there are
+ * too many of them, so the memory used stays constant. The variance of the
+ * batch means estimates the variance of the chain's mean (the batch means
+ * method), which gives the effective sample size and the Monte Carlo standard
+ * error.
+ */
+class batch_statistics_t {
+public:
+  void add(double x);
+
+  [[nodiscard]] auto count() const -> size_t { return _count; }
+  [[nodiscard]] auto summary() const -> sample_summary_t;
+
+  /**
+   * Estimate of the asymptotic variance, `n` times the variance of the mean of
+   * `n` samples. Nothing if there are too few batches.
+   */
+  [[nodiscard]] auto asymptotic_variance() const -> std::optional<double>;
+
+  [[nodiscard]] auto lag1_autocorrelation() const -> double;
+
+  /**
+   * Summaries of the first and second half of the samples, for split R-hat.
+   * The halves are made of whole batches.
+   */
+  [[nodiscard]] auto halves() const
+      -> std::pair<sample_summary_t, sample_summary_t>;
+
+private:
+  struct batch_t {
+    double sum    = 0.0;
+    double sum_sq = 0.0;
+    size_t count  = 0;
+  };
+
+  static auto summarize(const batch_t &b) -> sample_summary_t;
+  void        merge_batches();
+
+  std::vector<batch_t> _batches;
+  size_t               _batch_size{1};
+
+  /* Samples are shifted by the first sample, to keep the sums of squares from
+   * cancelling for quantities far from 0, like the log likelihood. */
+  double _shift{0.0};
+  double _last{0.0};
+  double _lag_sum{0.0};
+  size_t _count{0};
+};
+
+/**
+ * Convergence diagnostics of one quantity, pooled over every chain.
+ */
+struct quantity_diagnostics_t {
+  std::string name;
+  double      mean;
+  double      ess;
+  double      mcse;
+  double      autocorrelation;
+
+  /* Split R-hat, only when there are enough samples */
+  std::optional<double> rhat;
+};
+
+/**
+ * When sampling may stop. Sampling stops once every quantity satisfies every
+ * target that is set.
+ */
+struct stopping_rule_t {
+  std::optional<double> target_ess;
+  std::optional<double> target_mcse;
+
+  [[nodiscard]] auto enabled() const -> bool {
+    return target_ess.has_value() || target_mcse.has_value();
+  }
+};
+
+/**
+ * Tracks the convergence of named quantities across several chains as samples
+ * arrive.
+ */
+class convergence_monitor_t {
+public:
+  convergence_monitor_t(std::vector<std::string> names, stopping_rule_t rule);
+
+  /**
+   * Add the values of every quantity for one sample of `chain`.
+   */
+  void add(size_t chain, const std::vector<double> &values);
+
+  [[nodiscard]] auto diagnostics() const
+      -> std::vector<quantity_diagnostics_t>;
+
+  /**
+   * True once every quantity meets the stopping rule. Always false if the rule
+   * has no targets.
+   */
+  [[nodiscard]] auto converged() const -> bool;
+
+  /**
+   * Log a one line summary of the worst quantities.
+   */
+  void report() const;
+
+  void write_json(std::ostream &os) const;
+
+private:
+  [[nodiscard]] auto diagnose(size_t quantity) const -> quantity_diagnostics_t;
+
+  std::vector<std::string>                     _names;
+  stopping_rule_t                              _rule;
+  std::vector<std::vector<batch_statistics_t>> _chains;
+};
+
+#endif
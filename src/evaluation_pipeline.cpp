@@ -0,0 +1,111 @@
+#include "evaluation_pipeline.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+evaluation_pipeline_t::evaluation_pipeline_t(results_t  &results,
+                                             size_t      workers,
+                                             size_t      capacity,
+                                             evaluator_t evaluate) :
+    _results{results}, _evaluate{std::move(evaluate)}, _capacity{capacity} {
+  if (workers == 0) {
+    throw std::runtime_error{"The evaluation pipeline needs a worker"};
+  }
+  if (capacity == 0) {
+    throw std::runtime_error{"The evaluation queue needs a capacity"};
+  }
+  _workers.reserve(workers);
+  for (size_t w = 0; w < workers; ++w) {
+    _workers.emplace_back([this, w]() { work(w); });
+  }
+}
+
+evaluation_pipeline_t::~evaluation_pipeline_t() { stop(); }
+
+void evaluation_pipeline_t::push(params_t params, double llh, size_t chain) {
+  std::unique_lock<std::mutex> lock(_queue_mutex);
+  _not_full.wait(lock, [this]() {
+    return _queue.size() < _capacity || _closed || _error;
+  });
+  if (_error) { std::rethrow_exception(_error); }
+  if (_closed) {
+    throw std::runtime_error{"Pushed a sample to a finished pipeline"};
+  }
+  _queue.push_back({_pushed++, std::move(params), llh, chain});
+  lock.unlock();
+  _not_empty.notify_one();
+}
+
+void evaluation_pipeline_t::drain() {
+  {
+    std::unique_lock<std::mutex> lock(_deliver_mutex);
+    _delivered.wait(
+        lock, [this]() { return _next_index == _pushed || _worker_failed; });
+  }
+  std::lock_guard<std::mutex> lock(_queue_mutex);
+  if (_error) { std::rethrow_exception(_error); }
+}
+
+void evaluation_pipeline_t::finish() {
+  stop();
+  if (_error) { std::rethrow_exception(_error); }
+}
+
+void evaluation_pipeline_t::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_queue_mutex);
+    _closed = true;
+  }
+  _not_empty.notify_all();
+  _not_full.notify_all();
+  for (auto &w : _workers) {
+    if (w.joinable()) { w.join(); }
+  }
+}
+
+void evaluation_pipeline_t::work(size_t worker) {
+  for (;;) {
+    pending_sample_t sample;
+    {
+      std::unique_lock<std::mutex> lock(_queue_mutex);
+      _not_empty.wait(lock, [this]() { return !_queue.empty() || _closed; });
+      if (_queue.empty() || _error) { return; }
+      sample = std::move(_queue.front());
+      _queue.pop_front();
+    }
+    _not_full.notify_one();
+
+    try {
+      deliver(sample.index, _evaluate(worker, sample));
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        if (!_error) { _error = std::current_exception(); }
+      }
+      {
+        std::lock_guard<std::mutex> lock(_deliver_mutex);
+        _worker_failed = true;
+      }
+      _not_full.notify_all();
+      _not_empty.notify_all();
+      _delivered.notify_all();
+      return;
+    }
+  }
+}
+
+/**
+ * Results can finish out of order, so they are held back until every earlier
+ * sample has been added to the results.
+ */
+void evaluation_pipeline_t::deliver(size_t index, result_t &&result) {
+  std::lock_guard<std::mutex> lock(_deliver_mutex);
+  _out_of_order.emplace(index, std::move(result));
+  for (auto it = _out_of_order.begin();
+       it != _out_of_order.end() && it->first == _next_index;
+       it = _out_of_order.erase(it)) {
+    _results.add_result(std::move(it->second));
+    _next_index += 1;
+  }
+  _delivered.notify_all();
+}
@@ -0,0 +1,107 @@
+#ifndef EVALUATION_PIPELINE_HPP
+#define EVALUATION_PIPELINE_HPP
+
+#include "results.hpp"
+#include "util.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A sample taken by a chain, which has not been evaluated yet.
+ */
+struct pending_sample_t {
+  size_t   index;
+  params_t params;
+  double   llh;
+  size_t   chain;
+};
+
+/**
+ * Evaluates recorded samples on a pool of worker threads, so that a chain does
+ * not wait for the tournament evaluation of every sample it records.
+ *
+ * Samples are pushed into a bounded queue. Each worker takes samples from the
+ * queue, and evaluates them with `evaluate`, passing its own worker index so
+ * that it can use state owned by that worker (e.g. a tournament). The results
+ * are added to `results` in the order the samples were pushed.
+ *
+ * The chain only blocks when the queue is full, which keeps the memory used by
+ * pending samples bounded when the workers fall behind.
+ */
+class evaluation_pipeline_t {
+public:
+  using evaluator_t =
+      std::function<result_t(size_t worker, const pending_sample_t &sample)>;
+
+  evaluation_pipeline_t(results_t  &results,
+                        size_t      workers,
+                        size_t      capacity,
+                        evaluator_t evaluate);
+
+  evaluation_pipeline_t(const evaluation_pipeline_t &) = delete;
+  auto operator=(const evaluation_pipeline_t &)
+      -> evaluation_pipeline_t & = delete;
+
+  /**
+   * Stops the workers. Samples which are still queued are evaluated first.
+   * Errors from the workers are dropped, call `finish` to see them.
+   */
+  ~evaluation_pipeline_t();
+
+  /**
+   * Queue a sample for evaluation. Blocks if the queue is full. Rethrows the
+   * error of a worker, if one has failed.
+   */
+  void push(params_t params, double llh, size_t chain);
+
+  /**
+   * Wait until every sample pushed so far has been added to the results. The
+   * workers keep running. Rethrows the first error from a worker.
+   */
+  void drain();
+
+  /**
+   * Wait for every queued sample to be evaluated and added to the results, and
+   * stop the workers. Rethrows the first error from a worker.
+   */
+  void finish();
+
+  /**
+   * Number of samples pushed so far.
+   */
+  [[nodiscard]] auto pushed() const -> size_t { return _pushed; }
+
+private:
+  void work(size_t worker);
+  void deliver(size_t index, result_t &&result);
+  void stop();
+
+  results_t  &_results;
+  evaluator_t _evaluate;
+  size_t      _capacity;
+  size_t      _pushed{0};
+
+  std::deque<pending_sample_t> _queue;
+  std::mutex                   _queue_mutex;
+  std::condition_variable      _not_empty;
+  std::condition_variable      _not_full;
+  bool                         _closed{false};
+  std::exception_ptr           _error;
+
+  std::map<size_t, result_t> _out_of_order;
+  size_t                     _next_index{0};
+  bool                       _worker_failed{false};
+  std::mutex                 _deliver_mutex;
+  std::condition_variable    _delivered;
+
+  std::vector<std::thread> _workers;
+};
+
+#endif
@@ -0,0 +1,1289 @@
+#include "group_stage.hpp"
+#include "factorial.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <omp.h>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+constexpr uint64_t WIN_POINTS       = 3;
+constexpr uint64_t DRAW_POINTS      = 1;
+constexpr size_t   POINTS_BITS      = 8;
+constexpr size_t   MAX_GROUP_SIZE   = 64 / POINTS_BITS;
+constexpr uint64_t POINTS_BITS_MASK = (1UL << POINTS_BITS) - 1;
+
+/* Every set of groups that can provide the best placed teams is visited on
+ * every evaluation, so there can not be too many of them */
+constexpr size_t MAX_BEST_PLACED_SETS = 10000;
+
+/* The largest number of keys of a factor of the knockout, see
+ * `knockout_pass_t` */
+constexpr size_t MAX_KNOCKOUT_STATES = 1UL << 18;
+
+/**
+ * The points of every team in a group, packed into a single integer so that
+ * identical point tables can be merged.
+ */
+using points_table_t = uint64_t;
+
+static auto get_points(points_table_t table, size_t team) -> size_t {
+  return (table >> (POINTS_BITS * team)) & POINTS_BITS_MASK;
+}
+
+static auto add_points(points_table_t table, size_t team, uint64_t points)
+    -> points_table_t {
+  return table + (points << (POINTS_BITS * team));
+}
+
+auto compute_group_standings(const std::vector<size_t> &teams,
+                             const matrix_t            &win_probs,
+                             const matrix_t            &draw_probs)
+    -> group_standings_t {
+  size_t team_count = teams.size();
+  if (team_count == 0 || team_count > MAX_GROUP_SIZE) {
+    throw std::runtime_error{"Groups must have between 1 and 8 teams"};
+  }
+
+  std::unordered_map<points_table_t, double> tables{{0, 1.0}};
+
+  for (size_t i = 0; i < team_count; ++i) {
+    for (size_t j = i + 1; j < team_count; ++j) {
+      size_t t1 = teams[i];
+      size_t t2 = teams[j];
+
+      double draw = draw_probs.empty() ? 0.0 : draw_probs.at(t1).at(t2);
+      double win  = std::max(win_probs.at(t1).at(t2) - draw / 2.0, 0.0);
+      double loss = std::max(win_probs.at(t2).at(t1) - draw / 2.0, 0.0);
+
+      std::unordered_map<points_table_t, double> next_tables;
+      for (const auto &[table, prob] : tables) {
+        if (win > 0.0) {
+          next_tables[add_points(table, i, WIN_POINTS)] += prob * win;
+        }
+        if (loss > 0.0) {
+          next_tables[add_points(table, j, WIN_POINTS)] += prob * loss;
+        }
+        if (draw > 0.0) {
+          next_tables[add_points(add_points(table, i, DRAW_POINTS),
+                                 j,
+                                 DRAW_POINTS)] += prob * draw;
+        }
+      }
+      tables = std::move(next_tables);
+    }
+  }
+
+  size_t max_points = WIN_POINTS * (team_count - 1);
+
+  group_standings_t standings;
+  standings.position_probs = matrix_t(team_count, vector_t(team_count));
+  standings.placed_points.resize(
+      team_count, matrix_t(team_count, vector_t(max_points + 1)));
+
+  std::vector<size_t> order(team_count);
+  std::vector<size_t> points_of(team_count);
+  standings.point_tables.reserve(tables.size());
+  for (const auto &[table, prob] : tables) {
+    for (size_t t = 0; t < team_count; ++t) {
+      points_of[t] = get_points(table, t);
+    }
+    standings.point_tables.emplace_back(points_of, prob);
+
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(
+        order.begin(), order.end(), [table = table](size_t a, size_t b) {
+          return get_points(table, a) > get_points(table, b);
+        });
+
+    /* Teams that are level on points share the positions they span equally */
+    for (size_t begin = 0; begin < team_count;) {
+      size_t points = get_points(table, order[begin]);
+      size_t end    = begin + 1;
+      while (end < team_count && get_points(table, order[end]) == points) {
+        ++end;
+      }
+
+      double share = prob / static_cast<double>(end - begin);
+      for (size_t k = begin; k < end; ++k) {
+        for (size_t pos = begin; pos < end; ++pos) {
+          standings.position_probs[order[k]][pos]        += share;
+          standings.placed_points[pos][order[k]][points] += share;
+        }
+      }
+      begin = end;
+    }
+  }
+
+  return standings;
+}
+
+/**
+ * The number of ways to choose `k` of `n` items, saturated at `limit`.
+ */
+static auto choose(size_t n, size_t k, size_t limit) -> size_t {
+  k            = std::min(k, n - k);
+  double count = 1.0;
+  for (size_t i = 0; i < k; ++i) {
+    count = count * static_cast<double>(n - i) / static_cast<double>(i + 1);
+    if (count > static_cast<double>(limit)) { return limit; }
+  }
+  return static_cast<size_t>(std::round(count));
+}
+
+/**
+ * Multiply the polynomial `poly` by (constant + x * linear).
+ */
+static void multiply(vector_t &poly, double constant, double linear) {
+  poly.push_back(0.0);
+  for (size_t i = poly.size() - 1; i > 0; --i) {
+    poly[i] = poly[i] * constant + poly[i - 1] * linear;
+  }
+  poly[0] *= constant;
+}
+
+group_tournament_t::group_tournament_t(std::vector<std::vector<size_t>> groups,
+                                       std::vector<knockout_slot_t>     slots,
+                                       size_t best_placed_position) :
+    _groups{std::move(groups)},
+    _slots{std::move(slots)},
+    _best_placed_position{best_placed_position},
+    _team_count{0} {
+
+  if (_slots.size() < 2 || (_slots.size() & (_slots.size() - 1)) != 0) {
+    throw std::runtime_error{
+        "The number of knockout slots must be a power of 2"};
+  }
+
+  for (const auto &g : _groups) {
+    for (auto t : g) { _team_count = std::max(_team_count, t + 1); }
+  }
+
+  _outcome_positions.resize(_groups.size());
+  for (size_t s = 0; s < _slots.size(); ++s) {
+    const auto &slot = _slots[s];
+    if (slot.best_placed) {
+      _best_placed_slots.push_back(s);
+      continue;
+    }
+    if (slot.group >= _groups.size() ||
+        slot.position >= _groups[slot.group].size()) {
+      throw std::runtime_error{"Knockout slot refers to a missing group team"};
+    }
+    _outcome_positions[slot.group].push_back(slot.position);
+  }
+
+  if (!_best_placed_slots.empty()) {
+    if (_groups.size() > 64) {
+      throw std::runtime_error{"Too many groups for best placed slots"};
+    }
+    if (_best_placed_slots.size() > _groups.size()) {
+      throw std::runtime_error{"More best placed slots than groups"};
+    }
+    if (choose(_groups.size(),
+               _best_placed_slots.size(),
+               MAX_BEST_PLACED_SETS + 1) > MAX_BEST_PLACED_SETS) {
+      throw std::runtime_error{
+          "Too many sets of groups can provide the best placed teams"};
+    }
+    for (size_t g = 0; g < _groups.size(); ++g) {
+      if (_groups[g].size() <= _best_placed_position) {
+        throw std::runtime_error{
+            "Every group needs a team in the best placed position"};
+      }
+      _outcome_positions[g].push_back(_best_placed_position);
+    }
+  }
+
+  for (auto &positions : _outcome_positions) {
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+  }
+  _slot_outcome_index.resize(_slots.size());
+  for (size_t s = 0; s < _slots.size(); ++s) {
+    const auto &slot = _slots[s];
+    if (slot.best_placed) { continue; }
+    const auto &positions  = _outcome_positions[slot.group];
+    _slot_outcome_index[s] = static_cast<size_t>(
+        std::lower_bound(positions.begin(), positions.end(), slot.position) -
+        positions.begin());
+  }
+  _placed_outcome_index.assign(_groups.size(), 0);
+  if (!_best_placed_slots.empty()) {
+    for (size_t g = 0; g < _groups.size(); ++g) {
+      const auto &positions    = _outcome_positions[g];
+      _placed_outcome_index[g] = static_cast<size_t>(
+          std::lower_bound(
+              positions.begin(), positions.end(), _best_placed_position) -
+          positions.begin());
+    }
+  }
+
+  check_knockout_states();
+}
+
+void group_tournament_t::set_best_placed_table(
+    std::map<uint64_t, std::vector<size_t>> table) {
+  _best_placed_table = std::move(table);
+  check_knockout_states();
+}
+
+void group_tournament_t::set_bestof(const std::vector<size_t> &bestof) {
+  size_t rounds = 0;
+  while ((1UL << rounds) < _slots.size()) { ++rounds; }
+  if (bestof.size() < rounds) {
+    throw std::runtime_error{"There are fewer best ofs than knockout rounds"};
+  }
+  _bestof = bestof;
+}
+
+auto group_tournament_t::eval(const matrix_t &win_probs,
+                              const matrix_t &draw_probs) -> vector_t {
+  if (win_probs.size() < _team_count) {
+    throw std::runtime_error{"The win probs do not cover every group team"};
+  }
+  _standings.clear();
+  _standings.reserve(_groups.size());
+  for (const auto &g : _groups) {
+    _standings.push_back(compute_group_standings(g, win_probs, draw_probs));
+  }
+
+  _slot_probs.assign(_slots.size(), vector_t(win_probs.size()));
+  for (size_t s = 0; s < _slots.size(); ++s) {
+    const auto &slot = _slots[s];
+    if (slot.best_placed) { continue; }
+    const auto &group = _groups[slot.group];
+    for (size_t t = 0; t < group.size(); ++t) {
+      _slot_probs[s].at(group[t]) =
+          _standings[slot.group].position_probs[t][slot.position];
+    }
+  }
+
+  if (!_best_placed_slots.empty()) { compute_best_placed_slots(); }
+
+  compute_group_outcomes();
+
+  vector_t wpv(win_probs.size(), 0.0);
+  if (_best_placed_slots.empty()) {
+    add_knockout(win_probs, 0, 0, wpv);
+    return wpv;
+  }
+
+  size_t point_count = 0;
+  for (const auto &outcomes : _outcomes) {
+    for (const auto &outcome : outcomes) {
+      point_count = std::max(point_count, outcome.placed_points + 1);
+    }
+  }
+  std::vector<uint64_t> masks;
+  std::vector<bool>     selector(_groups.size(), false);
+  std::fill_n(selector.begin(), _best_placed_slots.size(), true);
+  do {
+    uint64_t mask = 0;
+    for (size_t g = 0; g < _groups.size(); ++g) {
+      if (selector[g]) { mask |= 1UL << g; }
+    }
+    masks.push_back(mask);
+  } while (std::prev_permutation(selector.begin(), selector.end()));
+
+  /* The sets of groups are evaluated independently, and summed in order, so
+   * that the result does not depend on the number of threads */
+  std::vector<vector_t> mask_wpvs(masks.size(),
+                                  vector_t(win_probs.size(), 0.0));
+  bool                  parallel = omp_in_parallel() == 0;
+#pragma omp parallel for schedule(dynamic) if (parallel)
+  for (size_t i = 0; i < masks.size(); ++i) {
+    for (size_t c = 0; c < point_count; ++c) {
+      add_knockout(win_probs, masks[i], c, mask_wpvs[i]);
+    }
+  }
+  for (const auto &mask_wpv : mask_wpvs) {
+    for (size_t t = 0; t < wpv.size(); ++t) { wpv[t] += mask_wpv[t]; }
+  }
+  return wpv;
+}
+
+auto group_tournament_t::best_placed_groups(uint64_t mask) const
+    -> std::vector<size_t> {
+  auto it = _best_placed_table.find(mask);
+  if (it != _best_placed_table.end()) {
+    if (it->second.size() != _best_placed_slots.size()) {
+      throw std::runtime_error{"Best placed table entry is the wrong size"};
+    }
+    for (auto g : it->second) {
+      if (g >= _groups.size()) {
+        throw std::runtime_error{"Best placed table entry refers to a missing "
+                                 "group"};
+      }
+    }
+    return it->second;
+  }
+
+  std::vector<size_t> qualified;
+  for (size_t g = 0; g < _groups.size(); ++g) {
+    if ((mask & (1UL << g)) != 0) { qualified.push_back(g); }
+  }
+  return qualified;
+}
+
+/**
+ * The group that fills each slot of the knockout, when the groups in `mask`
+ * provide the best placed teams.
+ */
+auto group_tournament_t::knockout_slot_groups(uint64_t mask) const
+    -> std::vector<size_t> {
+  std::vector<size_t> slot_groups(_slots.size());
+  std::vector<size_t> placed_groups;
+  if (!_best_placed_slots.empty()) { placed_groups = best_placed_groups(mask); }
+  for (size_t s = 0, i = 0; s < _slots.size(); ++s) {
+    slot_groups[s] =
+        _slots[s].best_placed ? placed_groups[i++] : _slots[s].group;
+  }
+  return slot_groups;
+}
+
+/**
+ * Add the outcomes of a single point table of a group to `outcomes`, by
+ * choosing the teams for the positions from `next` on. Teams level on points
+ * are ordered uniformly at random, so the team in a position is equally likely
+ * to be any of the teams tied over it that are not placed yet.
+ */
+static void add_table_outcomes(
+    const std::vector<size_t>                             &positions,
+    const std::vector<size_t>                             &order,
+    const std::vector<size_t>                             &points,
+    const std::vector<size_t>                             &teams,
+    size_t                                                 placed_position,
+    size_t                                                 next,
+    double                                                 prob,
+    std::vector<size_t>                                   &chosen,
+    std::map<std::pair<std::vector<size_t>, size_t>, double> &outcomes) {
+  if (next == positions.size()) {
+    size_t placed_points =
+        placed_position < order.size() ? points[order[placed_position]] : 0;
+    std::vector<size_t> global(chosen.size());
+    for (size_t i = 0; i < chosen.size(); ++i) { global[i] = teams[chosen[i]]; }
+    outcomes[{std::move(global), placed_points}] += prob;
+    return;
+  }
+
+  size_t level = points[order[positions[next]]];
+  size_t begin = positions[next];
+  while (begin > 0 && points[order[begin - 1]] == level) { --begin; }
+  size_t end = positions[next] + 1;
+  while (end < order.size() && points[order[end]] == level) { ++end; }
+
+  std::vector<size_t> candidates;
+  for (size_t k = begin; k < end; ++k) {
+    if (std::find(chosen.begin(), chosen.end(), order[k]) == chosen.end()) {
+      candidates.push_back(order[k]);
+    }
+  }
+  double share = prob / static_cast<double>(candidates.size());
+  for (auto team : candidates) {
+    chosen.push_back(team);
+    add_table_outcomes(positions,
+                       order,
+                       points,
+                       teams,
+                       placed_position,
+                       next + 1,
+                       share,
+                       chosen,
+                       outcomes);
+    chosen.pop_back();
+  }
+}
+
+void group_tournament_t::compute_group_outcomes() {
+  size_t placed_position =
+      _best_placed_slots.empty() ? SIZE_MAX : _best_placed_position;
+
+  _outcomes.assign(_groups.size(), {});
+  for (size_t g = 0; g < _groups.size(); ++g) {
+    const auto &teams = _groups[g];
+    std::map<std::pair<std::vector<size_t>, size_t>, double> outcomes;
+    std::vector<size_t> order(teams.size());
+    std::vector<size_t> chosen;
+    for (const auto &[points, prob] : _standings[g].point_tables) {
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(
+          order.begin(), order.end(), [&points = points](size_t a, size_t b) {
+            return points[a] > points[b];
+          });
+      add_table_outcomes(_outcome_positions[g],
+                         order,
+                         points,
+                         teams,
+                         placed_position,
+                         0,
+                         prob,
+                         chosen,
+                         outcomes);
+    }
+    for (auto &[key, prob] : outcomes) {
+      _outcomes[g].push_back({key.first, key.second, prob});
+    }
+  }
+}
+
+/**
+ * The results of a group that matter to one pass over the knockout: the teams
+ * in the slots of the group, in slot order and as indices into the group, and
+ * the probability of each set of teams with the best placed team of the group
+ * away from the cutoff, and at it.
+ */
+struct group_domain_t {
+  std::vector<size_t>                                       slots;
+  bool                                                      qualifies;
+  std::map<std::vector<size_t>, std::pair<double, double>> results;
+};
+
+/* A key of a factor of the knockout packs the number of groups with their best
+ * placed team at the cutoff, in the qualifying set and outside of it, and the
+ * index into its group of the team in every open slot */
+constexpr size_t   COUNT_BITS     = 7;
+constexpr size_t   TEAM_BITS      = 3;
+constexpr size_t   TEAMS_OFFSET   = 2 * COUNT_BITS;
+constexpr size_t   MAX_OPEN_SLOTS = (64 - TEAMS_OFFSET) / TEAM_BITS;
+constexpr uint64_t COUNT_MASK     = (1UL << COUNT_BITS) - 1;
+constexpr uint64_t TEAM_MASK      = (1UL << TEAM_BITS) - 1;
+
+static auto key_counts(size_t in_set, size_t out_of_set) -> uint64_t {
+  return in_set | (out_of_set << COUNT_BITS);
+}
+
+static auto key_in_set(uint64_t key) -> size_t { return key & COUNT_MASK; }
+
+static auto key_out_of_set(uint64_t key) -> size_t {
+  return (key >> COUNT_BITS) & COUNT_MASK;
+}
+
+static auto key_team(uint64_t key, size_t index) -> size_t {
+  return (key >> (TEAMS_OFFSET + TEAM_BITS * index)) & TEAM_MASK;
+}
+
+static auto key_with_team(size_t index, size_t team) -> uint64_t {
+  return static_cast<uint64_t>(team) << (TEAMS_OFFSET + TEAM_BITS * index);
+}
+
+/**
+ * An index from the keys of a factor to its entries, by open addressing. The
+ * factors are rebuilt at every match of every pass over the knockout, so adding
+ * to them has to be cheap.
+ */
+class key_index_t {
+public:
+  /**
+   * The entry of `key`, which is set to `next` if the key is missing, and
+   * whether it was missing.
+   */
+  auto try_emplace(uint64_t key, size_t next) -> std::pair<size_t, bool> {
+    if (2 * (_size + 1) > _keys.size()) { grow(); }
+    size_t slot = find_slot(key);
+    if (_keys[slot] == key) { return {_entries[slot], false}; }
+    _keys[slot]    = key;
+    _entries[slot] = next;
+    _size         += 1;
+    return {next, true};
+  }
+
+private:
+  static constexpr uint64_t EMPTY           = UINT64_MAX;
+  static constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15UL;
+
+  auto find_slot(uint64_t key) const -> size_t {
+    size_t mask = _keys.size() - 1;
+    size_t slot = static_cast<size_t>((key * HASH_MULTIPLIER) >> 32) & mask;
+    while (_keys[slot] != key && _keys[slot] != EMPTY) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void grow() {
+    auto keys    = std::move(_keys);
+    auto entries = std::move(_entries);
+    _keys.assign(std::max<size_t>(16, 2 * keys.size()), EMPTY);
+    _entries.assign(_keys.size(), 0);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] == EMPTY) { continue; }
+      size_t slot    = find_slot(keys[i]);
+      _keys[slot]    = keys[i];
+      _entries[slot] = entries[i];
+    }
+  }
+
+  std::vector<uint64_t> _keys;
+  std::vector<size_t>   _entries;
+  size_t                _size = 0;
+};
+
+/**
+ * The winner of a subtree of the knockout, jointly with the teams in its open
+ * slots, which are the slots of the groups that also fill slots outside of
+ * the subtree. The WPV of an entry is weighted by the probability of the
+ * results of the groups that only fill slots inside of the subtree.
+ */
+struct knockout_factor_t {
+  std::vector<size_t>   slots;
+  std::vector<uint64_t> keys;
+  std::vector<double>   wpvs;
+  key_index_t           index;
+
+  auto wpv(size_t entry, size_t team_count) -> double * {
+    return wpvs.data() + entry * team_count;
+  }
+
+  auto wpv(size_t entry, size_t team_count) const -> const double * {
+    return wpvs.data() + entry * team_count;
+  }
+
+  /**
+   * The WPV of the entry for `key`, which is added if it is missing. Only valid
+   * until the next entry is added.
+   */
+  auto add(uint64_t key, size_t team_count) -> double * {
+    auto [entry, inserted] = index.try_emplace(key, keys.size());
+    if (inserted) {
+      keys.push_back(key);
+      wpvs.resize(wpvs.size() + team_count, 0.0);
+    }
+    return wpv(entry, team_count);
+  }
+};
+
+static auto contains(const std::vector<size_t> &sorted, size_t value) -> bool {
+  return std::binary_search(sorted.begin(), sorted.end(), value);
+}
+
+static auto index_of(const std::vector<size_t> &sorted, size_t value)
+    -> size_t {
+  return static_cast<size_t>(
+      std::lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin());
+}
+
+/**
+ * The largest number of keys of a factor over `slots`: every slot of a group
+ * holds a different team of the group, and the counts of the groups at the
+ * cutoff range over `counts` values.
+ */
+static auto factor_bound(const std::vector<size_t> &slots,
+                         const std::vector<size_t> &slot_groups,
+                         const std::vector<size_t> &group_sizes,
+                         size_t                     counts) -> double {
+  std::vector<size_t> taken(group_sizes.size(), 0);
+  double              bound = static_cast<double>(counts);
+  for (auto s : slots) {
+    size_t g  = slot_groups[s];
+    bound    *= static_cast<double>(group_sizes[g] - taken[g]);
+    taken[g] += 1;
+  }
+  return bound;
+}
+
+/**
+ * The slots in [lo, hi) of the groups that also fill slots outside of it.
+ */
+static auto open_slots(size_t                                  lo,
+                       size_t                                  hi,
+                       const std::vector<size_t>              &slot_groups,
+                       const std::vector<std::vector<size_t>> &group_slots)
+    -> std::vector<size_t> {
+  std::vector<size_t> open;
+  for (size_t s = lo; s < hi; ++s) {
+    const auto &slots = group_slots[slot_groups[s]];
+    if (slots.front() < lo || slots.back() >= hi) { open.push_back(s); }
+  }
+  return open;
+}
+
+/**
+ * The groups which fill slots on both sides of the match over [lo, hi), and
+ * none outside of it, so that the match is the last place they are needed.
+ */
+static auto closing_groups(size_t                                  lo,
+                           size_t                                  hi,
+                           const std::vector<std::vector<size_t>> &group_slots)
+    -> std::vector<size_t> {
+  size_t              mid = lo + (hi - lo) / 2;
+  std::vector<size_t> closing;
+  for (size_t g = 0; g < group_slots.size(); ++g) {
+    const auto &slots = group_slots[g];
+    if (!slots.empty() && slots.front() >= lo && slots.front() < mid &&
+        slots.back() >= mid && slots.back() < hi) {
+      closing.push_back(g);
+    }
+  }
+  return closing;
+}
+
+/**
+ * Whether the group `g`, which closes at a match, is summed out of the side
+ * with the slots `from`, rather than out of the side with the slots `to`. It is
+ * summed out of the side where it fills the most slots, as that shrinks the
+ * factor.
+ */
+static auto sums_out_of(size_t                     g,
+                        const std::vector<size_t> &from,
+                        const std::vector<size_t> &to,
+                        const std::vector<size_t> &slot_groups) -> bool {
+  auto in_group = [&](size_t s) { return slot_groups[s] == g; };
+  return std::count_if(from.begin(), from.end(), in_group) >=
+         std::count_if(to.begin(), to.end(), in_group);
+}
+
+/**
+ * The number of values of the counts of the groups at the cutoff, when the
+ * groups in `counted` have been summed out. Without best placed slots, the
+ * counts are always zero, and `qualifies` is empty.
+ */
+static auto count_states(const std::vector<bool> &counted,
+                         const std::vector<bool> &qualifies) -> size_t {
+  if (qualifies.empty()) { return 1; }
+  size_t in_set     = 0;
+  size_t out_of_set = 0;
+  for (size_t g = 0; g < counted.size(); ++g) {
+    if (counted[g]) { (qualifies[g] ? in_set : out_of_set) += 1; }
+  }
+  return (in_set + 1) * (out_of_set + 1);
+}
+
+/**
+ * The groups that fill slots inside of [lo, hi), and none outside of it.
+ */
+static auto closed_groups(size_t                                  lo,
+                          size_t                                  hi,
+                          const std::vector<std::vector<size_t>> &group_slots)
+    -> std::vector<bool> {
+  std::vector<bool> closed(group_slots.size(), false);
+  for (size_t g = 0; g < group_slots.size(); ++g) {
+    const auto &slots = group_slots[g];
+    closed[g] = !slots.empty() && slots.front() >= lo && slots.back() < hi;
+  }
+  return closed;
+}
+
+/**
+ * Check that no factor of the knockout over [lo, hi) has more than
+ * `MAX_KNOCKOUT_STATES` keys, following the steps of `knockout_pass_t`.
+ */
+static void check_factor_bounds(
+    size_t                                  lo,
+    size_t                                  hi,
+    const std::vector<size_t>              &slot_groups,
+    const std::vector<std::vector<size_t>> &group_slots,
+    const std::vector<size_t>              &group_sizes,
+    const std::vector<bool>                &qualifies) {
+  if (hi - lo == 1) { return; }
+  size_t mid = lo + (hi - lo) / 2;
+  check_factor_bounds(
+      lo, mid, slot_groups, group_slots, group_sizes, qualifies);
+  check_factor_bounds(
+      mid, hi, slot_groups, group_slots, group_sizes, qualifies);
+
+  auto check = [&](const std::vector<size_t> &slots,
+                   const std::vector<bool>   &counted) {
+    if (slots.size() > MAX_OPEN_SLOTS ||
+        factor_bound(slots,
+                     slot_groups,
+                     group_sizes,
+                     count_states(counted, qualifies)) >
+            static_cast<double>(MAX_KNOCKOUT_STATES)) {
+      throw std::runtime_error{
+          "The knockout depends on the results of too many groups at once"};
+    }
+  };
+
+  /* Each closing group is summed out of one of the sides, towards the slots
+   * of the other */
+  auto sum_out = [&](size_t                     g,
+                     const std::vector<size_t> &to,
+                     std::vector<size_t>       &slots,
+                     std::vector<bool>         &counted) {
+    std::vector<size_t> next;
+    for (auto s : slots) {
+      if (slot_groups[s] != g) { next.push_back(s); }
+    }
+    for (auto s : to) {
+      if (slot_groups[s] == g) { next.push_back(s); }
+    }
+    std::sort(next.begin(), next.end());
+    slots      = std::move(next);
+    counted[g] = true;
+    check(slots, counted);
+  };
+
+  auto closing = closing_groups(lo, hi, group_slots);
+  auto left    = open_slots(lo, mid, slot_groups, group_slots);
+  auto right   = open_slots(mid, hi, slot_groups, group_slots);
+  for (const auto &[x, y, x_lo, x_hi, y_lo, y_hi] :
+       {std::tuple{left, right, lo, mid, mid, hi},
+        std::tuple{right, left, mid, hi, lo, mid}}) {
+    auto x_slots   = x;
+    auto y_slots   = y;
+    auto x_counted = closed_groups(x_lo, x_hi, group_slots);
+    auto y_counted = closed_groups(y_lo, y_hi, group_slots);
+    for (auto g : closing) {
+      if (sums_out_of(g, y, x, slot_groups)) {
+        sum_out(g, x, y_slots, y_counted);
+      } else {
+        sum_out(g, y, x_slots, x_counted);
+      }
+    }
+  }
+  check(open_slots(lo, hi, slot_groups, group_slots),
+        closed_groups(lo, hi, group_slots));
+}
+
+/**
+ * One evaluation of the knockout, for a fixed group in every slot, by
+ * eliminating the groups bottom up through the bracket. A subtree is only
+ * conditioned on the teams in its open slots, so the groups that only fill
+ * slots inside of it are summed out where their last slot joins the bracket.
+ * Given the teams in the open slots of both sides of a match, the winners of
+ * the two sides are independent, so the WPV of the match is the fold of the
+ * WPVs of the sides. The fold is bilinear, so the sum over the groups that
+ * close at the match is taken one group at a time, over the chance of beating
+ * the winner of the other side.
+ */
+class knockout_pass_t {
+public:
+  knockout_pass_t(const std::vector<group_domain_t>      &domains,
+                  const std::vector<std::vector<size_t>> &groups,
+                  const std::vector<size_t>              &slot_groups,
+                  const matrix_t                         &win_probs,
+                  const std::vector<size_t>              &bestof) :
+      _domains{domains},
+      _groups{groups},
+      _slot_groups{slot_groups},
+      _win_probs{win_probs},
+      _bestof{bestof} {
+    for (const auto &domain : _domains) {
+      _group_slots.push_back(domain.slots);
+    }
+  }
+
+  /**
+   * The factor of the subtree over the slots [lo, hi), whose match is played
+   * `depth` rounds before the final.
+   */
+  auto eval(size_t lo, size_t hi, size_t depth) const -> knockout_factor_t {
+    if (hi - lo == 1) { return leaf(lo); }
+
+    size_t mid   = lo + (hi - lo) / 2;
+    auto   left  = eval(lo, mid, depth + 1);
+    auto   right = eval(mid, hi, depth + 1);
+
+    auto     closing = closing_groups(lo, hi, _group_slots);
+    uint64_t bestof  = _bestof.empty() ? 1 : _bestof.at(depth);
+
+    knockout_factor_t match;
+    match.slots = open_slots(lo, hi, _slot_groups, _group_slots);
+    add_winners(left, right, closing, bestof, match);
+    add_winners(right, left, closing, bestof, match);
+    return match;
+  }
+
+private:
+  auto team_count() const -> size_t { return _win_probs.size(); }
+
+  auto leaf(size_t slot) const -> knockout_factor_t {
+    size_t      g      = _slot_groups[slot];
+    const auto &domain = _domains[g];
+    size_t      index  = index_of(domain.slots, slot);
+    bool        closed = domain.slots.size() == 1;
+
+    knockout_factor_t factor;
+    if (!closed) { factor.slots = {slot}; }
+    for (const auto &[teams, probs] : domain.results) {
+      size_t team = _groups[g][teams[index]];
+      if (!closed) {
+        factor.add(key_with_team(0, teams[index]), team_count())[team] = 1.0;
+        continue;
+      }
+      if (probs.first > 0.0) {
+        factor.add(key_counts(0, 0), team_count())[team] += probs.first;
+      }
+      if (probs.second > 0.0) {
+        factor.add(key_counts(domain.qualifies, !domain.qualifies),
+                   team_count())[team] += probs.second;
+      }
+    }
+    return factor;
+  }
+
+  /**
+   * Replace the teams of group `g` in the slots of `factor` with its teams in
+   * the slots on the other side of the match, weighted by the probability of
+   * the results of the group. The WPVs of `factor` are only read for the teams
+   * in `support`.
+   */
+  auto sum_group(const knockout_factor_t   &factor,
+                 size_t                     g,
+                 const std::vector<size_t> &support) const
+      -> knockout_factor_t {
+    const auto &domain = _domains[g];
+
+    knockout_factor_t summed;
+    for (auto s : factor.slots) {
+      if (_slot_groups[s] != g) { summed.slots.push_back(s); }
+    }
+    for (auto s : domain.slots) {
+      if (!contains(factor.slots, s)) { summed.slots.push_back(s); }
+    }
+    std::sort(summed.slots.begin(), summed.slots.end());
+
+    /* The results of the group, by its teams in the slots of `factor`, as the
+     * part of the summed key with its other teams */
+    std::unordered_map<uint64_t,
+                       std::vector<std::tuple<uint64_t, double, double>>>
+        results;
+    for (const auto &[teams, probs] : domain.results) {
+      uint64_t inside  = 0;
+      uint64_t outside = 0;
+      for (size_t i = 0; i < teams.size(); ++i) {
+        size_t s = domain.slots[i];
+        if (contains(factor.slots, s)) {
+          inside |= key_with_team(index_of(factor.slots, s), teams[i]);
+        } else {
+          outside |= key_with_team(index_of(summed.slots, s), teams[i]);
+        }
+      }
+      results[inside].emplace_back(outside, probs.first, probs.second);
+    }
+
+    std::vector<size_t> kept_from;
+    std::vector<size_t> kept_to;
+    uint64_t            inside_mask = 0;
+    for (size_t i = 0; i < factor.slots.size(); ++i) {
+      size_t s = factor.slots[i];
+      if (_slot_groups[s] == g) {
+        inside_mask |= key_with_team(i, TEAM_MASK);
+      } else {
+        kept_from.push_back(i);
+        kept_to.push_back(index_of(summed.slots, s));
+      }
+    }
+
+    for (size_t e = 0; e < factor.keys.size(); ++e) {
+      uint64_t key = factor.keys[e];
+      auto     it  = results.find(key & inside_mask);
+      if (it == results.end()) { continue; }
+
+      uint64_t kept = 0;
+      for (size_t i = 0; i < kept_from.size(); ++i) {
+        kept |= key_with_team(kept_to[i], key_team(key, kept_from[i]));
+      }
+      size_t in_set     = key_in_set(key);
+      size_t out_of_set = key_out_of_set(key);
+      for (const auto &[outside, away, at] : it->second) {
+        for (auto [prob, counted] :
+             {std::pair{away, false}, std::pair{at, true}}) {
+          if (prob <= 0.0) { continue; }
+          uint64_t counts =
+              key_counts(in_set + (counted && domain.qualifies),
+                         out_of_set + (counted && !domain.qualifies));
+          uint64_t    summed_key = kept | outside | counts;
+          const auto *source     = factor.wpv(e, team_count());
+          auto       *result     = summed.add(summed_key, team_count());
+          for (auto t : support) { result[t] += prob * source[t]; }
+        }
+      }
+    }
+    return summed;
+  }
+
+  /**
+   * Add the probability that the winner of `x` wins the match against the
+   * winner of `y` to `match`.
+   */
+  void add_winners(const knockout_factor_t   &x,
+                   const knockout_factor_t   &y,
+                   const std::vector<size_t> &closing,
+                   uint64_t                   bestof,
+                   knockout_factor_t         &match) const {
+    size_t n = team_count();
+
+    /* The teams that can win `x`, and their chances of beating each team */
+    std::vector<size_t> x_support;
+    for (size_t t = 0; t < n; ++t) {
+      for (size_t e = 0; e < x.keys.size(); ++e) {
+        if (x.wpv(e, n)[t] != 0.0) {
+          x_support.push_back(t);
+          break;
+        }
+      }
+    }
+    matrix_t win_chance(n, vector_t(n, 0.0));
+    for (auto t : x_support) {
+      for (size_t u = 0; u < n; ++u) {
+        if (t == u) { continue; }
+        win_chance[t][u] =
+            bestof_n(_win_probs[t][u], _win_probs[u][t], bestof);
+      }
+    }
+
+    /* The chance of each team beating the winner of `y` */
+    knockout_factor_t beat;
+    beat.slots = y.slots;
+    beat.keys  = y.keys;
+    beat.wpvs.assign(y.wpvs.size(), 0.0);
+    std::vector<size_t> y_support;
+    for (size_t e = 0; e < y.keys.size(); ++e) {
+      const auto *wpv = y.wpv(e, n);
+      y_support.clear();
+      for (size_t u = 0; u < n; ++u) {
+        if (wpv[u] != 0.0) { y_support.push_back(u); }
+      }
+      auto *chance = beat.wpv(e, n);
+      for (auto t : x_support) {
+        for (auto u : y_support) { chance[t] += win_chance[t][u] * wpv[u]; }
+      }
+    }
+
+    /* Sum out the groups that close here, each from the side where it fills
+     * the most slots, so that both sides have the same slots of them */
+    knockout_factor_t summed_x;
+    const auto       *winner = &x;
+    for (auto g : closing) {
+      if (sums_out_of(g, y.slots, x.slots, _slot_groups)) {
+        beat = sum_group(beat, g, x_support);
+      } else {
+        summed_x = sum_group(*winner, g, x_support);
+        winner   = &summed_x;
+      }
+    }
+
+    /* The entries of `beat` by the teams in the slots of the closing groups */
+    std::vector<size_t> x_shared;
+    std::vector<size_t> beat_shared;
+    for (size_t i = 0; i < winner->slots.size(); ++i) {
+      size_t s = winner->slots[i];
+      if (std::find(closing.begin(), closing.end(), _slot_groups[s]) ==
+          closing.end()) {
+        continue;
+      }
+      x_shared.push_back(i);
+      beat_shared.push_back(index_of(beat.slots, s));
+    }
+    auto shared_teams = [](uint64_t key, const std::vector<size_t> &shared) {
+      uint64_t teams = 0;
+      for (size_t j = 0; j < shared.size(); ++j) {
+        teams |= key_with_team(j, key_team(key, shared[j]));
+      }
+      return teams;
+    };
+    std::unordered_map<uint64_t, std::vector<size_t>> beat_by_shared;
+    for (size_t e = 0; e < beat.keys.size(); ++e) {
+      beat_by_shared[shared_teams(beat.keys[e], beat_shared)].push_back(e);
+    }
+
+    /* Where each slot of the match comes from, and the pairs of its slots of
+     * the same group, which hold different teams */
+    std::vector<std::pair<size_t, size_t>> from_x;
+    std::vector<std::pair<size_t, size_t>> from_beat;
+    std::vector<std::pair<size_t, size_t>> same_group;
+    for (size_t i = 0; i < match.slots.size(); ++i) {
+      size_t s = match.slots[i];
+      if (contains(winner->slots, s)) {
+        from_x.emplace_back(index_of(winner->slots, s), i);
+      } else {
+        from_beat.emplace_back(index_of(beat.slots, s), i);
+      }
+      for (size_t j = 0; j < i; ++j) {
+        if (_slot_groups[match.slots[j]] == _slot_groups[s]) {
+          same_group.emplace_back(j, i);
+        }
+      }
+    }
+
+    for (size_t e = 0; e < winner->keys.size(); ++e) {
+      uint64_t x_key = winner->keys[e];
+      auto     it    = beat_by_shared.find(shared_teams(x_key, x_shared));
+      if (it == beat_by_shared.end()) { continue; }
+
+      uint64_t x_part = 0;
+      for (auto [from, to] : from_x) {
+        x_part |= key_with_team(to, key_team(x_key, from));
+      }
+      const auto *wpv = winner->wpv(e, n);
+      for (auto b : it->second) {
+        uint64_t beat_key = beat.keys[b];
+        uint64_t key      = x_part;
+        for (auto [from, to] : from_beat) {
+          key |= key_with_team(to, key_team(beat_key, from));
+        }
+        if (std::any_of(same_group.begin(),
+                        same_group.end(),
+                        [key](std::pair<size_t, size_t> slots) {
+                          return key_team(key, slots.first) ==
+                                 key_team(key, slots.second);
+                        })) {
+          continue;
+        }
+        key |= key_counts(key_in_set(x_key) + key_in_set(beat_key),
+                          key_out_of_set(x_key) + key_out_of_set(beat_key));
+
+        const auto *chance = beat.wpv(b, n);
+        auto       *result = match.add(key, n);
+        for (auto t : x_support) { result[t] += wpv[t] * chance[t]; }
+      }
+    }
+  }
+
+  const std::vector<group_domain_t>      &_domains;
+  const std::vector<std::vector<size_t>> &_groups;
+  const std::vector<size_t>              &_slot_groups;
+  const matrix_t                         &_win_probs;
+  const std::vector<size_t>              &_bestof;
+  std::vector<std::vector<size_t>>        _group_slots;
+};
+
+/**
+ * Add the WPV of the knockout for the set of groups `mask` providing the best
+ * placed teams, with the worst of them on `cutoff` points, to `wpv`. The slots
+ * of the knockout are filled by fixed groups, so only the results of the groups
+ * which are consistent with the set and cutoff are kept, and the tie for the
+ * cutoff is broken at the root of the bracket, from the number of groups at it.
+ * Without best placed slots, `mask` and `cutoff` are ignored.
+ */
+void group_tournament_t::add_knockout(const matrix_t &win_probs,
+                                      uint64_t        mask,
+                                      size_t          cutoff,
+                                      vector_t       &wpv) const {
+  bool best_placed = !_best_placed_slots.empty();
+  auto slot_groups = knockout_slot_groups(mask);
+
+  std::vector<group_domain_t> domains(_groups.size());
+  for (size_t s = 0; s < _slots.size(); ++s) {
+    domains[slot_groups[s]].slots.push_back(s);
+  }
+
+  /* The count of the groups without slots at the cutoff, as a polynomial */
+  vector_t unslotted{1.0};
+  bool     qualifier_at_cutoff = !best_placed;
+  for (size_t g = 0; g < _groups.size(); ++g) {
+    auto &domain     = domains[g];
+    domain.qualifies = (mask & (1UL << g)) != 0;
+
+    double              away = 0.0;
+    double              at   = 0.0;
+    std::vector<size_t> teams(domain.slots.size());
+    for (const auto &outcome : _outcomes[g]) {
+      bool at_cutoff = false;
+      if (best_placed) {
+        if (domain.qualifies ? outcome.placed_points < cutoff
+                             : outcome.placed_points > cutoff) {
+          continue;
+        }
+        at_cutoff = outcome.placed_points == cutoff;
+      }
+      if (domain.slots.empty()) {
+        (at_cutoff ? at : away) += outcome.prob;
+        continue;
+      }
+
+      for (size_t i = 0; i < teams.size(); ++i) {
+        size_t s    = domain.slots[i];
+        size_t team = outcome.teams[_slots[s].best_placed
+                                        ? _placed_outcome_index[g]
+                                        : _slot_outcome_index[s]];
+        teams[i]    = static_cast<size_t>(
+            std::find(_groups[g].begin(), _groups[g].end(), team) -
+            _groups[g].begin());
+      }
+      auto &probs = domain.results[teams];
+      (at_cutoff ? probs.second : probs.first) += outcome.prob;
+      if (at_cutoff && domain.qualifies) { qualifier_at_cutoff = true; }
+    }
+
+    if (domain.slots.empty()) {
+      multiply(unslotted, away, at);
+    } else if (domain.results.empty()) {
+      return;
+    }
+  }
+  if (!qualifier_at_cutoff) { return; }
+
+  knockout_pass_t pass{domains, _groups, slot_groups, win_probs, _bestof};
+  auto            root = pass.eval(0, _slots.size(), 0);
+  for (size_t e = 0; e < root.keys.size(); ++e) {
+    const auto *root_wpv = root.wpv(e, wpv.size());
+    double      weight   = 1.0;
+    if (best_placed) {
+      size_t in_set     = key_in_set(root.keys[e]);
+      size_t out_of_set = key_out_of_set(root.keys[e]);
+      if (in_set == 0) { continue; }
+      weight = 0.0;
+      for (size_t j = 0; j < unslotted.size(); ++j) {
+        auto tied  = static_cast<double>(
+            choose(in_set + out_of_set + j, in_set, SIZE_MAX));
+        weight    += unslotted[j] / tied;
+      }
+    }
+    for (size_t t = 0; t < wpv.size(); ++t) { wpv[t] += weight * root_wpv[t]; }
+  }
+}
+
+/**
+ * Check that the knockout can be evaluated with bounded work, for every set of
+ * groups that can provide the best placed teams.
+ */
+void group_tournament_t::check_knockout_states() const {
+  std::vector<size_t> group_sizes(_groups.size());
+  for (size_t g = 0; g < _groups.size(); ++g) {
+    group_sizes[g] = _groups[g].size();
+  }
+
+  auto check_mask = [&](uint64_t mask) {
+    auto                             slot_groups = knockout_slot_groups(mask);
+    std::vector<std::vector<size_t>> group_slots(_groups.size());
+    for (size_t s = 0; s < _slots.size(); ++s) {
+      group_slots[slot_groups[s]].push_back(s);
+    }
+    std::vector<bool> qualifies;
+    if (!_best_placed_slots.empty()) {
+      for (size_t g = 0; g < _groups.size(); ++g) {
+        qualifies.push_back((mask & (1UL << g)) != 0);
+      }
+    }
+    check_factor_bounds(
+        0, _slots.size(), slot_groups, group_slots, group_sizes, qualifies);
+  };
+
+  if (_best_placed_slots.empty()) {
+    check_mask(0);
+    return;
+  }
+  std::vector<bool> selector(_groups.size(), false);
+  std::fill_n(selector.begin(), _best_placed_slots.size(), true);
+  do {
+    uint64_t mask = 0;
+    for (size_t g = 0; g < _groups.size(); ++g) {
+      if (selector[g]) { mask |= 1UL << g; }
+    }
+    check_mask(mask);
+  } while (std::prev_permutation(selector.begin(), selector.end()));
+}
+/**
+ * Fill the best placed slots, by summing over every set of groups that can
+ * provide the best placed teams. For a set `M` and a cutoff `c`, the groups in
+ * `M` have at least `c` points and the others at most `c`, and if `a` groups in
+ * `M` and `b` others have exactly `c` points, the tie is broken in favour of
+ * `M` with probability 1 / (a + b choose a). Groups are independent, so the
+ * probability of each count of groups at the cutoff is the coefficient of a
+ * product of polynomials, one per group, and the work is polynomial in the
+ * number of groups for each set.
+ */
+void group_tournament_t::compute_best_placed_slots() {
+  size_t group_count = _groups.size();
+  size_t slot_count  = _best_placed_slots.size();
+
+  size_t point_count = 0;
+  for (size_t g = 0; g < group_count; ++g) {
+    point_count = std::max(
+        point_count,
+        _standings[g].placed_points[_best_placed_position].front().size());
+  }
+
+  /* below[g][c], at[g][c] and above[g][c] are the probabilities that the best
+   * placed team of group `g` has fewer than, exactly or more than `c` points */
+  matrix_t at(group_count, vector_t(point_count, 0.0));
+  matrix_t below(group_count, vector_t(point_count, 0.0));
+  matrix_t above(group_count, vector_t(point_count, 0.0));
+  for (size_t g = 0; g < group_count; ++g) {
+    const auto &placed = _standings[g].placed_points[_best_placed_position];
+    for (const auto &team_points : placed) {
+      for (size_t k = 0; k < team_points.size(); ++k) {
+        at[g][k] += team_points[k];
+      }
+    }
+    double cumulative = 0.0;
+    for (size_t c = 0; c < point_count; ++c) {
+      below[g][c]  = cumulative;
+      cumulative  += at[g][c];
+    }
+    for (size_t c = 0; c < point_count; ++c) {
+      above[g][c] = std::max(cumulative - below[g][c] - at[g][c], 0.0);
+    }
+  }
+
+  matrix_t inverse_choose(group_count + 1, vector_t(group_count + 1, 0.0));
+  for (size_t n = 0; n <= group_count; ++n) {
+    for (size_t k = 0; k <= n; ++k) {
+      inverse_choose[n][k] =
+          1.0 / static_cast<double>(choose(n, k, SIZE_MAX));
+    }
+  }
+
+  /* qualify[g][k] is the probability that the set qualifies, given that the
+   * best placed team of `g` has `k` points */
+  matrix_t          qualify(group_count, vector_t(point_count));
+  vector_t          outside;
+  vector_t          inside;
+  std::vector<bool> selector(group_count, false);
+  std::fill_n(selector.begin(), slot_count, true);
+  do {
+    uint64_t mask = 0;
+    for (size_t g = 0; g < group_count; ++g) {
+      if (selector[g]) { mask |= 1UL << g; }
+    }
+    for (auto &q : qualify) { std::fill(q.begin(), q.end(), 0.0); }
+
+    for (size_t c = 0; c < point_count; ++c) {
+      outside.assign(1, 1.0);
+      for (size_t h = 0; h < group_count; ++h) {
+        if (!selector[h]) { multiply(outside, below[h][c], at[h][c]); }
+      }
+      if (std::all_of(outside.begin(), outside.end(), [](double f) {
+            return f == 0.0;
+          })) {
+        continue;
+      }
+
+      for (size_t g = 0; g < group_count; ++g) {
+        if (!selector[g]) { continue; }
+        inside.assign(1, 1.0);
+        for (size_t h = 0; h < group_count; ++h) {
+          if (selector[h] && h != g) {
+            multiply(inside, above[h][c], at[h][c]);
+          }
+        }
+
+        /* With `g` at the cutoff, or above it, where another group must be
+         * at the cutoff */
+        double at_cutoff    = 0.0;
+        double above_cutoff = 0.0;
+        for (size_t a = 0; a < inside.size(); ++a) {
+          for (size_t b = 0; b < outside.size(); ++b) {
+            double f   = inside[a] * outside[b];
+            at_cutoff += f * inverse_choose[a + 1 + b][a + 1];
+            if (a > 0) { above_cutoff += f * inverse_choose[a + b][a]; }
+          }
+        }
+        qualify[g][c] += at_cutoff;
+        for (size_t k = c + 1; k < point_count; ++k) {
+          qualify[g][k] += above_cutoff;
+        }
+      }
+    }
+
+    auto slot_groups = best_placed_groups(mask);
+    for (size_t i = 0; i < slot_count; ++i) {
+      size_t      g      = slot_groups[i];
+      const auto &placed = _standings[g].placed_points[_best_placed_position];
+      auto       &slot   = _slot_probs[_best_placed_slots[i]];
+      for (size_t t = 0; t < _groups[g].size(); ++t) {
+        for (size_t k = 0; k < placed[t].size(); ++k) {
+          slot.at(_groups[g][t]) += qualify[g][k] * placed[t][k];
+        }
+      }
+    }
+  } while (std::prev_permutation(selector.begin(), selector.end()));
+}
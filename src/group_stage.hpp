@@ -0,0 +1,213 @@
+#ifndef GROUP_STAGE_HPP
+#define GROUP_STAGE_HPP
+
+#include "util.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * The distribution over the final standings of a single round robin group.
+ *
+ * Teams are indexed locally, in the order they were given to
+ * `compute_group_standings`.
+ */
+struct group_standings_t {
+  /**
+   * `position_probs[t][p]` is the probability that team `t` finishes in
+   * position `p`, where position 0 is the group winner.
+   */
+  matrix_t position_probs;
+
+  /**
+   * `placed_points[p][t][k]` is the probability that team `t` finishes in
+   * position `p` with exactly `k` points. Used to rank teams placed in the same
+   * position across groups.
+   */
+  std::vector<matrix_t> placed_points;
+
+  /**
+   * The distinct final point tables of the group, and their probabilities.
+   * `point_tables[i].first[t]` is the number of points of team `t`.
+   */
+  std::vector<std::pair<std::vector<size_t>, double>> point_tables;
+
+  [[nodiscard]] auto team_count() const -> size_t {
+    return position_probs.size();
+  }
+};
+
+/**
+ * Compute the exact distribution of the standings of a round robin group, by
+ * enumerating the results of every match in the group. Intermediate states
+ * that have the same points for every team are merged, so the work is bounded
+ * by the number of distinct point tables rather than the number of match
+ * outcomes.
+ *
+ * A win is worth 3 points, and a draw is worth 1. Teams that are level on
+ * points are ordered uniformly at random.
+ *
+ * @param teams Global team indices of the members of the group. At most 8.
+ *
+ * @param win_probs Pairwise win probabilities, indexed by global team index,
+ * with draws split evenly between the teams (as produced by
+ * `generate_win_probs`).
+ *
+ * @param draw_probs Pairwise draw probabilities, indexed by global team index.
+ * May be empty, in which case matches are never drawn.
+ */
+auto compute_group_standings(const std::vector<size_t> &teams,
+                             const matrix_t            &win_probs,
+                             const matrix_t            &draw_probs)
+    -> group_standings_t;
+
+/**
+ * A slot of the knockout bracket that is filled from the group stage. If
+ * `best_placed` is set, the slot is filled by one of the best teams finishing
+ * in the best placed position across all groups (e.g. the best third placed
+ * teams), and `group` and `position` are ignored.
+ */
+struct knockout_slot_t {
+  size_t group;
+  size_t position;
+  bool   best_placed;
+};
+
+/**
+ * The result of a group, as far as the knockout is concerned: the teams that
+ * finish in the positions which fill knockout slots, and the points of the team
+ * in the best placed position.
+ */
+struct group_outcome_t {
+  /* Global team indices, in the order of the positions of the group that are
+   * used by the knockout */
+  std::vector<size_t> teams;
+  size_t              placed_points;
+  double              prob;
+};
+
+/**
+ * A tournament that starts with a group stage, followed by a knockout bracket.
+ *
+ * The group standings, the probability that each team fills each slot of the
+ * bracket, and the knockout are all computed exactly. The slots of a group are
+ * not independent, as a team can only fill one of them, so the knockout is
+ * conditioned on the results of the groups. Rather than evaluating it for every
+ * joint result of the groups, each subtree of the bracket is only conditioned
+ * on the teams in its slots of the groups that also fill slots outside of it,
+ * and the other groups are summed out where their last slot joins the bracket.
+ * Brackets keep the slots of a group apart until late, so each subtree only
+ * depends on a few slots of each group, which keeps the work small for the
+ * formats of the European Championship with 6 groups, and the World Cup with 8.
+ * Configurations where some subtree would depend on more than 262144 joint
+ * results at once are rejected, which includes the World Cup with 12 groups.
+ *
+ * Teams level on points are ordered uniformly at random, both within a group
+ * and when ranking the best placed teams. Head to head results and goal
+ * difference are not used.
+ */
+class group_tournament_t {
+public:
+  /**
+   * @param groups The global team indices of the members of each group.
+   *
+   * @param slots The slots of the knockout bracket, in bracket order. The
+   * number of slots must be a power of 2.
+   *
+   * @param best_placed_position The position ranked across groups for the best
+   * placed slots. Defaults to third place.
+   *
+   * The best placed slots are filled by summing over every set of groups that
+   * could provide the best placed teams, so configurations with more than
+   * 10000 such sets are rejected.
+   *
+   * @throws std::runtime_error If the number of slots is not a power of 2, or
+   * if the knockout can not be computed exactly with bounded work.
+   */
+  group_tournament_t(std::vector<std::vector<size_t>> groups,
+                     std::vector<knockout_slot_t>     slots,
+                     size_t                           best_placed_position = 2);
+
+  /**
+   * Set the map from the set of groups which provide a best placed team, to
+   * the group assigned to each best placed slot (in bracket order). The set of
+   * groups is a bitmask over group indices. The default assigns the qualifying
+   * groups in ascending order. The table decides which slots each group fills,
+   * so it is checked like the slots given to the constructor.
+   */
+  void set_best_placed_table(std::map<uint64_t, std::vector<size_t>> table);
+
+  /**
+   * Set the number of games of each match of the knockout, by round, starting
+   * with the final.
+   */
+  void set_bestof(const std::vector<size_t> &bestof);
+
+  /**
+   * Compute the probability that each team wins the tournament.
+   *
+   * @param win_probs Pairwise win probabilities over all teams. Used for the
+   * knockout, and for the group stage when combined with `draw_probs`.
+   *
+   * @param draw_probs Pairwise draw probabilities for the group stage. May be
+   * empty.
+   *
+   * @return A WPV over all teams, indexed by global team index.
+   */
+  auto eval(const matrix_t &win_probs, const matrix_t &draw_probs = {})
+      -> vector_t;
+
+  /**
+   * Standings of each group, from the last call to `eval`.
+   */
+  [[nodiscard]] auto standings() const
+      -> const std::vector<group_standings_t> & {
+    return _standings;
+  }
+
+  /**
+   * `slot_probs()[s][t]` is the probability that team `t` fills slot `s`, from
+   * the last call to `eval`.
+   */
+  [[nodiscard]] auto slot_probs() const -> const matrix_t & {
+    return _slot_probs;
+  }
+
+  /**
+   * One more than the largest team index in the groups, which is the smallest
+   * size of the matrices that `eval` accepts.
+   */
+  [[nodiscard]] auto team_count() const -> size_t { return _team_count; }
+
+private:
+  void compute_best_placed_slots();
+  void compute_group_outcomes();
+  void add_knockout(const matrix_t &win_probs,
+                    uint64_t        mask,
+                    size_t          cutoff,
+                    vector_t       &wpv) const;
+  void check_knockout_states() const;
+  auto best_placed_groups(uint64_t mask) const -> std::vector<size_t>;
+  auto knockout_slot_groups(uint64_t mask) const -> std::vector<size_t>;
+
+  std::vector<std::vector<size_t>>         _groups;
+  std::vector<knockout_slot_t>             _slots;
+  std::vector<size_t>                      _best_placed_slots;
+  std::map<uint64_t, std::vector<size_t>> _best_placed_table;
+  std::vector<size_t>                      _bestof;
+  std::vector<group_standings_t>           _standings;
+  matrix_t                                 _slot_probs;
+  size_t                                   _best_placed_position;
+  size_t                                   _team_count;
+
+  /* The positions of each group that fill slots, in ascending order, for
+   * every slot filled from a group the index of its position in them, and for
+   * every group the index of the best placed position */
+  std::vector<std::vector<size_t>>          _outcome_positions;
+  std::vector<size_t>                       _slot_outcome_index;
+  std::vector<size_t>                       _placed_outcome_index;
+  std::vector<std::vector<group_outcome_t>> _outcomes;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "laplace.hpp"
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+/* Eigenvalues below this fraction of the largest are taken to be flat */
+constexpr double flat_eigenvalue  = 1e-9;
+constexpr size_t max_jacobi_sweeps = 100;
+
+gaussian_approximation_t::gaussian_approximation_t(params_t mean,
+                                                   matrix_t scale,
+                                                   size_t   bounded) :
+    _mean{std::move(mean)},
+    _scale{std::move(scale)},
+    _draws(_mean.size()),
+    _bounded{bounded} {
+  if (_scale.size() != _mean.size()) {
+    throw std::runtime_error{"The scale does not match the mean"};
+  }
+  if (_bounded > _mean.size()) {
+    throw std::runtime_error{"More bounded parameters than parameters"};
+  }
+  for (size_t i = 0; i < _bounded; ++i) {
+    if (!(_mean[i] >= 0.0 && _mean[i] <= 1.0)) {
+      throw std::runtime_error{"The mean is outside the bounds"};
+    }
+  }
+  for (size_t j = 0; j < _mean.size(); ++j) {
+    bool flat = true;
+    for (const auto &row : _scale) {
+      if (row.size() != _mean.size()) {
+        throw std::runtime_error{"The scale does not match the mean"};
+      }
+      if (row[j] != 0.0) { flat = false; }
+    }
+    if (flat) { _flat_directions += 1; }
+  }
+}
+
+void gaussian_approximation_t::draw(random_engine_t &gen, params_t &params) {
+  for (auto &z : _draws) { z = _normal(gen); }
+  params.resize(_mean.size());
+  for (size_t i = 0; i < _mean.size(); ++i) {
+    double x = _mean[i];
+    for (size_t j = 0; j < _draws.size(); ++j) {
+      x += _scale[i][j] * _draws[j];
+    }
+    params[i] = x;
+  }
+
+  /* Fold the bounded parameters back into [0, 1]. Every crossing of a bound
+   * is a reflection */
+  for (size_t i = 0; i < _bounded; ++i) {
+    double crossings = std::floor(params[i]);
+    if (crossings == 0.0) { continue; }
+    params[i] -= crossings;
+    if (std::fmod(crossings, 2.0) != 0.0) { params[i] = 1.0 - params[i]; }
+  }
+}
+
+/**
+ * Eigendecomposition of the symmetric matrix `a` by cyclic Jacobi rotations.
+ * On return, the diagonal of `a` holds the eigenvalues, and the columns of
+ * `vectors` the matching eigenvectors.
+ */
+static void jacobi_eigen(matrix_t &a, matrix_t &vectors) {
+  size_t n = a.size();
+  vectors.assign(n, params_t(n, 0.0));
+  for (size_t i = 0; i < n; ++i) { vectors[i][i] = 1.0; }
+
+  for (size_t sweep = 0; sweep < max_jacobi_sweeps; ++sweep) {
+    double off_diagonal = 0.0;
+    double diagonal     = 0.0;
+    for (size_t p = 0; p < n; ++p) {
+      diagonal += a[p][p] * a[p][p];
+      for (size_t q = p + 1; q < n; ++q) { off_diagonal += a[p][q] * a[p][q]; }
+    }
+    if (off_diagonal <= 1e-30 * diagonal) { return; }
+
+    for (size_t p = 0; p < n; ++p) {
+      for (size_t q = p + 1; q < n; ++q) {
+        if (a[p][q] == 0.0) { continue; }
+        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+        double t     = std::copysign(1.0, theta) /
+                   (std::abs(theta) + std::sqrt(theta * theta + 1));
+        double c = 1 / std::sqrt(t * t + 1);
+        double s = t * c;
+
+        for (size_t k = 0; k < n; ++k) {
+          double akp = a[k][p];
+          double akq = a[k][q];
+          a[k][p]    = c * akp - s * akq;
+          a[k][q]    = s * akp + c * akq;
+        }
+        for (size_t k = 0; k < n; ++k) {
+          double apk = a[p][k];
+          double aqk = a[q][k];
+          a[p][k]    = c * apk - s * aqk;
+          a[q][k]    = s * apk + c * aqk;
+        }
+        for (size_t k = 0; k < n; ++k) {
+          double vkp    = vectors[k][p];
+          double vkq    = vectors[k][q];
+          vectors[k][p] = c * vkp - s * vkq;
+          vectors[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+}
+
+auto laplace_approximation(const likelihood_model_t &model,
+                           const log_prior_t        &prior,
+                           const params_t           &mode)
+    -> gaussian_approximation_t {
+  if (!model.has_hessian()) {
+    throw std::runtime_error{
+        "The Laplace approximation needs a model with a Hessian"};
+  }
+
+  params_t gradient;
+  matrix_t precision;
+  (void)log_posterior_hessian(model, prior, mode, gradient, precision);
+  for (auto &row : precision) {
+    for (auto &f : row) { f = -f; }
+  }
+
+  matrix_t vectors;
+  jacobi_eigen(precision, vectors);
+
+  double largest = 0.0;
+  for (size_t i = 0; i < precision.size(); ++i) {
+    largest = std::max(largest, precision[i][i]);
+  }
+  if (!(largest > 0.0)) {
+    throw std::runtime_error{"The log posterior has no curvature at the mode"};
+  }
+
+  /* scale = V diag(1 / sqrt(eigenvalue)), so scale * scale^T is the inverse
+   * of the precision, restricted to the directions with curvature */
+  size_t   n = mode.size();
+  matrix_t scale(n, params_t(n, 0.0));
+  for (size_t j = 0; j < n; ++j) {
+    double eigenvalue = precision[j][j];
+    if (eigenvalue <= flat_eigenvalue * largest) { continue; }
+    double sd = 1 / std::sqrt(eigenvalue);
+    for (size_t i = 0; i < n; ++i) { scale[i][j] = vectors[i][j] * sd; }
+  }
+  return {mode, std::move(scale), model.bounded_param_count()};
+}
@@ -0,0 +1,63 @@
+#ifndef LAPLACE_HPP
+#define LAPLACE_HPP
+
+#include "model.hpp"
+#include "util.hpp"
+#include <cstddef>
+#include <random>
+
+/**
+ * A multivariate normal distribution over the parameters, given by its mean
+ * and a square root of its covariance. Draws are `mean + scale * z`, for a
+ * vector `z` of independent standard normal draws.
+ *
+ * The first `bounded` parameters are restricted to [0, 1], like the bounded
+ * parameters of a model. Draws of them that fall outside are reflected back
+ * off the bounds, as the trajectories of the HMC sampler are.
+ */
+class gaussian_approximation_t {
+public:
+  gaussian_approximation_t(params_t mean, matrix_t scale, size_t bounded = 0);
+
+  /**
+   * Draw a set of parameters into `params`, which is resized to fit.
+   */
+  void draw(random_engine_t &gen, params_t &params);
+
+  [[nodiscard]] auto mean() const -> const params_t & { return _mean; }
+  [[nodiscard]] auto scale() const -> const matrix_t & { return _scale; }
+
+  [[nodiscard]] auto bounded_param_count() const -> size_t { return _bounded; }
+
+  /**
+   * The number of directions in which the distribution has no spread.
+   */
+  [[nodiscard]] auto flat_directions() const -> size_t {
+    return _flat_directions;
+  }
+
+private:
+  params_t                         _mean;
+  matrix_t                         _scale;
+  vector_t                         _draws;
+  size_t                           _bounded;
+  size_t                           _flat_directions{0};
+  std::normal_distribution<double> _normal{0.0, 1.0};
+};
+
+/**
+ * The Laplace approximation of the posterior: a normal distribution at the
+ * mode `mode`, whose covariance is the inverse of the negated Hessian of the
+ * log posterior there. The mode should be the bounded mode found by
+ * `find_mode`, and draws are kept in the bounds of the model.
+ *
+ * Directions in which the log posterior has no curvature, like shifting every
+ * strength of the Poisson model by the same amount, are given no spread, so
+ * draws stay at the mode along them, as the optimizer does.
+ */
+auto laplace_approximation(const likelihood_model_t &model,
+                           const log_prior_t        &prior,
+                           const params_t           &mode)
+    -> gaussian_approximation_t;
+
+#endif
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <json.hpp>
 #include <random>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -84,6 +85,12 @@ create_input_format_options(const cli_options_t &cli_options) {
   if (cli_options["bestofs"].initialized()) {
     ret.bestofs_filename = cli_options["bestofs"].value<std::string>();
   }
+  if (cli_options["samples-file"].initialized()) {
+    ret.samples_filename = cli_options["samples-file"].value<std::string>();
+  }
+  if (cli_options["groups"].initialized()) {
+    ret.groups_filename = cli_options["groups"].value<std::string>();
+  }
   ret.dummy = cli_options["dummy"].value(false);
   return ret;
 }
@@ -132,9 +139,54 @@ mcmc_options_t create_mcmc_options(const cli_options_t &cli_options) {
   mcmc_options.samples       = cli_options["samples"].value(100'000ul);
   mcmc_options.sample_matrix = cli_options["sample-matrix"].value(false);
   mcmc_options.node_probabilites = cli_options["node-probs"].value(false);
+  mcmc_options.chains            = cli_options["chains"].value(1ul);
+  mcmc_options.temperatures      = cli_options["temperatures"].value(1ul);
+  mcmc_options.max_temperature   = cli_options["max-temperature"].value(10.0);
+  mcmc_options.hmc               = cli_options["hmc"].value(false);
+  mcmc_options.leapfrog_steps    = cli_options["leapfrog-steps"].value(20ul);
+  mcmc_options.adaptive_covariance =
+      cli_options["adaptive-covariance"].value(false);
+  mcmc_options.adapt = cli_options["adapt"].value(false) ||
+                       mcmc_options.adaptive_covariance;
+  mcmc_options.target_acceptance =
+      cli_options["target-acceptance"].value(0.44);
+  mcmc_options.evaluation_threads = cli_options["eval-threads"].value(0ul);
+  mcmc_options.checkpoint_interval =
+      cli_options["checkpoint-interval"].value(0ul);
+  mcmc_options.resume = cli_options["resume"].value(false);
+  if (cli_options["target-ess"].initialized()) {
+    mcmc_options.target_ess = cli_options["target-ess"].value<double>();
+  }
+  if (cli_options["target-mcse"].initialized()) {
+    mcmc_options.target_mcse = cli_options["target-mcse"].value<double>();
+  }
+  mcmc_options.diagnostics = cli_options["diagnostics"].value(false) ||
+                             mcmc_options.target_ess.has_value() ||
+                             mcmc_options.target_mcse.has_value();
+  mcmc_options.diagnostics_interval =
+      cli_options["diagnostics-interval"].value(1000ul);
+  mcmc_options.optimize   = cli_options["optimize"].value(false);
+  mcmc_options.warm_start = cli_options["warm-start"].value(false);
+  mcmc_options.laplace    = cli_options["laplace"].value(false);
+  mcmc_options.bootstrap  = cli_options["bootstrap"].value(0ul);
   return mcmc_options;
 }
 
+pool_options_t create_pool_options(const cli_options_t &cli_options) {
+  pool_options_t pool_options;
+  if (cli_options["pool-points"].initialized()) {
+    std::istringstream points(cli_options["pool-points"].value<std::string>());
+    for (std::string p; std::getline(points, p, ',');) {
+      pool_options.round_points.push_back(std::stod(p));
+    }
+  }
+  if (cli_options["pool-bracket"].initialized()) {
+    pool_options.bracket_filename =
+        cli_options["pool-bracket"].value<std::string>();
+  }
+  return pool_options;
+}
+
 std::vector<std::string> read_teams_file(const std::string &teams_filename) {
   std::ifstream teams_file(teams_filename);
   if (!teams_file) {
@@ -154,6 +206,7 @@ program_options_t create_program_options(const cli_options_t &cli_options) {
   prog_opts.run_mode           = create_run_mode_type(cli_options).value();
   prog_opts.mcmc_options       = create_mcmc_options(cli_options);
   prog_opts.simulation_options = create_simulation_mode_options(cli_options);
+  prog_opts.pool_options       = create_pool_options(cli_options);
 
   prog_opts.teams = read_teams_file(cli_options["teams"].value<std::string>());
   if (cli_options["seed"].initialized()) {
@@ -164,6 +217,10 @@ program_options_t create_program_options(const cli_options_t &cli_options) {
   }
 
   prog_opts.output_prefix = cli_options["prefix"].value<std::string>();
+  prog_opts.meeting_probs = cli_options["meeting-probs"].value(false);
+  if (cli_options["prune-epsilon"].initialized()) {
+    prog_opts.prune_epsilon = cli_options["prune-epsilon"].value<double>();
+  }
 
   return prog_opts;
 }
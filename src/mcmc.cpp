@@ -1,8 +1,13 @@
 #include "mcmc.hpp"
+#include "checkpoint.hpp"
 #include "debug.h"
+#include "group_stage.hpp"
+#include "laplace.hpp"
 #include "match.hpp"
 #include "model.hpp"
+#include "optimizer.hpp"
 #include "program_options.hpp"
+#include "proposal.hpp"
 #include "sampler.hpp"
 #include "tournament_factory.hpp"
 #include "util.hpp"
@@ -10,9 +15,16 @@
 #include <algorithm>
 #include <cmath>
 #include <csv.h>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <numeric>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 std::vector<size_t> get_bestofs(const std::string &filename) {
@@ -229,12 +241,278 @@ static void write_team_files(const team_name_map_t          &name_map,
   team_map_outfile << "]}";
 }
 
+static auto trim(const std::string &str) -> std::string {
+  auto begin = str.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) { return {}; }
+  auto end = str.find_last_not_of(" \t\r");
+  return str.substr(begin, end - begin + 1);
+}
+
+/**
+ * Read a bracket for a pool. Each line of the file is a round, starting with
+ * the first round, and lists the picked winners of that round from left to
+ * right.
+ */
+static auto parse_pool_bracket_file(
+    const std::string                           &bracket_filename,
+    const std::vector<std::vector<std::string>> &round_labels,
+    const team_name_map_t                       &name_map) -> bracket_picks_t {
+  std::ifstream bracket_file(bracket_filename);
+  if (!bracket_file) {
+    throw std::runtime_error{"Could not read the pool bracket file"};
+  }
+
+  bracket_picks_t picks;
+  size_t          round = 0;
+  for (std::string line; std::getline(bracket_file, line);) {
+    if (trim(line).empty()) { continue; }
+    if (round >= round_labels.size()) {
+      throw std::runtime_error{"Pool bracket file has too many rounds"};
+    }
+    std::istringstream line_stream(line);
+    size_t             match = 0;
+    for (std::string team; std::getline(line_stream, team, ',');) {
+      if (match >= round_labels[round].size()) {
+        throw std::runtime_error{"Pool bracket file has too many picks in "
+                                 "round " +
+                                 std::to_string(round + 1)};
+      }
+      picks[round_labels[round][match++]] = name_map.at(trim(team));
+    }
+    round++;
+  }
+
+  return picks;
+}
+
+static void write_pool_files(tournament_t<tournament_node_t> &tournament,
+                             const program_options_t         &program_options,
+                             const team_name_map_t           &name_map,
+                             const std::string               &output_suffix) {
+  const auto &round_points = program_options.pool_options.round_points;
+  if (round_points.empty()) { return; }
+
+  debug_string(EMIT_LEVEL_PROGRESS, "Computing the optimal pool bracket");
+  auto round_labels             = tournament.round_labels();
+  auto [best_picks, best_score] = tournament.optimal_pool_bracket(round_points);
+
+  std::ofstream pool_outfile(program_options.output_prefix + ".dynamic.pool" +
+                             output_suffix);
+  pool_outfile << "{\"expected-score\": " << best_score;
+  pool_outfile << ", \"bracket\": [";
+  for (size_t r = 0; r < round_labels.size(); ++r) {
+    pool_outfile << "[";
+    for (size_t m = 0; m < round_labels[r].size(); ++m) {
+      pool_outfile << "\""
+                   << program_options.teams[best_picks.at(round_labels[r][m])]
+                   << "\"";
+      if (m != round_labels[r].size() - 1) { pool_outfile << ", "; }
+    }
+    pool_outfile << "]";
+    if (r != round_labels.size() - 1) { pool_outfile << ", "; }
+  }
+  pool_outfile << "]";
+
+  if (program_options.pool_options.bracket_filename.has_value()) {
+    auto picks = parse_pool_bracket_file(
+        program_options.pool_options.bracket_filename.value(),
+        round_labels,
+        name_map);
+    pool_outfile << ", \"bracket-expected-score\": "
+                 << tournament.expected_pool_score(picks, round_points);
+  }
+  pool_outfile << "}" << std::endl;
+}
+
+/**
+ * Evaluate a dynamic tournament, and also write the meeting probabilities if
+ * they were requested. If pruning was requested, the bound on the error of the
+ * approximation is written alongside the result.
+ */
+static auto compute_dynamic(tournament_t<tournament_node_t> &tournament,
+                            const program_options_t         &program_options,
+                            const std::string &output_infix) -> vector_t {
+  std::optional<meeting_probs_t> meetings;
+  std::optional<pruning_t>       pruning;
+  if (program_options.meeting_probs) { meetings = meeting_probs_t{}; }
+  if (program_options.prune_epsilon.has_value()) {
+    pruning = pruning_t{program_options.prune_epsilon.value(), 0.0};
+  }
+
+  auto wp = tournament.eval(meetings.has_value() ? &meetings.value() : nullptr,
+                            pruning.has_value() ? &pruning.value() : nullptr);
+
+  if (meetings.has_value()) {
+    debug_string(EMIT_LEVEL_PROGRESS, "Writing meeting probabilities");
+    std::ofstream meetings_outfile(program_options.output_prefix +
+                                       ".dynamic.meetings" + output_infix +
+                                       ".bin",
+                                   std::ios::binary);
+    meetings->write_binary(meetings_outfile);
+  }
+
+  if (pruning.has_value()) {
+    debug_print(EMIT_LEVEL_IMPORTANT,
+                "Pruned evaluation discarded at most %e probability",
+                pruning->discarded);
+    std::ofstream prune_outfile(program_options.output_prefix +
+                                ".dynamic.prune" + output_infix + ".json");
+    prune_outfile << "{\"epsilon\": " << pruning->epsilon
+                  << ", \"error-bound\": " << pruning->discarded << "}"
+                  << std::endl;
+  }
+  return wp;
+}
+
+/**
+ * Find the group with the name `name` in a groups file.
+ */
+static auto find_group(const std::vector<std::string> &group_names,
+                       const std::string              &name) -> size_t {
+  auto it = std::find(group_names.begin(), group_names.end(), name);
+  if (it == group_names.end()) {
+    throw std::runtime_error{"Groups file refers to a missing group: " + name};
+  }
+  return static_cast<size_t>(it - group_names.begin());
+}
+
+static auto split_list(const std::string &list) -> std::vector<std::string> {
+  std::vector<std::string> items;
+  std::istringstream       list_stream(list);
+  for (std::string item; std::getline(list_stream, item, ',');) {
+    if (!trim(item).empty()) { items.push_back(trim(item)); }
+  }
+  return items;
+}
+
+/**
+ * Read a group stage. Each line of the file is one of
+ *
+ *   group NAME: TEAM, TEAM, ...
+ *   slots: SLOT, SLOT, ...
+ *   best NAME, NAME, ...: NAME, NAME, ...
+ *
+ * where a slot is a position and a group name, e.g. `1A` for the winner of
+ * group A, or a position and a `*` for one of the best teams in that position
+ * across all groups. A `best` line gives, for the groups on the left providing
+ * the best placed teams, the group assigned to each best placed slot. Lines
+ * starting with a `#` are ignored.
+ */
+static auto parse_groups_file(const std::string     &groups_filename,
+                              const team_name_map_t &name_map)
+    -> group_tournament_t {
+  std::ifstream groups_file(groups_filename);
+  if (!groups_file) {
+    throw std::runtime_error{"Could not read the groups file"};
+  }
+
+  std::vector<std::string>                         group_names;
+  std::vector<std::vector<size_t>>                 groups;
+  std::vector<std::string>                         slot_names;
+  std::vector<std::pair<std::string, std::string>> best_lines;
+  for (std::string line; std::getline(groups_file, line);) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') { continue; }
+    auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      throw std::runtime_error{"Groups file line is missing a colon: " + line};
+    }
+    auto key   = trim(line.substr(0, colon));
+    auto value = line.substr(colon + 1);
+    if (key.rfind("group ", 0) == 0) {
+      group_names.push_back(trim(key.substr(6)));
+      groups.emplace_back();
+      for (const auto &team : split_list(value)) {
+        groups.back().push_back(name_map.at(team));
+      }
+    } else if (key == "slots") {
+      slot_names = split_list(value);
+    } else if (key.rfind("best ", 0) == 0) {
+      best_lines.emplace_back(key.substr(5), value);
+    } else {
+      throw std::runtime_error{"Groups file has an unknown line: " + line};
+    }
+  }
+
+  std::vector<knockout_slot_t> slots;
+  std::optional<size_t>        best_placed_position;
+  for (const auto &slot_name : slot_names) {
+    size_t digits = slot_name.find_first_not_of("0123456789");
+    if (digits == 0 || digits == std::string::npos) {
+      throw std::runtime_error{"Groups file has a malformed slot: " +
+                               slot_name};
+    }
+    size_t position = std::stoul(slot_name.substr(0, digits)) - 1;
+    auto   group    = trim(slot_name.substr(digits));
+    if (group == "*") {
+      if (best_placed_position.value_or(position) != position) {
+        throw std::runtime_error{
+            "Best placed slots must all be for the same position"};
+      }
+      best_placed_position = position;
+      slots.push_back({0, position, true});
+    } else {
+      slots.push_back({find_group(group_names, group), position, false});
+    }
+  }
+
+  group_tournament_t tournament{
+      std::move(groups), std::move(slots), best_placed_position.value_or(2)};
+
+  std::map<uint64_t, std::vector<size_t>> best_placed_table;
+  for (const auto &[qualified, assigned] : best_lines) {
+    uint64_t mask = 0;
+    for (const auto &group : split_list(qualified)) {
+      mask |= 1UL << find_group(group_names, group);
+    }
+    auto &row = best_placed_table[mask];
+    for (const auto &group : split_list(assigned)) {
+      row.push_back(find_group(group_names, group));
+    }
+  }
+  tournament.set_best_placed_table(std::move(best_placed_table));
+
+  return tournament;
+}
+
+/**
+ * Evaluate a tournament with a group stage, as given by the groups file, and
+ * write its win probabilities to `filename`.
+ */
+static void write_group_stage(const program_options_t &program_options,
+                              const team_name_map_t   &name_map,
+                              const matrix_t          &win_probs,
+                              const matrix_t          &draw_probs,
+                              const std::string       &filename) {
+  if (program_options.run_mode != run_mode_e::dynamic) {
+    throw std::runtime_error{"Group stages are only supported in dynamic mode"};
+  }
+  if (program_options.meeting_probs ||
+      program_options.prune_epsilon.has_value() ||
+      !program_options.pool_options.round_points.empty()) {
+    throw std::runtime_error{"Group stages can not be combined with meeting "
+                             "probabilities, pruning or pools"};
+  }
+
+  debug_string(EMIT_LEVEL_PROGRESS, "Computing the group stage");
+  auto tournament = parse_groups_file(
+      program_options.input_formats.groups_filename.value(), name_map);
+  if (program_options.input_formats.bestofs_filename.has_value()) {
+    tournament.set_bestof(
+        get_bestofs(program_options.input_formats.bestofs_filename.value()));
+  }
+
+  auto          wp = tournament.eval(win_probs, draw_probs);
+  std::ofstream wp_outfile(filename);
+  wp_outfile << to_json(wp) << std::endl;
+}
+
 static auto get_lh_model(const program_options_t    &program_options,
                          const std::vector<match_t> &matches)
     -> std::tuple<std::unique_ptr<likelihood_model_t>,
                   std::function<std::pair<params_t, double>(const params_t &,
                                                             random_engine_t &)>,
-                  std::function<double(const params_t &)>> {
+                  log_prior_t> {
 
   if (program_options.mcmc_options.model_type == likelihood_model::poisson) {
     debug_string(EMIT_LEVEL_IMPORTANT, "Using a Poisson likelihood model");
@@ -242,7 +520,7 @@ static auto get_lh_model(const program_options_t    &program_options,
         std::make_unique<poisson_likelihood_model_t>(
             poisson_likelihood_model_t(matches));
     auto update_func = update_win_probs_beta_with_scale;
-    return std::make_tuple(std::move(lhm), update_func, uniform_prior);
+    return std::make_tuple(std::move(lhm), update_func, uniform_log_prior());
   }
 
   debug_string(EMIT_LEVEL_IMPORTANT, "Using a simple likelihood model");
@@ -250,7 +528,7 @@ static auto get_lh_model(const program_options_t    &program_options,
       std::make_unique<simple_likelihood_model_t>(
           simple_likelihood_model_t(matches));
   auto update_func = update_win_probs_uniform;
-  return std::make_tuple(std::move(lhm), update_func, uniform_prior);
+  return std::make_tuple(std::move(lhm), update_func, uniform_log_prior());
 }
 
 void compute_tournament(const program_options_t &program_options) {
@@ -263,7 +541,13 @@ void compute_tournament(const program_options_t &program_options) {
     odds = parse_odds_file(program_options.input_formats.odds_filename.value(),
                            team_name_map);
     const std::string output_suffix = ".odds.json";
-    if (program_options.run_mode == run_mode_e::single) {
+    if (program_options.input_formats.groups_filename.has_value()) {
+      write_group_stage(program_options,
+                        team_name_map,
+                        odds,
+                        {},
+                        output_prefix + ".dynamic" + output_suffix);
+    } else if (program_options.run_mode == run_mode_e::single) {
       std::ofstream odds_outfile(output_prefix + ".single" + output_suffix);
       auto          t = tournament_factory_single(program_options.teams);
       t.reset_win_probs(odds);
@@ -273,8 +557,9 @@ void compute_tournament(const program_options_t &program_options) {
       std::ofstream odds_outfile(output_prefix + ".dynamic" + output_suffix);
       auto          t = tournament_factory(program_options.teams);
       t.reset_win_probs(odds);
-      auto wp = t.eval();
+      auto wp = compute_dynamic(t, program_options, ".odds");
       odds_outfile << to_json(wp) << std::endl;
+      write_pool_files(t, program_options, team_name_map, output_suffix);
     }
     if (program_options.run_mode == run_mode_e::simulation) {
       std::ofstream odds_outfile(output_prefix + ".sim" + output_suffix);
@@ -290,19 +575,25 @@ void compute_tournament(const program_options_t &program_options) {
     matrix_t probs = parse_prob_files(
         program_options.input_formats.probs_filename.value(), team_name_map);
     const std::string output_suffix = ".probs.json";
-    if (program_options.run_mode == run_mode_e::single) {
+    if (program_options.input_formats.groups_filename.has_value()) {
+      write_group_stage(program_options,
+                        team_name_map,
+                        probs,
+                        {},
+                        output_prefix + ".dynamic" + output_suffix);
+    } else if (program_options.run_mode == run_mode_e::single) {
       std::ofstream probs_outfile(output_prefix + ".single" + output_suffix);
       auto          t = tournament_factory_single(program_options.teams);
       t.reset_win_probs(probs);
       auto wp = t.eval();
       probs_outfile << to_json(wp) << std::endl;
-    }
-    if (program_options.run_mode == run_mode_e::dynamic) {
+    } else if (program_options.run_mode == run_mode_e::dynamic) {
       std::ofstream probs_outfile(output_prefix + ".dynamic" + output_suffix);
       auto          t = tournament_factory(program_options.teams);
       t.reset_win_probs(probs);
-      auto wp = t.eval();
+      auto wp = compute_dynamic(t, program_options, ".probs");
       probs_outfile << to_json(wp) << std::endl;
+      write_pool_files(t, program_options, team_name_map, output_suffix);
     }
     if (program_options.run_mode == run_mode_e::simulation) {
       std::ofstream probs_outfile(output_prefix + ".sim" + output_suffix);
@@ -344,6 +635,706 @@ static auto verify_teams(const std::vector<match_t>     &matches,
   return team_indicies;
 }
 
+/**
+ * Geometric temperature ladder from 1 to `max_temperature`, with `count`
+ * rungs.
+ */
+static auto make_temperature_ladder(size_t count, double max_temperature)
+    -> std::vector<double> {
+  std::vector<double> ladder{1.0};
+  for (size_t k = 1; k < count; ++k) {
+    ladder.push_back(std::pow(max_temperature,
+                              static_cast<double>(k) /
+                                  static_cast<double>(count - 1)));
+  }
+  return ladder;
+}
+
+/**
+ * Where an interrupted run left off. Either the number of samples of a samples
+ * file which have been evaluated, or the checkpoint of a chain.
+ */
+struct resume_state_t {
+  size_t                            evaluated_samples = 0;
+  std::optional<chain_checkpoint_t> checkpoint;
+
+  [[nodiscard]] auto resuming() const -> bool {
+    return evaluated_samples > 0 || checkpoint.has_value();
+  }
+};
+
+static auto checkpoint_filename(const program_options_t &options)
+    -> std::filesystem::path {
+  return options.output_prefix + "." +
+         std::string{describe_run_type(options.run_mode)} + ".checkpoint";
+}
+
+/**
+ * Run `program_options.mcmc_options.chains` independent MCMC chains, feeding
+ * their samples into `results`. Each chain has its own seed, likelihood model
+ * and tournament. When built with OpenMP, the chains run concurrently.
+ *
+ * The first chain uses the seed from the program options, so a single chain
+ * run is unchanged. The requested samples are split evenly between the chains.
+ * If more than one temperature is requested, each chain is a parallel
+ * tempering chain.
+ *
+ * A single random walk chain can be checkpointed, and resumed from
+ * `checkpoint`.
+ */
+template <typename T>
+static void
+run_chains(results_t                                         &results,
+           const program_options_t                           &program_options,
+           const std::vector<match_t>                        &matches,
+           const std::vector<size_t>                         &team_indicies,
+           const std::function<tournament_t<T>()>            &make_tournament,
+           const std::function<void(sampler_t<T> &)>         &setup_sampler,
+           const std::optional<chain_checkpoint_t>           &checkpoint,
+           const std::optional<params_t>                     &initial_params) {
+  size_t chains = std::max<size_t>(program_options.mcmc_options.chains, 1);
+  size_t mcmc_samples = program_options.mcmc_options.samples;
+  size_t burnin_samples =
+      static_cast<double>(mcmc_samples) * program_options.mcmc_options.burnin;
+
+  random_engine_t     seeder(program_options.seed);
+  std::vector<size_t> seeds{program_options.seed};
+  for (size_t c = 1; c < chains; ++c) { seeds.push_back(seeder()); }
+
+  std::vector<log_prior_t>         prior_funcs;
+  std::vector<adaptive_proposal_t> proposals;
+  std::vector<sampler_t<T>>        samplers;
+  samplers.reserve(chains);
+  for (size_t c = 0; c < chains; ++c) {
+    auto [lhm, update_func, prior_func] =
+        get_lh_model(program_options, matches);
+    (void)update_func;
+    if (program_options.mcmc_options.adapt) {
+      proposals.emplace_back(lhm->param_count(),
+                             lhm->bounded_param_count(),
+                             program_options.mcmc_options.target_acceptance,
+                             program_options.mcmc_options.adaptive_covariance);
+    }
+    samplers.emplace_back(std::move(lhm), make_tournament());
+    samplers.back().set_team_indicies(team_indicies);
+    samplers.back().set_chain(c);
+    if (initial_params.has_value()) {
+      samplers.back().set_initial_params(initial_params.value());
+    }
+    samplers.back().set_evaluation_threads(
+        program_options.mcmc_options.evaluation_threads, make_tournament);
+    setup_sampler(samplers.back());
+    prior_funcs.push_back(prior_func);
+  }
+
+  if (chains > 1) {
+    debug_print(EMIT_LEVEL_PROGRESS, "Running %lu chains", chains);
+  }
+  if (program_options.mcmc_options.evaluation_threads > 0) {
+    debug_print(EMIT_LEVEL_PROGRESS,
+                "Evaluating samples on %lu threads per chain",
+                program_options.mcmc_options.evaluation_threads);
+  }
+
+  constexpr size_t swap_interval = 10;
+  auto             temperatures  = make_temperature_ladder(
+      program_options.mcmc_options.temperatures,
+      program_options.mcmc_options.max_temperature);
+  if (temperatures.size() > 1) {
+    debug_print(EMIT_LEVEL_PROGRESS,
+                "Using parallel tempering with %lu replicas",
+                temperatures.size());
+  }
+
+  constexpr double hmc_target_accept = 0.8;
+  if (program_options.mcmc_options.hmc) {
+    if (temperatures.size() > 1) {
+      throw std::runtime_error{
+          "HMC can not be combined with parallel tempering"};
+    }
+    debug_string(EMIT_LEVEL_PROGRESS, "Using Hamiltonian Monte Carlo");
+  }
+
+  if (program_options.mcmc_options.checkpoint_interval > 0 ||
+      checkpoint.has_value()) {
+    if (chains > 1 || program_options.mcmc_options.hmc ||
+        temperatures.size() > 1) {
+      throw std::runtime_error{"Checkpoints are only supported for a single "
+                               "random walk chain"};
+    }
+    samplers.front().set_checkpointing(
+        checkpoint_filename(program_options),
+        program_options.mcmc_options.checkpoint_interval);
+    if (checkpoint.has_value()) { samplers.front().resume_from(*checkpoint); }
+  }
+
+  if (program_options.mcmc_options.adapt) {
+    if (program_options.mcmc_options.hmc || temperatures.size() > 1) {
+      throw std::runtime_error{"Proposal adaptation can only be used with a "
+                               "single temperature random walk"};
+    }
+    if (program_options.mcmc_options.adaptive_covariance &&
+        program_options.mcmc_options.model_type == likelihood_model::simple) {
+      throw std::runtime_error{
+          "Covariance learning is only supported for the Poisson model"};
+    }
+    debug_print(EMIT_LEVEL_PROGRESS,
+                "Adapting the proposal during burnin, target acceptance: %f",
+                program_options.mcmc_options.target_acceptance);
+  }
+
+  std::vector<std::exception_ptr> errors(chains);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+  for (size_t c = 0; c < chains; ++c) {
+    /* The samples are split between the chains, but every chain is
+     * independent, so each needs the full burnin */
+    size_t chain_samples =
+        mcmc_samples / chains + (c < mcmc_samples % chains ? 1 : 0);
+    try {
+      if (program_options.mcmc_options.hmc) {
+        samplers[c].run_hmc_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            prior_funcs[c],
+            program_options.mcmc_options.leapfrog_steps,
+            hmc_target_accept,
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      } else if (temperatures.size() > 1 &&
+                 program_options.mcmc_options.model_type ==
+                     likelihood_model::poisson) {
+        samplers[c].run_tempered_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            win_probs_beta_with_scale_proposal_t{},
+            prior_funcs[c],
+            temperatures,
+            swap_interval,
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      } else if (temperatures.size() > 1) {
+        samplers[c].run_tempered_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            win_probs_uniform_proposal_t{},
+            prior_funcs[c],
+            temperatures,
+            swap_interval,
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      } else if (program_options.mcmc_options.adapt) {
+        samplers[c].run_adaptive_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            proposals[c],
+            prior_funcs[c],
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      } else if (program_options.mcmc_options.model_type ==
+                 likelihood_model::poisson) {
+        /* In-place equivalents of the update functions of `get_lh_model` */
+        win_probs_beta_with_scale_proposal_t proposal;
+        samplers[c].run_inplace_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            proposal,
+            prior_funcs[c],
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      } else {
+        win_probs_uniform_proposal_t proposal;
+        samplers[c].run_inplace_chain(
+            results,
+            chain_samples,
+            burnin_samples,
+            seeds[c],
+            proposal,
+            prior_funcs[c],
+            program_options.mcmc_options.sample_matrix,
+            program_options.mcmc_options.node_probabilites);
+      }
+    } catch (...) { errors[c] = std::current_exception(); }
+  }
+  for (const auto &e : errors) {
+    if (e) { std::rethrow_exception(e); }
+  }
+
+  write_graph_files(samplers.front().get_tournament(),
+                    program_options.output_prefix,
+                    std::string{describe_run_type(program_options.run_mode)});
+}
+
+static auto evaluation_progress_filename(const program_options_t &options)
+    -> std::filesystem::path {
+  return options.output_prefix + "." +
+         std::string{describe_run_type(options.run_mode)} + ".eval.progress";
+}
+
+/**
+ * Record how many samples have been evaluated, along with the size of every
+ * output file at that point. The file is replaced atomically, so it always
+ * describes a consistent state of the outputs.
+ */
+static void
+write_evaluation_progress(const std::filesystem::path              &filename,
+                          size_t                                     samples,
+                          const std::vector<std::filesystem::path> &outputs) {
+  auto tmp_filename = filename;
+  tmp_filename += ".tmp";
+  {
+    std::ofstream progress_file(tmp_filename);
+    progress_file << samples << "\n";
+    for (const auto &path : outputs) {
+      progress_file << std::filesystem::file_size(path) << " " << path.string()
+                    << "\n";
+    }
+  }
+  std::filesystem::rename(tmp_filename, filename);
+}
+
+/**
+ * If an earlier evaluation of a samples file was interrupted, cut its output
+ * files back to the last recorded progress, and return the number of samples
+ * that were evaluated.
+ */
+static auto restore_evaluation_progress(const std::filesystem::path &filename)
+    -> std::optional<size_t> {
+  std::ifstream progress_file(filename);
+  if (!progress_file) { return {}; }
+
+  size_t samples = 0;
+  progress_file >> samples;
+  uintmax_t   size = 0;
+  std::string path;
+  while (progress_file >> size && std::getline(progress_file, path)) {
+    path = trim(path);
+    if (!std::filesystem::exists(path) ||
+        std::filesystem::file_size(path) < size) {
+      throw std::runtime_error{"Output file " + path +
+                               " is shorter than its recorded progress"};
+    }
+    std::filesystem::resize_file(path, size);
+  }
+  debug_print(EMIT_LEVEL_IMPORTANT,
+              "Resuming the evaluation after %lu samples",
+              samples);
+  return samples;
+}
+
+/**
+ * Evaluate the samples of an earlier run with the tournament of this run,
+ * instead of running chains. The outputs are checkpointed every
+ * `checkpoint_interval` samples, so an interrupted evaluation can be resumed.
+ */
+template <typename T>
+static void evaluate_samples_file(
+    results_t                                 &results,
+    const program_options_t                   &program_options,
+    const std::vector<match_t>                &matches,
+    const std::vector<size_t>                 &team_indicies,
+    const std::function<tournament_t<T>()>    &make_tournament,
+    const std::function<void(sampler_t<T> &)> &setup_sampler,
+    size_t                                     resume_from) {
+  constexpr size_t checkpoint_interval = 1000;
+
+  auto lhm = std::get<0>(get_lh_model(program_options, matches));
+  sampler_t<T> sampler{std::move(lhm), make_tournament()};
+  sampler.set_team_indicies(team_indicies);
+
+  size_t threads = program_options.mcmc_options.evaluation_threads;
+  if (threads == 0) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  sampler.set_evaluation_threads(threads, make_tournament);
+  setup_sampler(sampler);
+
+  sample_reader_t reader(
+      program_options.input_formats.samples_filename.value());
+  reader.skip(resume_from);
+
+  auto progress_filename = evaluation_progress_filename(program_options);
+  debug_print(EMIT_LEVEL_PROGRESS,
+              "Evaluating posterior samples on %lu threads",
+              threads);
+
+  size_t evaluated = resume_from;
+  for (size_t batch = checkpoint_interval; batch == checkpoint_interval;) {
+    batch = sampler.evaluate_samples(
+        results,
+        reader,
+        checkpoint_interval,
+        program_options.mcmc_options.sample_matrix,
+        program_options.mcmc_options.node_probabilites);
+    evaluated += batch;
+    write_evaluation_progress(progress_filename, evaluated, results.flush());
+    debug_print(EMIT_LEVEL_PROGRESS, "%lu samples evaluated", evaluated);
+  }
+
+  write_graph_files(sampler.get_tournament(),
+                    program_options.output_prefix,
+                    std::string{describe_run_type(program_options.run_mode)});
+}
+
+/**
+ * Find the maximum a posteriori parameters of `lhm`.
+ */
+static auto find_map_params(const likelihood_model_t &lhm,
+                            const log_prior_t        &prior_func) -> params_t {
+  auto optimum = find_mode(lhm, prior_func, params_t(lhm.param_count(), 0.5));
+  if (!optimum.converged) {
+    debug_print(EMIT_LEVEL_IMPORTANT,
+                "The optimizer did not converge after %lu iterations",
+                optimum.iterations);
+  }
+  debug_print(EMIT_LEVEL_PROGRESS,
+              "Found the maximum a posteriori parameters in %lu iterations, "
+              "log posterior: %f",
+              optimum.iterations,
+              optimum.log_posterior);
+  return optimum.params;
+}
+
+/**
+ * Find the maximum a posteriori parameters, and write the tournament win
+ * probabilities they give, along with the parameters themselves.
+ */
+template <typename T>
+static auto write_map_prediction(
+    const program_options_t                   &program_options,
+    const std::vector<match_t>                &matches,
+    const std::vector<size_t>                 &team_indicies,
+    const std::function<tournament_t<T>()>    &make_tournament,
+    const std::function<void(sampler_t<T> &)> &setup_sampler) -> params_t {
+  auto [lhm, update_func, prior_func] = get_lh_model(program_options, matches);
+  (void)update_func;
+
+  auto params = find_map_params(*lhm, prior_func);
+
+  sampler_t<T> sampler{std::move(lhm), make_tournament()};
+  sampler.set_team_indicies(team_indicies);
+  setup_sampler(sampler);
+  auto wp = sampler.evaluate_params(params);
+
+  std::string prefix = program_options.output_prefix + "." +
+                       std::string{describe_run_type(program_options.run_mode)};
+  std::ofstream wp_outfile(prefix + ".mlp.json");
+  wp_outfile << to_json(wp) << std::endl;
+  std::ofstream params_outfile(prefix + ".mlp.params.json");
+  params_outfile << to_json(params) << std::endl;
+
+  return params;
+}
+
+/**
+ * As `write_map_prediction`, but for a tournament with a group stage. The
+ * Poisson model also gives the draw probabilities of the group matches.
+ */
+static void
+write_group_stage_map_prediction(const program_options_t    &program_options,
+                                 const std::vector<match_t> &matches,
+                                 const team_name_map_t      &name_map) {
+  const auto &mcmc_options = program_options.mcmc_options;
+  if (!mcmc_options.optimize || mcmc_options.bootstrap > 0 ||
+      program_options.input_formats.samples_filename.has_value()) {
+    throw std::runtime_error{
+        "Group stages with matches are only supported with --optimize"};
+  }
+
+  auto [lhm, update_func, prior_func] = get_lh_model(program_options, matches);
+  (void)update_func;
+
+  auto params        = find_map_params(*lhm, prior_func);
+  auto team_indicies = make_team_indicies(name_map, program_options.teams);
+  auto win_probs     = lhm->generate_win_probs(params, team_indicies);
+
+  matrix_t draw_probs;
+  if (const auto *poisson =
+          dynamic_cast<const poisson_likelihood_model_t *>(lhm.get())) {
+    draw_probs = poisson->generate_draw_probs(params, team_indicies);
+  }
+
+  std::string prefix = program_options.output_prefix + "." +
+                       std::string{describe_run_type(program_options.run_mode)};
+  write_group_stage(program_options,
+                    name_map,
+                    win_probs,
+                    draw_probs,
+                    prefix + ".mlp.json");
+  std::ofstream params_outfile(prefix + ".mlp.params.json");
+  params_outfile << to_json(params) << std::endl;
+}
+
+/**
+ * Reject the options that the Laplace approximation does not support, before
+ * anything is written.
+ */
+static void check_laplace_options(const program_options_t &program_options) {
+  const auto &mcmc_options = program_options.mcmc_options;
+  if (mcmc_options.model_type != likelihood_model::poisson) {
+    throw std::runtime_error{
+        "The Laplace approximation is only supported for the Poisson model"};
+  }
+  if (mcmc_options.checkpoint_interval > 0 || mcmc_options.resume) {
+    throw std::runtime_error{
+        "Checkpoints are not supported with the Laplace approximation"};
+  }
+}
+
+/**
+ * Draw the samples from the Laplace approximation of the posterior at `mode`,
+ * instead of running chains. The draws are evaluated on worker threads, like
+ * the samples of a samples file.
+ */
+template <typename T>
+static void
+run_laplace(results_t                                 &results,
+            const program_options_t                   &program_options,
+            const std::vector<match_t>                &matches,
+            const std::vector<size_t>                 &team_indicies,
+            const std::function<tournament_t<T>()>    &make_tournament,
+            const std::function<void(sampler_t<T> &)> &setup_sampler,
+            const params_t                            &mode) {
+  const auto &mcmc_options = program_options.mcmc_options;
+
+  auto [lhm, update_func, prior_func] = get_lh_model(program_options, matches);
+  (void)update_func;
+  auto approximation = laplace_approximation(*lhm, prior_func, mode);
+  if (approximation.flat_directions() > 0) {
+    debug_print(EMIT_LEVEL_INFO,
+                "The posterior is flat in %lu directions, which are not "
+                "sampled",
+                approximation.flat_directions());
+  }
+
+  sampler_t<T> sampler{std::move(lhm), make_tournament()};
+  sampler.set_team_indicies(team_indicies);
+  size_t threads = mcmc_options.evaluation_threads;
+  if (threads == 0) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  sampler.set_evaluation_threads(threads, make_tournament);
+  setup_sampler(sampler);
+
+  debug_print(EMIT_LEVEL_PROGRESS,
+              "Drawing samples from the Laplace approximation on %lu threads",
+              threads);
+  sampler.run_independent_samples(results,
+                                  mcmc_options.samples,
+                                  program_options.seed,
+                                  std::move(approximation),
+                                  mcmc_options.sample_matrix,
+                                  mcmc_options.node_probabilites);
+
+  write_graph_files(sampler.get_tournament(),
+                    program_options.output_prefix,
+                    std::string{describe_run_type(program_options.run_mode)});
+}
+
+/**
+ * Write the mean, standard deviation, median and central 95% interval of the
+ * win probability of every team over the bootstrap replicates, along with the
+ * win probabilities of every replicate.
+ */
+static void write_bootstrap_summary(const std::string &filename,
+                                    const matrix_t    &win_probs,
+                                    size_t             converged) {
+  size_t   replicates = win_probs.size();
+  size_t   teams      = win_probs.front().size();
+  vector_t mean(teams, 0.0);
+  vector_t sd(teams, 0.0);
+  vector_t lower(teams);
+  vector_t median(teams);
+  vector_t upper(teams);
+
+  auto     n = static_cast<double>(replicates);
+  vector_t team_probs(replicates);
+  for (size_t t = 0; t < teams; ++t) {
+    for (size_t r = 0; r < replicates; ++r) { team_probs[r] = win_probs[r][t]; }
+    for (double p : team_probs) { mean[t] += p / n; }
+    for (double p : team_probs) { sd[t] += (p - mean[t]) * (p - mean[t]); }
+    sd[t] = replicates > 1 ? std::sqrt(sd[t] / (n - 1)) : 0.0;
+
+    std::sort(team_probs.begin(), team_probs.end());
+    auto quantile = [&team_probs, n](double q) {
+      return team_probs[static_cast<size_t>(std::round(q * (n - 1)))];
+    };
+    lower[t]  = quantile(0.025);
+    median[t] = quantile(0.5);
+    upper[t]  = quantile(0.975);
+  }
+
+  std::ofstream outfile(filename);
+  outfile << "{\"replicates\": " << replicates
+          << ", \"converged\": " << converged
+          << ", \"mean\": " << to_json(mean) << ", \"sd\": " << to_json(sd)
+          << ", \"lower\": " << to_json(lower)
+          << ", \"median\": " << to_json(median)
+          << ", \"upper\": " << to_json(upper)
+          << ", \"win_probs\": " << to_json(win_probs) << "}" << std::endl;
+}
+
+/**
+ * Fit `--bootstrap` replicates of the matches, resampled with
+ * `generate_bootstrap`, by maximum a posteriori optimization, and summarise
+ * the win probabilities the fits give. The replicates are fit in parallel, and
+ * replicate `r` always uses the `r`th seed drawn from the run's seed, so the
+ * results do not depend on the number of threads.
+ */
+template <typename T>
+static void
+run_bootstrap(const program_options_t                   &program_options,
+              const std::vector<match_t>                &matches,
+              const std::vector<size_t>                 &team_indicies,
+              const std::function<tournament_t<T>()>    &make_tournament,
+              const std::function<void(sampler_t<T> &)> &setup_sampler) {
+  size_t replicates = program_options.mcmc_options.bootstrap;
+  if (matches.empty()) {
+    throw std::runtime_error{"Bootstrapping needs a match history"};
+  }
+
+  auto   prior      = std::get<2>(get_lh_model(program_options, matches));
+  size_t team_count = count_teams(matches);
+  bool   poisson    = program_options.mcmc_options.model_type ==
+                 likelihood_model::poisson;
+
+  random_engine_t       seeder(program_options.seed);
+  std::vector<uint64_t> seeds(replicates);
+  for (auto &s : seeds) { s = seeder(); }
+
+  debug_print(
+      EMIT_LEVEL_PROGRESS, "Fitting %lu bootstrap replicates", replicates);
+
+  matrix_t                        win_probs(replicates);
+  std::vector<char>               converged(replicates, 0);
+  std::vector<std::exception_ptr> errors(replicates);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (size_t r = 0; r < replicates; ++r) {
+    try {
+      auto replicate = generate_bootstrap(matches, seeds[r]);
+      std::unique_ptr<likelihood_model_t> lhm;
+      if (poisson) {
+        lhm = std::make_unique<poisson_likelihood_model_t>(replicate,
+                                                           team_count);
+      } else {
+        lhm = std::make_unique<simple_likelihood_model_t>(replicate,
+                                                          team_count);
+      }
+      auto optimum =
+          find_mode(*lhm, prior, params_t(lhm->param_count(), 0.5));
+      converged[r] = optimum.converged ? 1 : 0;
+
+      sampler_t<T> sampler{std::move(lhm), make_tournament()};
+      sampler.set_team_indicies(team_indicies);
+      setup_sampler(sampler);
+      win_probs[r] = sampler.evaluate_params(optimum.params);
+    } catch (...) { errors[r] = std::current_exception(); }
+  }
+  for (const auto &e : errors) {
+    if (e) { std::rethrow_exception(e); }
+  }
+
+  size_t converged_count =
+      static_cast<size_t>(std::count(converged.begin(), converged.end(), 1));
+  if (converged_count < replicates) {
+    debug_print(EMIT_LEVEL_IMPORTANT,
+                "The fits of %lu bootstrap replicates did not converge",
+                replicates - converged_count);
+  }
+
+  write_bootstrap_summary(
+      program_options.output_prefix + "." +
+          std::string{describe_run_type(program_options.run_mode)} +
+          ".bootstrap.json",
+      win_probs,
+      converged_count);
+}
+
+/**
+ * Either run the MCMC chains, or evaluate the samples of an earlier run if a
+ * samples file was given. When asked, the chains are started from the maximum
+ * a posteriori parameters, or replaced by them or by draws from the Laplace
+ * approximation around them.
+ */
+template <typename T>
+static void
+run_sampler(results_t                                 &results,
+            const program_options_t                   &program_options,
+            const std::vector<match_t>                &matches,
+            const std::vector<size_t>                 &team_indicies,
+            const std::function<tournament_t<T>()>    &make_tournament,
+            const std::function<void(sampler_t<T> &)> &setup_sampler,
+            const resume_state_t                      &resume) {
+  if (program_options.input_formats.samples_filename.has_value()) {
+    evaluate_samples_file<T>(results,
+                             program_options,
+                             matches,
+                             team_indicies,
+                             make_tournament,
+                             setup_sampler,
+                             resume.evaluated_samples);
+    return;
+  }
+
+  if (program_options.mcmc_options.bootstrap > 0) {
+    run_bootstrap<T>(program_options,
+                     matches,
+                     team_indicies,
+                     make_tournament,
+                     setup_sampler);
+    return;
+  }
+
+  if (program_options.mcmc_options.laplace) {
+    check_laplace_options(program_options);
+  }
+
+  std::optional<params_t> initial_params;
+  if (program_options.mcmc_options.optimize ||
+      program_options.mcmc_options.warm_start ||
+      program_options.mcmc_options.laplace) {
+    initial_params = write_map_prediction<T>(program_options,
+                                             matches,
+                                             team_indicies,
+                                             make_tournament,
+                                             setup_sampler);
+    if (program_options.mcmc_options.optimize) { return; }
+  }
+
+  if (program_options.mcmc_options.laplace) {
+    run_laplace<T>(results,
+                   program_options,
+                   matches,
+                   team_indicies,
+                   make_tournament,
+                   setup_sampler,
+                   initial_params.value());
+    return;
+  }
+
+  run_chains<T>(results,
+                program_options,
+                matches,
+                team_indicies,
+                make_tournament,
+                setup_sampler,
+                resume.checkpoint,
+                initial_params);
+}
+
 void mcmc_run(const program_options_t &program_options) {
   auto team_name_map = create_name_map(program_options.teams);
 
@@ -371,87 +1362,111 @@ void mcmc_run(const program_options_t &program_options) {
     }
   }
 
-  results.set_run_type(program_options.run_mode)
-      .add_file_output(program_options.output_prefix)
-      .enable_memory_save();
+  if (program_options.input_formats.groups_filename.has_value()) {
+    write_group_stage_map_prediction(program_options, matches, team_name_map);
+    write_team_files(team_name_map,
+                     program_options.teams,
+                     program_options.output_prefix,
+                     std::string{describe_run_type(program_options.run_mode)},
+                     ".json");
+    return;
+  }
 
-  if (program_options.mcmc_options.node_probabilites) {
-    results.add_node_probs_output(program_options.output_prefix);
+  results.set_run_type(program_options.run_mode);
+  if (program_options.mcmc_options.chains > 1) {
+    results.enable_chain_tagging();
   }
 
-  size_t mcmc_samples = program_options.mcmc_options.samples;
-  size_t burnin_samples =
-      static_cast<double>(mcmc_samples) * program_options.mcmc_options.burnin;
+  resume_state_t resume;
+  if (program_options.input_formats.samples_filename.has_value()) {
+    resume.evaluated_samples =
+        restore_evaluation_progress(
+            evaluation_progress_filename(program_options))
+            .value_or(0);
+  } else if (program_options.mcmc_options.resume) {
+    resume.checkpoint =
+        chain_checkpoint_t::read(checkpoint_filename(program_options));
+    resume.checkpoint->truncate_outputs();
+  }
 
-  if (program_options.run_mode == run_mode_e::single) {
-    auto [lhm, update_func, prior_func] =
-        get_lh_model(program_options, matches);
-    sampler_t<single_node_t> sampler{
-        std::move(lhm), tournament_factory_single(program_options.teams)};
-    sampler.set_team_indicies(team_indicies);
+  bool sampling = (!program_options.mcmc_options.optimize &&
+                   program_options.mcmc_options.bootstrap == 0) ||
+                  program_options.input_formats.samples_filename.has_value();
+  if (sampling) {
+    results.add_file_output(program_options.output_prefix, resume.resuming());
+    if (!program_options.input_formats.samples_filename.has_value()) {
+      results.enable_memory_save();
+    }
 
+    if (program_options.mcmc_options.node_probabilites) {
+      results.add_node_probs_output(program_options.output_prefix,
+                                    resume.resuming());
+    }
+  }
+
+  if (program_options.mcmc_options.diagnostics &&
+      !program_options.mcmc_options.optimize &&
+      program_options.mcmc_options.bootstrap == 0 &&
+      !program_options.input_formats.samples_filename.has_value()) {
+    const auto &mcmc_options = program_options.mcmc_options;
+    results.enable_diagnostics(
+        {mcmc_options.target_ess, mcmc_options.target_mcse},
+        mcmc_options.diagnostics_interval);
+  }
+
+  if (program_options.run_mode == run_mode_e::single) {
     debug_string(EMIT_LEVEL_PROGRESS, "Running MCMC sampler (Single Mode)");
-    sampler.run_chain(results,
-                      mcmc_samples,
-                      burnin_samples,
-                      program_options.seed,
-                      update_func,
-                      prior_func,
-                      program_options.mcmc_options.sample_matrix,
-                      program_options.mcmc_options.node_probabilites);
-    write_graph_files(sampler.get_tournament(),
-                      program_options.output_prefix,
-                      std::string{describe_run_type(program_options.run_mode)});
+    run_sampler<single_node_t>(
+        results,
+        program_options,
+        matches,
+        team_indicies,
+        [&program_options]() {
+          return tournament_factory_single(program_options.teams);
+        },
+        [](sampler_t<single_node_t> &) {},
+        resume);
   }
 
   if (program_options.run_mode == run_mode_e::dynamic) {
-    auto [lhm, update_func, prior_func] =
-        get_lh_model(program_options, matches);
-    sampler_t<tournament_node_t> sampler{
-        std::move(lhm), tournament_factory(program_options.teams)};
-    sampler.set_team_indicies(team_indicies);
+    std::vector<size_t> bestofs;
     if (program_options.input_formats.bestofs_filename.has_value()) {
-      sampler.set_bestofs(
-          get_bestofs(program_options.input_formats.bestofs_filename.value()));
+      bestofs =
+          get_bestofs(program_options.input_formats.bestofs_filename.value());
     }
 
     debug_string(EMIT_LEVEL_PROGRESS, "Running MCMC sampler (Dynamic Mode)");
-    sampler.run_chain(results,
-                      mcmc_samples,
-                      burnin_samples,
-                      program_options.seed,
-                      update_func,
-                      prior_func,
-                      program_options.mcmc_options.sample_matrix,
-                      program_options.mcmc_options.node_probabilites);
-    write_graph_files(sampler.get_tournament(),
-                      program_options.output_prefix,
-                      std::string{describe_run_type(program_options.run_mode)});
+    run_sampler<tournament_node_t>(
+        results,
+        program_options,
+        matches,
+        team_indicies,
+        [&program_options]() {
+          return tournament_factory(program_options.teams);
+        },
+        [&bestofs](sampler_t<tournament_node_t> &sampler) {
+          if (!bestofs.empty()) { sampler.set_bestofs(bestofs); }
+        },
+        resume);
   }
 
   if (program_options.run_mode == run_mode_e::simulation) {
-    auto [lhm, update_func, prior_func] =
-        get_lh_model(program_options, matches);
-    sampler_t<simulation_node_t> sampler{
-        std::move(lhm), tournament_factory_simulation(program_options.teams)};
-    sampler.set_team_indicies(team_indicies);
-
-    sampler.set_simulation_iterations(
-        program_options.simulation_options.samples);
-
     debug_string(EMIT_LEVEL_PROGRESS, "Running MCMC sampler (Simulation Mode)");
-    sampler.run_chain(results,
-                      mcmc_samples,
-                      burnin_samples,
-                      program_options.seed,
-                      update_func,
-                      prior_func,
-                      program_options.mcmc_options.sample_matrix,
-                      program_options.mcmc_options.node_probabilites);
-    write_graph_files(sampler.get_tournament(),
-                      program_options.output_prefix,
-                      std::string{describe_run_type(program_options.run_mode)});
+    run_sampler<simulation_node_t>(
+        results,
+        program_options,
+        matches,
+        team_indicies,
+        [&program_options]() {
+          return tournament_factory_simulation(program_options.teams);
+        },
+        [&program_options](sampler_t<simulation_node_t> &sampler) {
+          sampler.set_simulation_iterations(
+              program_options.simulation_options.samples);
+        },
+        resume);
   }
+  results.write_diagnostics(program_options.output_prefix);
   write_team_files(team_name_map,
                    program_options.teams,
                    program_options.output_prefix,
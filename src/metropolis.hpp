@@ -0,0 +1,159 @@
+#ifndef METROPOLIS_HPP
+#define METROPOLIS_HPP
+
+#include "model.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+/**
+ * Adapts an update function, which returns a new set of parameters, to the
+ * in-place proposal interface. Allocates on every call, like the update
+ * function itself.
+ */
+class function_proposal_t {
+public:
+  using update_func_t = std::function<std::pair<params_t, double>(
+      const params_t &, random_engine_t &)>;
+
+  explicit function_proposal_t(update_func_t update_func) :
+      _update_func{std::move(update_func)} {}
+
+  auto propose(const params_t  &params,
+               params_t        &proposed,
+               random_engine_t &gen) -> proposal_move_t {
+    double hastings_ratio;
+    std::tie(proposed, hastings_ratio) = _update_func(params, gen);
+
+    proposal_move_t move{{}, std::log(hastings_ratio)};
+    for (size_t k = 0; k < params.size(); ++k) {
+      if (params[k] == proposed[k]) { continue; }
+      if (move.changed.has_value()) {
+        move.changed.reset();
+        break;
+      }
+      move.changed = k;
+    }
+    return move;
+  }
+
+private:
+  update_func_t _update_func;
+};
+
+/**
+ * A single random walk Metropolis-Hastings step, templated on the proposal and
+ * the prior so that both are called directly.
+ *
+ * The proposal changes a second copy of the parameters in place. After the
+ * accept/reject step, the copies are brought back in line by copying only the
+ * changed parameter, so a step does not allocate unless the proposal or the
+ * likelihood model does.
+ *
+ * `Proposal` needs `propose(params, proposed, gen) -> proposal_move_t`, and
+ * `Prior` needs `operator()(params)` and `delta(params, proposed, index)`, like
+ * `log_prior_t`.
+ *
+ * For parallel tempering, `inv_temp` raises the likelihood to `1 / T`.
+ */
+template <typename Proposal, typename Prior> class metropolis_kernel_t {
+public:
+  metropolis_kernel_t(const likelihood_model_t &lh_model,
+                      Proposal                 &proposal,
+                      const Prior              &prior,
+                      params_t                  params,
+                      double                    inv_temp = 1.0) :
+      _lh_model{lh_model},
+      _proposal{proposal},
+      _prior{prior},
+      _params{std::move(params)},
+      _proposed{_params},
+      _log_lh{_lh_model.log_likelihood(_params)},
+      _inv_temp{inv_temp} {}
+
+  /**
+   * Take a step. Returns true if the proposal was accepted.
+   */
+  auto step(random_engine_t &gen) -> bool {
+    _last_move = _proposal.propose(_params, _proposed, gen);
+
+    double next_lh;
+    double log_prior_ratio;
+    if (_last_move.changed.has_value()) {
+      size_t index = _last_move.changed.value();
+      next_lh      = _log_lh +
+                _lh_model.delta_log_likelihood(_params, _proposed, index);
+      log_prior_ratio = _prior.delta(_params, _proposed, index);
+    } else {
+      next_lh         = _lh_model.log_likelihood(_proposed);
+      log_prior_ratio = _prior(_proposed) - _prior(_params);
+    }
+    if (std::isnan(next_lh)) { throw std::runtime_error("next_lh is nan"); }
+
+    double log_acceptance = _inv_temp * (next_lh - _log_lh) +
+                            log_prior_ratio + _last_move.log_hastings;
+    bool accepted = std::log(_coin(gen)) < log_acceptance;
+    if (accepted) { _log_lh = next_lh; }
+
+    auto &from = accepted ? _proposed : _params;
+    auto &to   = accepted ? _params : _proposed;
+    if (_last_move.changed.has_value()) {
+      to[_last_move.changed.value()] = from[_last_move.changed.value()];
+    } else {
+      std::copy(from.begin(), from.end(), to.begin());
+    }
+    return accepted;
+  }
+
+  /**
+   * Recompute the log likelihood from scratch, so that the rounding errors of
+   * incremental updates do not accumulate.
+   */
+  void refresh_log_likelihood() {
+    _log_lh = _lh_model.log_likelihood(_params);
+  }
+
+  /**
+   * Replace the state of the chain, when resuming from a checkpoint.
+   */
+  void restore(const params_t &params, double log_lh) {
+    _params   = params;
+    _proposed = params;
+    _log_lh   = log_lh;
+  }
+
+  /**
+   * Exchange states with another chain, as in a parallel tempering swap. The
+   * temperatures stay with the chains.
+   */
+  void swap_state(metropolis_kernel_t &other) {
+    std::swap(_params, other._params);
+    std::swap(_proposed, other._proposed);
+    std::swap(_log_lh, other._log_lh);
+  }
+
+  [[nodiscard]] auto params() const -> const params_t & { return _params; }
+  [[nodiscard]] auto log_likelihood() const -> double { return _log_lh; }
+  [[nodiscard]] auto inv_temp() const -> double { return _inv_temp; }
+  [[nodiscard]] auto last_move() const -> const proposal_move_t & {
+    return _last_move;
+  }
+
+private:
+  const likelihood_model_t        &_lh_model;
+  Proposal                        &_proposal;
+  const Prior                     &_prior;
+  params_t                         _params;
+  params_t                         _proposed;
+  double                           _log_lh;
+  double                           _inv_temp;
+  proposal_move_t                  _last_move{{}, 0.0};
+  std::uniform_real_distribution<> _coin{0.0, 1.0};
+};
+
+#endif
@@ -2,8 +2,16 @@
 #include "factorial.hpp"
 #include "match.hpp"
 #include "model.hpp"
+#include "skellam_table.hpp"
 #include "util.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <utility>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -14,17 +22,62 @@
  */
 simple_likelihood_model_t::simple_likelihood_model_t(
     const std::vector<match_t> &matches) :
-    _param_count(count_teams(matches)) {
+    simple_likelihood_model_t(matches, count_teams(matches)) {}
 
-  _win_matrix.reserve(_param_count);
-  for (size_t i = 0; i < _param_count; ++i) {
-    _win_matrix.emplace_back(_param_count);
+/* Only the pairs of teams which played are kept, as a pair which never played
+ * adds nothing to the likelihood. Matches of a team with itself were never
+ * counted, so they are dropped too */
+simple_likelihood_model_t::simple_likelihood_model_t(
+    const std::vector<match_t> &matches, size_t team_count) :
+    _param_count(std::max(team_count, count_teams(matches))),
+    _team_pairs(_param_count) {
+  std::map<std::pair<size_t, size_t>, size_t> pair_indices;
+  for (const auto &m : matches) {
+    if (m.l_team == m.r_team) { continue; }
+    size_t l_team = std::min(m.l_team, m.r_team);
+    size_t r_team = std::max(m.l_team, m.r_team);
+
+    auto [it, inserted] = pair_indices.try_emplace({l_team, r_team}, 0);
+    if (inserted) {
+      it->second = _pairs.size();
+      _pairs.push_back({l_team, r_team, 0.0, 0.0, 0.0});
+      _team_pairs[l_team].push_back(it->second);
+      _team_pairs[r_team].push_back(it->second);
+    }
+
+    /* A win for the left team is counted towards the right team's side of
+     * the pair, as in the dense win matrix the pairs replaced */
+    size_t counted = m.winner == match_winner_t::left ? m.r_team : m.l_team;
+    auto  &pair    = _pairs[it->second];
+    if (counted == pair.l_team) {
+      pair.l_count += 1.0;
+    } else {
+      pair.r_count += 1.0;
+    }
   }
 
-  for (const auto &m : matches) {
-    _win_matrix[m.r_team][m.l_team] += 1 * static_cast<unsigned int>(m.winner);
-    _win_matrix[m.l_team][m.r_team] += 1 * static_cast<unsigned int>(!m.winner);
+  for (auto &pair : _pairs) {
+    auto l_count    = static_cast<size_t>(pair.l_count);
+    auto r_count    = static_cast<size_t>(pair.r_count);
+    pair.log_orders = log_factorial(l_count + r_count) -
+                      log_factorial(l_count) - log_factorial(r_count);
+  }
+}
+
+/* Outcomes which did not happen are skipped, so that a probability of 0 does
+ * not give 0 * log(0) */
+auto simple_likelihood_model_t::pair_log_likelihood(
+    const params_t &team_win_probs, const team_pair_t &pair) -> double {
+  double l_str = team_win_probs[pair.l_team];
+  double r_str = team_win_probs[pair.r_team];
+  double llh   = pair.log_orders;
+  if (pair.l_count > 0.0) {
+    llh += pair.l_count * std::log(l_str / (l_str + r_str));
+  }
+  if (pair.r_count > 0.0) {
+    llh += pair.r_count * std::log(r_str / (l_str + r_str));
   }
+  return llh;
 }
 
 /**
@@ -37,152 +90,348 @@ auto simple_likelihood_model_t::log_likelihood(
   debug_print(EMIT_LEVEL_DEBUG,
               "team_win_probs: %s",
               to_string(team_win_probs).c_str());
-  debug_print(EMIT_LEVEL_DEBUG, "win matrix size: %lu", _win_matrix.size());
-
-  for (size_t i = 0; i < _win_matrix.size(); ++i) {
-    for (size_t j = i + 1; j < _win_matrix.size(); ++j) {
-      double l_wp = team_win_probs[i] / (team_win_probs[i] + team_win_probs[j]);
-      double r_wp = 1 - l_wp;
-      debug_print(EMIT_LEVEL_DEBUG,
-                  "twp[i]: %f, twp[j]: %f, l_wp: %f, r_wp: %f i: %lu, j: %lu",
-                  team_win_probs[i],
-                  team_win_probs[j],
-                  l_wp,
-                  r_wp,
-                  i,
-                  j);
-      double tmp_lh = int_pow(l_wp, _win_matrix[i][j]) *
-                      int_pow(r_wp, _win_matrix[j][i]) *
-                      combinations(_win_matrix[i][j] + _win_matrix[j][i],
-                                   _win_matrix[i][j]);
-      llh += std::log(tmp_lh);
-    }
+  debug_print(EMIT_LEVEL_DEBUG, "pairs of teams: %lu", _pairs.size());
+
+  for (const auto &pair : _pairs) {
+    llh += pair_log_likelihood(team_win_probs, pair);
   }
   debug_print(EMIT_LEVEL_DEBUG, "computed llh: %f", llh);
   assert_string(!std::isnan(llh), "LH computed is NaN");
   return llh;
 }
 
-auto poisson_likelihood_model_t::log_likelihood(const params_t &team_strs) const
+auto simple_likelihood_model_t::maximization_step(
+    const params_t &team_strs) const -> params_t {
+  /* Keeps teams without a win from reaching 0, where the likelihood of two
+   * such teams playing each other is undefined */
+  constexpr double min_strength = 1e-9;
+
+  params_t next{team_strs};
+  size_t   teams = _team_pairs.size();
+  for (size_t i = 0; i < teams; ++i) {
+    double wins        = 0.0;
+    double denominator = 0.0;
+    for (auto p : _team_pairs[i]) {
+      const auto &pair  = _pairs[p];
+      double      games = pair.l_count + pair.r_count;
+      wins        += i == pair.l_team ? pair.l_count : pair.r_count;
+      denominator += games / (team_strs[pair.l_team] + team_strs[pair.r_team]);
+    }
+    if (denominator > 0.0) { next[i] = wins / denominator; }
+  }
+
+  auto   strengths_end = next.begin() + static_cast<std::ptrdiff_t>(teams);
+  double largest       = *std::max_element(next.begin(), strengths_end);
+  if (!(largest > 0.0)) { return team_strs; }
+  for (size_t i = 0; i < teams; ++i) {
+    next[i] = std::max(0.5 * next[i] / largest, min_strength);
+  }
+  return next;
+}
+
+auto simple_likelihood_model_t::delta_log_likelihood(
+    const params_t &params, const params_t &new_params, size_t index) const
     -> double {
-  double llh = 0.0;
+  if (index >= _team_pairs.size()) { return 0.0; }
 
-#ifdef _OPENMP
-#pragma omp parallel for reduction(+ : llh)
-#endif
-  for (const auto &m : _matches) {
-    /*
-    double param1 = NAN;
-    double param2 = NAN;
-    param1        = team_strs[m.l_team];
-    param2        = team_strs[m.r_team];
+  double delta = 0.0;
+  for (auto p : _team_pairs[index]) {
+    delta += pair_log_likelihood(new_params, _pairs[p]) -
+             pair_log_likelihood(params, _pairs[p]);
+  }
+  assert_string(!std::isnan(delta), "Delta LH computed is NaN");
+  return delta;
+}
 
-    double lambda_l = std::exp(param1 - param2);
-    double lambda_r = std::exp(param2 - param1);
+poisson_likelihood_model_t::poisson_likelihood_model_t(
+    const std::vector<match_t> &matches) :
+    poisson_likelihood_model_t(matches, count_teams(matches)) {}
+
+poisson_likelihood_model_t::poisson_likelihood_model_t(
+    const std::vector<match_t> &matches, size_t team_count) :
+    _param_count{std::max(team_count, count_teams(matches)) + 1},
+    _team_pairs(_param_count) {
+  /* The team indices are stored as int32, for the gathers of the vector
+   * kernels */
+  if (_param_count > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    throw std::runtime_error{"Too many teams for the Poisson model"};
+  }
 
-    double term_l = std::pow(lambda_l, m.l_goals) / factorial(m.l_goals) *
-                    std::exp(-lambda_l);
+  std::map<std::pair<size_t, size_t>, size_t> pair_indices;
+  for (const auto &m : matches) {
+    bool   swapped = m.r_team < m.l_team;
+    size_t l_team  = swapped ? m.r_team : m.l_team;
+    size_t r_team  = swapped ? m.l_team : m.r_team;
 
-    double term_r = std::pow(lambda_r, m.r_goals) / factorial(m.r_goals) *
-                    std::exp(-lambda_r);
-    */
+    auto [it, inserted] = pair_indices.try_emplace({l_team, r_team}, 0);
+    if (inserted) {
+      it->second = _pairs.size();
+      _pairs.l_team.push_back(static_cast<int32_t>(l_team));
+      _pairs.r_team.push_back(static_cast<int32_t>(r_team));
+      _pairs.matches.push_back(0.0);
+      _pairs.l_goals.push_back(0.0);
+      _pairs.r_goals.push_back(0.0);
+      _team_pairs[l_team].push_back(it->second);
+      if (r_team != l_team) { _team_pairs[r_team].push_back(it->second); }
+    }
 
-    assert_string(m.l_team < team_strs.size(),
-                  "Team strength index out of bounds");
-    assert_string(m.r_team < team_strs.size(),
-                  "Team strength index out of bounds");
+    size_t p            = it->second;
+    size_t l_goals      = swapped ? m.r_goals : m.l_goals;
+    size_t r_goals      = swapped ? m.l_goals : m.r_goals;
+    _pairs.matches[p]  += 1.0;
+    _pairs.l_goals[p]  += static_cast<double>(l_goals);
+    _pairs.r_goals[p]  += static_cast<double>(r_goals);
+    _log_factorial_sum += log_factorial(l_goals) + log_factorial(r_goals);
+  }
+}
 
-    double param1      = team_strs[m.l_team];
-    double param2      = team_strs[m.r_team];
-    double scale_param = team_strs[team_strs.size() - 1];
+auto poisson_likelihood_model_t::pair_log_likelihood(
+    size_t pair, const params_t &team_strs) const -> double {
+  return poisson_pairs_log_likelihood(
+      _pairs, team_strs, pair, pair + 1, simd_level_t::scalar);
+}
 
-    double log_lambda_l = param1 - param2 + scale_param;
-    double log_lambda_r = param2 - param1 + scale_param;
+auto poisson_likelihood_model_t::log_likelihood(const params_t &team_strs) const
+    -> double {
+  assert_string(team_strs.size() == _param_count,
+                "Wrong number of parameters for the Poisson model");
 
-    double term_l = log_lambda_l * m.l_goals - log_factorial(m.l_goals) -
-                    std::exp(log_lambda_l);
-    double term_r = log_lambda_r * m.r_goals - log_factorial(m.r_goals) -
-                    std::exp(log_lambda_r);
+  /* Large histories are split into chunks, which are evaluated in parallel.
+   * Not when called from a parallel region, such as the chains or the replicas
+   * of a tempered chain, as that would oversubscribe the cores */
+  constexpr size_t chunk_size = 4096;
+  size_t           chunks     = (_pairs.size() + chunk_size - 1) / chunk_size;
 
-    double term = term_l + term_r;
-    assert_string(!std::isnan(term), "Term computed is nan");
-    llh += term;
+  double llh = 0.0;
+#ifdef _OPENMP
+  bool parallel = chunks > 1 && omp_in_parallel() == 0;
+#pragma omp parallel for reduction(+ : llh) if (parallel)
+#endif
+  for (size_t c = 0; c < chunks; ++c) {
+    llh += poisson_pairs_log_likelihood(
+        _pairs,
+        team_strs,
+        c * chunk_size,
+        std::min(_pairs.size(), (c + 1) * chunk_size),
+        _simd_level);
   }
+  llh -= _log_factorial_sum;
 
   assert_string(!std::isnan(llh), "LLH computed is NaN");
   assert_string(llh <= 0.0, "LLH is positive");
   return llh;
 }
 
+/**
+ * With log(lambda_l) = p_l - p_r + s, the derivative of a match's term with
+ * respect to log(lambda_l) is (goals_l - lambda_l), and likewise for the right
+ * team. The chain rule then distributes these to p_l, p_r and s. Summed over
+ * the matches of a pair, the goals become the pair's total goals, and lambda
+ * is counted once per match.
+ */
+auto poisson_likelihood_model_t::log_likelihood_gradient(
+    const params_t &team_strs, params_t &gradient) const -> double {
+  gradient.assign(team_strs.size(), 0.0);
+  double scale_param = team_strs[team_strs.size() - 1];
+  double llh         = -_log_factorial_sum;
+
+  for (size_t p = 0; p < _pairs.size(); ++p) {
+    auto   l_team   = static_cast<size_t>(_pairs.l_team[p]);
+    auto   r_team   = static_cast<size_t>(_pairs.r_team[p]);
+    double param1   = team_strs[l_team];
+    double param2   = team_strs[r_team];
+    double lambda_l = std::exp(param1 - param2 + scale_param);
+    double lambda_r = std::exp(param2 - param1 + scale_param);
+
+    llh += (param1 - param2 + scale_param) * _pairs.l_goals[p] +
+           (param2 - param1 + scale_param) * _pairs.r_goals[p] -
+           _pairs.matches[p] * (lambda_l + lambda_r);
+
+    double d_l = _pairs.l_goals[p] - _pairs.matches[p] * lambda_l;
+    double d_r = _pairs.r_goals[p] - _pairs.matches[p] * lambda_r;
+
+    gradient[l_team]               += d_l - d_r;
+    gradient[r_team]               += d_r - d_l;
+    gradient[team_strs.size() - 1] += d_l + d_r;
+  }
+
+  /* Far from the mode the rates can overflow. Gradient based samplers treat
+   * this as a divergence, so report it rather than aborting */
+  if (std::isnan(llh)) { return -std::numeric_limits<double>::infinity(); }
+  return llh;
+}
+
+/**
+ * The second derivative of a match's term with respect to log(lambda_l) is
+ * -lambda_l, and log(lambda_l) is linear in the parameters, so each match adds
+ * -lambda_l u u^T to the Hessian, where u is the gradient of log(lambda_l).
+ * Likewise for the right team.
+ */
+auto poisson_likelihood_model_t::log_likelihood_hessian(
+    const params_t &team_strs, params_t &gradient, matrix_t &hessian) const
+    -> double {
+  double llh = log_likelihood_gradient(team_strs, gradient);
+
+  size_t scale = team_strs.size() - 1;
+  hessian.assign(team_strs.size(), params_t(team_strs.size(), 0.0));
+  for (size_t p = 0; p < _pairs.size(); ++p) {
+    auto   l_team   = static_cast<size_t>(_pairs.l_team[p]);
+    auto   r_team   = static_cast<size_t>(_pairs.r_team[p]);
+    double param1   = team_strs[l_team];
+    double param2   = team_strs[r_team];
+    double lambda_l = std::exp(param1 - param2 + team_strs[scale]);
+    double lambda_r = std::exp(param2 - param1 + team_strs[scale]);
+
+    const std::pair<size_t, double> u[] = {
+        {l_team, 1.0}, {r_team, -1.0}, {scale, 1.0}};
+    for (const auto &[i, ui] : u) {
+      for (const auto &[j, uj] : u) {
+        /* The gradient of log(lambda_r) is u with the team signs flipped */
+        double vi = i == scale ? ui : -ui;
+        double vj = j == scale ? uj : -uj;
+        hessian[i][j] -=
+            _pairs.matches[p] * (lambda_l * ui * uj + lambda_r * vi * vj);
+      }
+    }
+  }
+  return llh;
+}
+
+auto poisson_likelihood_model_t::delta_log_likelihood(
+    const params_t &params, const params_t &new_params, size_t index) const
+    -> double {
+  if (index + 1 >= params.size()) {
+    return log_likelihood(new_params) - log_likelihood(params);
+  }
+  if (index >= _team_pairs.size()) { return 0.0; }
+
+  double delta = 0.0;
+  for (auto p : _team_pairs[index]) {
+    delta += pair_log_likelihood(p, new_params) -
+             pair_log_likelihood(p, params);
+  }
+  assert_string(!std::isnan(delta), "Delta LLH computed is NaN");
+  return delta;
+}
+
+/**
+ * Fill in the win probabilities of every pair of teams with at least one team
+ * for which `changed` is true. `set_pair(wp, i, j)` fills in the pair of
+ * teams `i < j`, in both directions.
+ */
+template <typename Changed, typename SetPair>
+static void fill_win_probs(size_t    teams,
+                           matrix_t &wp,
+                           Changed   changed,
+                           SetPair   set_pair) {
+  for (size_t i = 0; i < teams; ++i) {
+    if (!changed(i)) { continue; }
+    for (size_t j = 0; j < teams; ++j) {
+      /* Pairs of two changed teams are filled in from the first of them */
+      if (j == i || (j < i && changed(j))) { continue; }
+      if (j < i) {
+        set_pair(wp, j, i);
+      } else {
+        set_pair(wp, i, j);
+      }
+    }
+  }
+}
+
+/**
+ * A square matrix for `teams` teams, reusing the rows of `wp` if it already
+ * has the right shape. Returns false if `wp` had to be resized, in which case
+ * every entry has to be filled in again.
+ */
+static auto shape_win_probs(size_t teams, matrix_t &wp) -> bool {
+  bool shaped = wp.size() == teams;
+  wp.resize(teams);
+  for (auto &row : wp) {
+    shaped = shaped && row.size() == teams;
+    row.resize(teams);
+  }
+  return shaped;
+}
+
 auto simple_likelihood_model_t::generate_win_probs(
     const params_t &params, const std::vector<size_t> &team_indicies) const
     -> matrix_t {
+  /* An empty matrix is filled in completely, without the old parameters */
   matrix_t wp;
-  wp.reserve(team_indicies.size());
-  for (size_t i = 0; i < team_indicies.size(); ++i) {
-    wp.emplace_back(team_indicies.size());
-  }
-  for (size_t i = 0; i < team_indicies.size(); ++i) {
-    for (size_t j = i + 1; j < team_indicies.size(); ++j) {
-      size_t team1_index = team_indicies[i];
-      size_t team2_index = team_indicies[j];
-      double w =
-          params[team1_index] / (params[team1_index] + params[team2_index]);
-      assert_string(w <= 1.0, "Win prob is well formed");
-      assert_string(w >= 0.0, "Win prob is well formed");
-      wp[i][j] = w;
-      wp[j][i] = 1 - w;
-    }
-  }
+  update_win_probs({}, params, team_indicies, wp);
   return wp;
 }
 
+void simple_likelihood_model_t::update_win_probs(
+    const params_t            &params,
+    const params_t            &new_params,
+    const std::vector<size_t> &team_indicies,
+    matrix_t                  &win_probs) const {
+  bool all     = !shape_win_probs(team_indicies.size(), win_probs);
+  auto changed = [&](size_t i) {
+    return all || params[team_indicies[i]] != new_params[team_indicies[i]];
+  };
+  auto set_pair = [&](matrix_t &wp, size_t i, size_t j) {
+    size_t team1_index = team_indicies[i];
+    size_t team2_index = team_indicies[j];
+    double w           = new_params[team1_index] /
+               (new_params[team1_index] + new_params[team2_index]);
+    assert_string(w <= 1.0, "Win prob is well formed");
+    assert_string(w >= 0.0, "Win prob is well formed");
+    wp[i][j] = w;
+    wp[j][i] = 1 - w;
+  };
+  fill_win_probs(team_indicies.size(), win_probs, changed, set_pair);
+}
+
 auto poisson_likelihood_model_t::generate_win_probs(
     const params_t &params, const std::vector<size_t> &team_indicies) const
     -> matrix_t {
+  /* An empty matrix is filled in completely, without the old parameters */
   matrix_t wp;
-  wp.reserve(team_indicies.size());
-  for (size_t i = 0; i < team_indicies.size(); ++i) {
-    wp.emplace_back(team_indicies.size());
-  }
-
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-  for (size_t i = 0; i < team_indicies.size(); i++) {
-    for (size_t j = i + 1; j < team_indicies.size(); j++) {
-      double team1_index = team_indicies[i];
-      double team2_index = team_indicies[j];
-      double param1      = params[team1_index];
-      double param2      = params[team2_index];
+  update_win_probs({}, params, team_indicies, wp);
+  return wp;
+}
 
-      double lambda1 = std::exp(param1 - param2);
-      double lambda2 = std::exp(param2 - param1);
+void poisson_likelihood_model_t::update_win_probs(
+    const params_t            &params,
+    const params_t            &new_params,
+    const std::vector<size_t> &team_indicies,
+    matrix_t                  &win_probs) const {
+  bool all     = !shape_win_probs(team_indicies.size(), win_probs);
+  auto changed = [&](size_t i) {
+    return all || params[team_indicies[i]] != new_params[team_indicies[i]];
+  };
 
-      double t1_prob  = skellam_cmf(-1, lambda2, lambda1);
-      double tie_prob = skellam_pmf(0, lambda2, lambda1);
-      double t2_prob  = 1 - t1_prob - tie_prob;
+  const auto &table    = skellam_table();
+  auto        set_pair = [&](matrix_t &wp, size_t i, size_t j) {
+    double t1_prob = phylourny_prob_clamp(table.win_prob(
+        new_params[team_indicies[i]] - new_params[team_indicies[j]]));
+    double t2_prob = phylourny_prob_clamp(1.0 - t1_prob);
 
-      t1_prob += tie_prob / 2.0;
-      t2_prob += tie_prob / 2.0;
+    assert_string(t1_prob <= 1.0 && t1_prob >= 0.0,
+                  "Generated probabilities are not well formed");
 
-      t1_prob = phylourny_prob_clamp(t1_prob);
-      t2_prob = phylourny_prob_clamp(t2_prob);
+    wp[i][j] = t1_prob;
+    wp[j][i] = t2_prob;
+  };
+  fill_win_probs(team_indicies.size(), win_probs, changed, set_pair);
+}
 
-      assert_string(t1_prob <= 1.0,
-                    "Generated probabilities are not well formed");
-      assert_string(t1_prob >= 0.0,
-                    "Generated probabilities are not well formed");
+auto poisson_likelihood_model_t::generate_draw_probs(
+    const params_t &params, const std::vector<size_t> &team_indicies) const
+    -> matrix_t {
+  matrix_t dp(team_indicies.size(), vector_t(team_indicies.size()));
 
-      assert_string(t2_prob <= 1.0,
-                    "Generated probabilities are not well formed");
-      assert_string(t2_prob >= 0.0,
-                    "Generated probabilities are not well formed");
+  for (size_t i = 0; i < team_indicies.size(); i++) {
+    for (size_t j = i + 1; j < team_indicies.size(); j++) {
+      double tie_prob = phylourny_prob_clamp(skellam_table().draw_prob(
+          params[team_indicies[i]] - params[team_indicies[j]]));
 
-      wp[i][j] = t1_prob;
-      wp[j][i] = t2_prob;
+      dp[i][j] = tie_prob;
+      dp[j][i] = tie_prob;
     }
   }
 
-  return wp;
+  return dp;
 }
@@ -2,7 +2,9 @@
 #define DATASET_HPP
 
 #include "match.hpp"
+#include "poisson_kernel.hpp"
 #include "util.hpp"
+#include <stdexcept>
 #include <vector>
 
 class likelihood_model_t {
@@ -13,14 +15,93 @@ public:
     return std::log(likelihood(p));
   }
 
+  /**
+   * Change in the log likelihood going from `params` to `new_params`, where the
+   * two only differ in the parameter `index`. Models can override this to only
+   * visit the terms that depend on that parameter. The default recomputes both
+   * log likelihoods.
+   */
+  [[nodiscard]] virtual auto
+  delta_log_likelihood(const params_t &params,
+                       const params_t &new_params,
+                       size_t          index) const -> double {
+    (void)index;
+    return log_likelihood(new_params) - log_likelihood(params);
+  }
+
+  /**
+   * True if the model implements `log_likelihood_gradient`.
+   */
+  [[nodiscard]] virtual auto has_gradient() const -> bool { return false; }
+
+  /**
+   * Compute the log likelihood, and its gradient with respect to every
+   * parameter.
+   *
+   * @param[out] gradient Resized to the parameter count.
+   */
+  [[nodiscard]] virtual auto
+  log_likelihood_gradient(const params_t &params, params_t &gradient) const
+      -> double {
+    (void)params;
+    (void)gradient;
+    throw std::runtime_error{"This model does not have a gradient"};
+  }
+
+  /**
+   * True if the model implements `log_likelihood_hessian`.
+   */
+  [[nodiscard]] virtual auto has_hessian() const -> bool { return false; }
+
+  /**
+   * Compute the log likelihood, its gradient, and its Hessian.
+   *
+   * @param[out] gradient Resized to the parameter count.
+   *
+   * @param[out] hessian Resized to a square matrix of the parameter count.
+   */
+  [[nodiscard]] virtual auto
+  log_likelihood_hessian(const params_t &params,
+                         params_t       &gradient,
+                         matrix_t       &hessian) const -> double {
+    (void)params;
+    (void)gradient;
+    (void)hessian;
+    throw std::runtime_error{"This model does not have a Hessian"};
+  }
+
   [[nodiscard]] virtual auto param_count() const -> size_t = 0;
 
+  /**
+   * The number of leading parameters which are restricted to [0, 1], as the
+   * default proposals keep them there. Samplers which move the parameters by
+   * other means must keep them in the same range, so that they sample the same
+   * posterior.
+   */
+  [[nodiscard]] virtual auto bounded_param_count() const -> size_t {
+    return param_count();
+  }
+
   virtual ~likelihood_model_t() = default;
 
   [[nodiscard]] virtual auto
   generate_win_probs(const params_t            &params,
                      const std::vector<size_t> &team_indicies) const
       -> matrix_t = 0;
+
+  /**
+   * Update `win_probs`, the win probabilities of `params`, to those of
+   * `new_params`. Models can override this to only recompute the rows and
+   * columns of the teams whose parameters changed. The default regenerates the
+   * whole matrix.
+   */
+  virtual void update_win_probs(const params_t            &params,
+                                const params_t            &new_params,
+                                const std::vector<size_t> &team_indicies,
+                                matrix_t                  &win_probs) const {
+    (void)params;
+    win_probs = generate_win_probs(new_params, team_indicies);
+  }
 };
 
 /**
@@ -31,6 +112,13 @@ public:
 class simple_likelihood_model_t final : public likelihood_model_t {
 public:
   explicit simple_likelihood_model_t(const std::vector<match_t> &matches);
+
+  /**
+   * A model of `team_count` teams, which may be more than play in `matches`,
+   * as in a bootstrap replicate of the matches.
+   */
+  simple_likelihood_model_t(const std::vector<match_t> &matches,
+                            size_t                      team_count);
   ~simple_likelihood_model_t() override = default;
 
   [[nodiscard]] auto likelihood(const params_t &team_strs) const
@@ -41,24 +129,74 @@ public:
   [[nodiscard]] auto log_likelihood(const params_t &team_win_probs) const
       -> double override;
 
+  /**
+   * Only the pairs involving team `index` are visited.
+   */
+  [[nodiscard]] auto delta_log_likelihood(const params_t &params,
+                                          const params_t &new_params,
+                                          size_t          index) const
+      -> double override;
+
   [[nodiscard]] auto param_count() const -> size_t override {
     return (_param_count * (_param_count + 1)) / 2;
   }
 
+  /**
+   * One minorization-maximization step of the Bradley-Terry likelihood
+   * (Hunter, 2004), which never decreases the likelihood. The strengths are
+   * rescaled so the largest is 0.5, which does not change the likelihood.
+   */
+  [[nodiscard]] auto maximization_step(const params_t &team_strs) const
+      -> params_t;
+
   [[nodiscard]] auto
   generate_win_probs(const params_t            &params,
                      const std::vector<size_t> &team_indicies) const
       -> matrix_t override;
 
+  void update_win_probs(const params_t            &params,
+                        const params_t            &new_params,
+                        const std::vector<size_t> &team_indicies,
+                        matrix_t                  &win_probs) const override;
+
 private:
-  std::vector<std::vector<unsigned int>> _win_matrix;
-  size_t                                 _param_count;
+  /**
+   * A pair of teams which played at least once. The likelihood of the pair is
+   * `p^l_count (1 - p)^r_count`, times the number of orders those outcomes
+   * can come in, where `p = params[l_team] / (params[l_team] +
+   * params[r_team])`.
+   */
+  struct team_pair_t {
+    size_t l_team;
+    size_t r_team;
+    double l_count;
+    double r_count;
+    double log_orders;
+  };
+
+  [[nodiscard]] static auto
+  pair_log_likelihood(const params_t &team_win_probs, const team_pair_t &pair)
+      -> double;
+
+  size_t                   _param_count;
+  std::vector<team_pair_t> _pairs;
+
+  /**
+   * The indices into `_pairs` of the pairs each team is part of.
+   */
+  std::vector<std::vector<size_t>> _team_pairs;
 };
 
 class poisson_likelihood_model_t final : public likelihood_model_t {
 public:
-  explicit poisson_likelihood_model_t(const std::vector<match_t> &matches) :
-      _param_count{count_teams(matches) + 1}, _matches{matches} {}
+  explicit poisson_likelihood_model_t(const std::vector<match_t> &matches);
+
+  /**
+   * A model of `team_count` teams, which may be more than play in `matches`,
+   * as in a bootstrap replicate of the matches.
+   */
+  poisson_likelihood_model_t(const std::vector<match_t> &matches,
+                             size_t                      team_count);
   ~poisson_likelihood_model_t() override = default;
 
   [[nodiscard]] auto likelihood(const params_t &team_strs) const
@@ -69,17 +207,83 @@ public:
   [[nodiscard]] auto log_likelihood(const params_t &team_strs) const
       -> double override;
 
+  /**
+   * Only the matches played by team `index` are visited, unless `index` is the
+   * scale parameter, which every match depends on.
+   */
+  [[nodiscard]] auto delta_log_likelihood(const params_t &params,
+                                          const params_t &new_params,
+                                          size_t          index) const
+      -> double override;
+
+  [[nodiscard]] auto has_gradient() const -> bool override { return true; }
+
+  [[nodiscard]] auto log_likelihood_gradient(const params_t &team_strs,
+                                             params_t       &gradient) const
+      -> double override;
+
+  [[nodiscard]] auto has_hessian() const -> bool override { return true; }
+
+  [[nodiscard]] auto log_likelihood_hessian(const params_t &team_strs,
+                                            params_t       &gradient,
+                                            matrix_t       &hessian) const
+      -> double override;
+
   [[nodiscard]] auto param_count() const -> size_t override {
     return _param_count;
   }
 
+  /**
+   * The team strengths are bounded, the scale parameter is not.
+   */
+  [[nodiscard]] auto bounded_param_count() const -> size_t override {
+    return _param_count - 1;
+  }
+
   [[nodiscard]] auto
   generate_win_probs(const params_t            &params,
                      const std::vector<size_t> &team_indicies) const
       -> matrix_t override;
 
+  /**
+   * The scale parameter does not change the win probabilities, so updates
+   * which only change it leave the matrix as it is.
+   */
+  void update_win_probs(const params_t            &params,
+                        const params_t            &new_params,
+                        const std::vector<size_t> &team_indicies,
+                        matrix_t                  &win_probs) const override;
+
+  /**
+   * Probability that a match between each pair of teams ends in a draw. Used
+   * for group stages, where draws are not broken.
+   */
+  [[nodiscard]] auto
+  generate_draw_probs(const params_t            &params,
+                      const std::vector<size_t> &team_indicies) const
+      -> matrix_t;
+
 private:
-  size_t               _param_count;
-  std::vector<match_t> _matches;
+  /**
+   * The log likelihood of the matches of pair `pair`, without the log
+   * factorial terms, which do not depend on the parameters.
+   */
+  [[nodiscard]] auto pair_log_likelihood(size_t          pair,
+                                         const params_t &team_strs) const
+      -> double;
+
+  size_t          _param_count;
+  poisson_pairs_t _pairs;
+  simd_level_t    _simd_level{detect_simd_level()};
+
+  /**
+   * The sum of log(goals!) over the goals of every match.
+   */
+  double _log_factorial_sum{0.0};
+
+  /**
+   * For each team, the indices of the pairs in `_pairs` it is part of.
+   */
+  std::vector<std::vector<size_t>> _team_pairs;
 };
 #endif
@@ -0,0 +1,185 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+/* Some damping is always kept, so that rounding errors in the gradient along
+ * directions where the likelihood is flat do not become large steps */
+constexpr double initial_damping = 1e-3;
+constexpr double min_damping     = 1e-8;
+constexpr double max_damping     = 1e12;
+
+/**
+ * Solve `a x = b` for a symmetric positive definite `a`, by Cholesky
+ * decomposition. Nothing if `a` is not positive definite.
+ */
+static auto cholesky_solve(const matrix_t &a, const params_t &b)
+    -> std::optional<params_t> {
+  size_t   n = a.size();
+  matrix_t l(n, params_t(n, 0.0));
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      double sum = a[i][j];
+      for (size_t k = 0; k < j; ++k) { sum -= l[i][k] * l[j][k]; }
+      if (i == j) {
+        if (!(sum > 0.0)) { return {}; }
+        l[i][i] = std::sqrt(sum);
+      } else {
+        l[i][j] = sum / l[j][j];
+      }
+    }
+  }
+
+  params_t x{b};
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t k = 0; k < i; ++k) { x[i] -= l[i][k] * x[k]; }
+    x[i] /= l[i][i];
+  }
+  for (size_t i = n; i-- > 0;) {
+    for (size_t k = i + 1; k < n; ++k) { x[i] -= l[k][i] * x[k]; }
+    x[i] /= l[i][i];
+  }
+  return x;
+}
+
+auto log_posterior_hessian(const likelihood_model_t &model,
+                           const log_prior_t        &prior,
+                           const params_t           &params,
+                           params_t                 &gradient,
+                           matrix_t                 &hessian) -> double {
+  double lp = model.log_likelihood_hessian(params, gradient, hessian);
+  lp       += prior(params);
+  prior.add_gradient(params, gradient);
+  for (size_t i = 0; i < params.size(); ++i) {
+    double h = 1e-5 * (1.0 + std::abs(params[i]));
+    hessian[i][i] += (prior.log_density_term_derivative(params[i] + h) -
+                      prior.log_density_term_derivative(params[i] - h)) /
+                     (2 * h);
+  }
+  return lp;
+}
+
+/**
+ * Move the first `bounded` parameters into [0, 1].
+ */
+static void clamp_to_bounds(params_t &params, size_t bounded) {
+  for (size_t i = 0; i < bounded; ++i) {
+    params[i] = std::clamp(params[i], 0.0, 1.0);
+  }
+}
+
+/**
+ * Whether parameter `i` is held at one of its bounds, because the gradient
+ * points out of [0, 1] there.
+ */
+static auto held_at_bound(const params_t &params,
+                          const params_t &gradient,
+                          size_t          i,
+                          size_t          bounded) -> bool {
+  return i < bounded && ((params[i] <= 0.0 && gradient[i] < 0.0) ||
+                         (params[i] >= 1.0 && gradient[i] > 0.0));
+}
+
+auto newton_maximize(const likelihood_model_t  &model,
+                     const log_prior_t         &prior,
+                     params_t                   params,
+                     const optimizer_options_t &options) -> optimum_t {
+  if (!model.has_hessian()) {
+    throw std::runtime_error{"Newton's method needs a model with a Hessian"};
+  }
+
+  size_t bounded = model.bounded_param_count();
+  clamp_to_bounds(params, bounded);
+
+  params_t gradient;
+  matrix_t hessian;
+  double   lp = log_posterior_hessian(model, prior, params, gradient, hessian);
+  double   damping = initial_damping;
+
+  std::vector<bool> held(params.size());
+  size_t            iter = 0;
+  for (; iter < options.max_iters; ++iter) {
+    double largest_gradient = 0.0;
+    for (size_t i = 0; i < params.size(); ++i) {
+      held[i] = held_at_bound(params, gradient, i, bounded);
+      if (!held[i]) {
+        largest_gradient = std::max(largest_gradient, std::abs(gradient[i]));
+      }
+    }
+    if (largest_gradient < options.tolerance) {
+      return {params, lp, iter, true};
+    }
+
+    bool accepted = false;
+    while (!accepted && damping < max_damping) {
+      /* Parameters held at a bound are left out of the step, and the rest
+       * are moved by Newton's method, then clamped back into the box */
+      matrix_t a{hessian};
+      params_t b{gradient};
+      for (size_t i = 0; i < a.size(); ++i) {
+        for (size_t j = 0; j < a.size(); ++j) {
+          a[i][j] = held[i] || held[j] ? 0.0 : -a[i][j];
+        }
+        a[i][i] += held[i] ? 1.0 : damping;
+        if (held[i]) { b[i] = 0.0; }
+      }
+      auto solution = cholesky_solve(a, b);
+      if (!solution.has_value()) {
+        damping *= 10;
+        continue;
+      }
+      const auto &step = solution.value();
+
+      params_t trial{params};
+      for (size_t i = 0; i < trial.size(); ++i) { trial[i] += step[i]; }
+      clamp_to_bounds(trial, bounded);
+      double trial_lp = model.log_likelihood(trial) + prior(trial);
+      if (std::isfinite(trial_lp) && trial_lp >= lp && trial != params) {
+        params   = std::move(trial);
+        damping  = std::max(damping / 10, min_damping);
+        accepted = true;
+      } else {
+        damping *= 10;
+      }
+    }
+    if (!accepted) { break; }
+
+    lp = log_posterior_hessian(model, prior, params, gradient, hessian);
+  }
+  return {params, lp, iter, false};
+}
+
+auto bradley_terry_maximize(const simple_likelihood_model_t &model,
+                            params_t                         params,
+                            const optimizer_options_t       &options)
+    -> optimum_t {
+  for (size_t iter = 0; iter < options.max_iters; ++iter) {
+    auto   next         = model.maximization_step(params);
+    double largest_step = 0.0;
+    for (size_t i = 0; i < next.size(); ++i) {
+      largest_step = std::max(largest_step, std::abs(next[i] - params[i]));
+    }
+    params = std::move(next);
+    if (largest_step < options.tolerance) {
+      return {params, model.log_likelihood(params), iter + 1, true};
+    }
+  }
+  return {params, model.log_likelihood(params), options.max_iters, false};
+}
+
+auto find_mode(const likelihood_model_t  &model,
+               const log_prior_t         &prior,
+               params_t                   start,
+               const optimizer_options_t &options) -> optimum_t {
+  if (model.has_hessian()) {
+    return newton_maximize(model, prior, std::move(start), options);
+  }
+  if (const auto *simple =
+          dynamic_cast<const simple_likelihood_model_t *>(&model)) {
+    return bradley_terry_maximize(*simple, std::move(start), options);
+  }
+  throw std::runtime_error{"This model can not be optimized"};
+}
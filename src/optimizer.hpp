@@ -0,0 +1,72 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include "model.hpp"
+#include "util.hpp"
+#include <cstddef>
+
+struct optimizer_options_t {
+  size_t max_iters = 1000;
+
+  /* Newton's method has converged once every component of the gradient is
+   * below this, other than those pushing against a bound, and the
+   * Bradley-Terry iteration once no strength moves by more than this */
+  double tolerance = 1e-8;
+};
+
+struct optimum_t {
+  params_t params;
+  double   log_posterior;
+  size_t   iterations;
+  bool     converged;
+};
+
+/**
+ * The log posterior of a model with a Hessian, along with its gradient and
+ * Hessian.
+ */
+auto log_posterior_hessian(const likelihood_model_t &model,
+                           const log_prior_t        &prior,
+                           const params_t           &params,
+                           params_t                 &gradient,
+                           matrix_t                 &hessian) -> double;
+
+/**
+ * Maximise the log posterior of a model with a Hessian, using Newton's method
+ * damped in the style of Levenberg-Marquardt. The damping keeps the steps
+ * well defined when the likelihood is flat in some direction, as the Poisson
+ * likelihood is when every strength is shifted by the same amount, and
+ * parameters in such directions are left where they start.
+ *
+ * The maximum is over the same region the samplers explore: the bounded
+ * parameters of the model (`bounded_param_count`) stay in [0, 1]. Steps are
+ * clamped into the box, and parameters that the gradient pushes against a
+ * bound are held there, so the optimum is the mode of the posterior that the
+ * chains sample.
+ *
+ * The curvature of the prior is found by differencing its derivative.
+ */
+auto newton_maximize(const likelihood_model_t  &model,
+                     const log_prior_t         &prior,
+                     params_t                   params,
+                     const optimizer_options_t &options = {}) -> optimum_t;
+
+/**
+ * Maximise the likelihood of the simple model, with the minorization-
+ * maximization algorithm for Bradley-Terry models. The prior is ignored.
+ */
+auto bradley_terry_maximize(const simple_likelihood_model_t &model,
+                            params_t                         params,
+                            const optimizer_options_t &options = {})
+    -> optimum_t;
+
+/**
+ * Find the maximum a posteriori parameters of `model` with whichever of the
+ * methods above suits it.
+ */
+auto find_mode(const likelihood_model_t  &model,
+               const log_prior_t         &prior,
+               params_t                   start,
+               const optimizer_options_t &options = {}) -> optimum_t;
+
+#endif
@@ -0,0 +1,248 @@
+#include "poisson_kernel.hpp"
+
+#include <cmath>
+#include <iterator>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PHYLOURNY_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static auto pair_term(const poisson_pairs_t &pairs,
+                      const double          *team_strs,
+                      double                 scale_param,
+                      size_t                 i) -> double {
+  double d            = team_strs[pairs.l_team[i]] - team_strs[pairs.r_team[i]];
+  double log_lambda_l = d + scale_param;
+  double log_lambda_r = scale_param - d;
+  return log_lambda_l * pairs.l_goals[i] + log_lambda_r * pairs.r_goals[i] -
+         pairs.matches[i] * (std::exp(log_lambda_l) + std::exp(log_lambda_r));
+}
+
+static auto scalar_log_likelihood(const poisson_pairs_t &pairs,
+                                  const double          *team_strs,
+                                  double                 scale_param,
+                                  size_t                 begin,
+                                  size_t                 end) -> double {
+  double llh = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    llh += pair_term(pairs, team_strs, scale_param, i);
+  }
+  return llh;
+}
+
+#ifdef PHYLOURNY_X86_KERNELS
+
+/* Without optimization, GCC implements some AVX-512 intrinsics as macros,
+ * which convert their masks to char. With optimization, GCC 12 reports the
+ * `_mm*_undefined_*` sources that the headers pass to gathers and rounding as
+ * uninitialized */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#ifndef __clang__
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+/* The vector exp works by writing x = n log(2) + r, with |r| <= log(2) / 2,
+ * so that exp(x) = 2^n exp(r). exp(r) is a Taylor polynomial, which is
+ * accurate to well under an ulp on that interval, and 2^n is built directly
+ * from its exponent bits. Inputs outside of [exp_min, exp_max], where 2^n is
+ * not a normal double, are left to std::exp */
+constexpr double exp_min     = -708.0;
+constexpr double exp_max     = 709.0;
+constexpr double log2e       = 1.4426950408889634;
+constexpr double ln2_hi      = 6.93147180369123816490e-01;
+constexpr double ln2_lo      = 1.90821492927058770002e-10;
+constexpr double exp_shifter = 4503599627370496.0 + 1023.0;
+
+constexpr double exp_coefficients[] = {
+    1.0 / 6227020800.0, /* 1/13! */
+    1.0 / 479001600.0,
+    1.0 / 39916800.0,
+    1.0 / 3628800.0,
+    1.0 / 362880.0,
+    1.0 / 40320.0,
+    1.0 / 5040.0,
+    1.0 / 720.0,
+    1.0 / 120.0,
+    1.0 / 24.0,
+    1.0 / 6.0,
+    1.0 / 2.0,
+    1.0,
+    1.0,
+};
+
+__attribute__((target("avx2,fma"))) static auto exp4(__m256d x) -> __m256d {
+  __m256d in_range = _mm256_and_pd(
+      _mm256_cmp_pd(x, _mm256_set1_pd(exp_min), _CMP_GE_OQ),
+      _mm256_cmp_pd(x, _mm256_set1_pd(exp_max), _CMP_LE_OQ));
+
+  __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(log2e)),
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(ln2_hi), x);
+  r         = _mm256_fnmadd_pd(n, _mm256_set1_pd(ln2_lo), r);
+
+  __m256d p = _mm256_set1_pd(exp_coefficients[0]);
+  for (size_t k = 1; k < std::size(exp_coefficients); ++k) {
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_coefficients[k]));
+  }
+
+  __m256i bits = _mm256_slli_epi64(
+      _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(exp_shifter))), 52);
+  __m256d result = _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+
+  if (_mm256_movemask_pd(in_range) != 0xF) {
+    alignas(32) double xs[4];
+    alignas(32) double rs[4];
+    _mm256_store_pd(xs, x);
+    _mm256_store_pd(rs, result);
+    for (size_t k = 0; k < 4; ++k) {
+      if (!(xs[k] >= exp_min && xs[k] <= exp_max)) { rs[k] = std::exp(xs[k]); }
+    }
+    result = _mm256_load_pd(rs);
+  }
+  return result;
+}
+
+__attribute__((target("avx2,fma"))) static auto
+avx2_log_likelihood(const poisson_pairs_t &pairs,
+                    const double          *team_strs,
+                    double                 scale_param,
+                    size_t                 begin,
+                    size_t                 end) -> double {
+  __m256d scale = _mm256_set1_pd(scale_param);
+  __m256d acc   = _mm256_setzero_pd();
+
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128i l_team = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(pairs.l_team.data() + i));
+    __m128i r_team = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(pairs.r_team.data() + i));
+    __m256d d = _mm256_sub_pd(_mm256_i32gather_pd(team_strs, l_team, 8),
+                              _mm256_i32gather_pd(team_strs, r_team, 8));
+    __m256d log_lambda_l = _mm256_add_pd(d, scale);
+    __m256d log_lambda_r = _mm256_sub_pd(scale, d);
+
+    __m256d term = _mm256_mul_pd(log_lambda_r,
+                                 _mm256_loadu_pd(pairs.r_goals.data() + i));
+    term         = _mm256_fmadd_pd(
+        log_lambda_l, _mm256_loadu_pd(pairs.l_goals.data() + i), term);
+    __m256d rates = _mm256_add_pd(exp4(log_lambda_l), exp4(log_lambda_r));
+    term          = _mm256_fnmadd_pd(
+        _mm256_loadu_pd(pairs.matches.data() + i), rates, term);
+    acc = _mm256_add_pd(acc, term);
+  }
+
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         scalar_log_likelihood(pairs, team_strs, scale_param, i, end);
+}
+
+__attribute__((target("avx512f"))) static auto exp8(__m512d x) -> __m512d {
+  __mmask8 in_range =
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(exp_min), _CMP_GE_OQ) &
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(exp_max), _CMP_LE_OQ);
+
+  __m512d n = _mm512_roundscale_pd(
+      _mm512_mul_pd(x, _mm512_set1_pd(log2e)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(ln2_hi), x);
+  r         = _mm512_fnmadd_pd(n, _mm512_set1_pd(ln2_lo), r);
+
+  __m512d p = _mm512_set1_pd(exp_coefficients[0]);
+  for (size_t k = 1; k < std::size(exp_coefficients); ++k) {
+    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_coefficients[k]));
+  }
+
+  __m512i bits = _mm512_slli_epi64(
+      _mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(exp_shifter))), 52);
+  __m512d result = _mm512_mul_pd(p, _mm512_castsi512_pd(bits));
+
+  if (in_range != 0xFF) {
+    alignas(64) double xs[8];
+    alignas(64) double rs[8];
+    _mm512_store_pd(xs, x);
+    _mm512_store_pd(rs, result);
+    for (size_t k = 0; k < 8; ++k) {
+      if (!(xs[k] >= exp_min && xs[k] <= exp_max)) { rs[k] = std::exp(xs[k]); }
+    }
+    result = _mm512_load_pd(rs);
+  }
+  return result;
+}
+
+__attribute__((target("avx512f"))) static auto
+avx512_log_likelihood(const poisson_pairs_t &pairs,
+                      const double          *team_strs,
+                      double                 scale_param,
+                      size_t                 begin,
+                      size_t                 end) -> double {
+  __m512d scale = _mm512_set1_pd(scale_param);
+  __m512d acc   = _mm512_setzero_pd();
+
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256i l_team = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(pairs.l_team.data() + i));
+    __m256i r_team = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(pairs.r_team.data() + i));
+    __m512d d = _mm512_sub_pd(_mm512_i32gather_pd(l_team, team_strs, 8),
+                              _mm512_i32gather_pd(r_team, team_strs, 8));
+    __m512d log_lambda_l = _mm512_add_pd(d, scale);
+    __m512d log_lambda_r = _mm512_sub_pd(scale, d);
+
+    __m512d term = _mm512_mul_pd(log_lambda_r,
+                                 _mm512_loadu_pd(pairs.r_goals.data() + i));
+    term         = _mm512_fmadd_pd(
+        log_lambda_l, _mm512_loadu_pd(pairs.l_goals.data() + i), term);
+    __m512d rates = _mm512_add_pd(exp8(log_lambda_l), exp8(log_lambda_r));
+    term          = _mm512_fnmadd_pd(
+        _mm512_loadu_pd(pairs.matches.data() + i), rates, term);
+    acc = _mm512_add_pd(acc, term);
+  }
+
+  alignas(64) double lanes[8];
+  _mm512_store_pd(lanes, acc);
+  double llh = 0.0;
+  for (double lane : lanes) { llh += lane; }
+  return llh + scalar_log_likelihood(pairs, team_strs, scale_param, i, end);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+auto detect_simd_level() -> simd_level_t {
+#ifdef PHYLOURNY_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) { return simd_level_t::avx512; }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return simd_level_t::avx2;
+  }
+#endif
+  return simd_level_t::scalar;
+}
+
+auto poisson_pairs_log_likelihood(const poisson_pairs_t &pairs,
+                                  const params_t        &team_strs,
+                                  size_t                 begin,
+                                  size_t                 end,
+                                  simd_level_t           level) -> double {
+  double scale_param = team_strs.back();
+  switch (level) {
+#ifdef PHYLOURNY_X86_KERNELS
+  case simd_level_t::avx512:
+    return avx512_log_likelihood(
+        pairs, team_strs.data(), scale_param, begin, end);
+  case simd_level_t::avx2:
+    return avx2_log_likelihood(
+        pairs, team_strs.data(), scale_param, begin, end);
+#endif
+  default:
+    return scalar_log_likelihood(
+        pairs, team_strs.data(), scale_param, begin, end);
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef POISSON_KERNEL_HPP
+#define POISSON_KERNEL_HPP
+
+#include "util.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The matches of the Poisson model, reduced to one entry per pair of teams and
+ * stored by column, so that the log likelihood can be evaluated for several
+ * pairs at a time.
+ *
+ * Matches between the pair with the teams the other way round are included
+ * with their goals swapped.
+ */
+struct poisson_pairs_t {
+  std::vector<int32_t> l_team;
+  std::vector<int32_t> r_team;
+  std::vector<double>  matches;
+  std::vector<double>  l_goals;
+  std::vector<double>  r_goals;
+
+  [[nodiscard]] auto size() const -> size_t { return l_team.size(); }
+};
+
+enum struct simd_level_t {
+  scalar,
+  avx2,
+  avx512,
+};
+
+/**
+ * The widest instruction set that both this build and the CPU running it
+ * support.
+ */
+auto detect_simd_level() -> simd_level_t;
+
+/**
+ * Sum of the log likelihoods of pairs `begin` to `end`, without the log
+ * factorial terms. The last parameter is the scale.
+ *
+ * Every team index of `pairs` must be a valid index into `team_strs`, as this
+ * is not checked.
+ */
+auto poisson_pairs_log_likelihood(const poisson_pairs_t &pairs,
+                                  const params_t        &team_strs,
+                                  size_t                 begin,
+                                  size_t                 end,
+                                  simd_level_t           level) -> double;
+
+#endif
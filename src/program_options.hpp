@@ -13,6 +13,8 @@ struct input_format_options_t {
   std::optional<std::string> probs_filename;
   std::optional<std::string> matches_filename;
   std::optional<std::string> bestofs_filename;
+  std::optional<std::string> samples_filename;
+  std::optional<std::string> groups_filename;
   bool                       dummy;
 };
 
@@ -45,11 +47,39 @@ struct mcmc_options_t {
   bool             sample_matrix;
   likelihood_model model_type;
   bool             node_probabilites;
+  size_t           chains;
+  size_t           temperatures;
+  double           max_temperature;
+  bool             hmc;
+  size_t           leapfrog_steps;
+  bool             adapt;
+  double           target_acceptance;
+  bool             adaptive_covariance;
+  size_t           evaluation_threads;
+  size_t           checkpoint_interval;
+  bool             resume;
+
+  bool                  diagnostics;
+  size_t                diagnostics_interval;
+  std::optional<double> target_ess;
+  std::optional<double> target_mcse;
+
+  bool   optimize;
+  bool   warm_start;
+  bool   laplace;
+  size_t bootstrap;
+};
+
+struct pool_options_t {
+  std::vector<double>        round_points;
+  std::optional<std::string> bracket_filename;
 };
 
 struct program_options_t {
   std::string              output_prefix;
   std::vector<std::string> teams;
+  bool                     meeting_probs;
+  std::optional<double>    prune_epsilon;
 
   size_t seed;
 
@@ -58,6 +88,7 @@ struct program_options_t {
 
   simulation_mode_options_t simulation_options;
   mcmc_options_t            mcmc_options;
+  pool_options_t            pool_options;
 };
 
 void run(const program_options_t &);
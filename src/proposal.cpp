@@ -0,0 +1,206 @@
+#include "proposal.hpp"
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+/* Bounds on the per-parameter scales, to keep a run of rejections (or
+ * acceptances) from driving a scale to a degenerate value. */
+constexpr double min_scale = 1e-4;
+constexpr double max_scale = 1e2;
+
+/* Adaptation gain decays as n^-0.6, which satisfies the diminishing
+ * adaptation conditions. */
+constexpr double adaptation_decay = 0.6;
+
+constexpr double block_target_accept      = 0.234;
+constexpr double covariance_regularizer   = 1e-6;
+constexpr size_t cholesky_update_interval = 100;
+
+adaptive_proposal_t::adaptive_proposal_t(size_t param_count,
+                                         size_t bounded_count,
+                                         double target_accept,
+                                         bool   learn_covariance,
+                                         double initial_scale) :
+    _scales(param_count, initial_scale),
+    _trials(param_count, 0),
+    _target_accept{target_accept},
+    _bounded_count{bounded_count},
+    _learn_covariance{learn_covariance} {
+  if (param_count == 0) {
+    throw std::runtime_error{"Adaptive proposal needs at least one parameter"};
+  }
+  if (!(target_accept > 0.0 && target_accept < 1.0)) {
+    throw std::runtime_error{"Target acceptance rate should be in (0, 1)"};
+  }
+  if (bounded_count > param_count) {
+    throw std::runtime_error{"More bounded parameters than parameters"};
+  }
+  if (learn_covariance) {
+    _mean.resize(param_count, 0.0);
+    _covariance.resize(param_count, vector_t(param_count, 0.0));
+  }
+}
+
+static auto reflect_unit_interval(double x) -> double {
+  while (x < 0.0 || x > 1.0) { x = x < 0.0 ? -x : 2.0 - x; }
+  return x;
+}
+
+auto adaptive_proposal_t::operator()(const params_t  &params,
+                                     random_engine_t &gen)
+    -> std::pair<params_t, double> {
+  params_t temp_params{params};
+  auto     move = propose(params, temp_params, gen);
+  return {temp_params, std::exp(move.log_hastings)};
+}
+
+auto adaptive_proposal_t::propose(const params_t  &params,
+                                  params_t        &proposed,
+                                  random_engine_t &gen) -> proposal_move_t {
+  _normal.reset();
+
+  if (covariance_ready() &&
+      std::uniform_real_distribution<double>(0.0, 1.0)(gen) < 0.5) {
+    for (auto &f : _block_draws) { f = _normal(gen); }
+    double scale = std::sqrt(_block_scale);
+    for (size_t i = 0; i < params.size(); ++i) {
+      double step = 0.0;
+      for (size_t j = 0; j <= i; ++j) {
+        step += _cholesky[i][j] * _block_draws[j];
+      }
+      proposed[i] += scale * step;
+    }
+    for (size_t i = 0; i < _bounded_count; ++i) {
+      if (proposed[i] < 0.0 || proposed[i] > 1.0) {
+        return {{}, -std::numeric_limits<double>::infinity()};
+      }
+    }
+    return {{}, 0.0};
+  }
+
+  std::uniform_int_distribution<size_t> picker(0, params.size() - 1);
+  size_t                                index = picker(gen);
+  proposed[index] += _scales[index] * _normal(gen);
+  if (index < _bounded_count) {
+    proposed[index] = reflect_unit_interval(proposed[index]);
+  }
+  return {index, 0.0};
+}
+
+void adaptive_proposal_t::adapt(const params_t              &params,
+                                const std::optional<size_t> &changed,
+                                bool                         accepted) {
+  if (_frozen) { return; }
+
+  double outcome = accepted ? 1.0 : 0.0;
+  if (changed.has_value()) {
+    size_t index     = changed.value();
+    _trials[index]  += 1;
+    double gain      = std::pow(static_cast<double>(_trials[index]),
+                           -adaptation_decay);
+    double log_scale = std::log(_scales[index]) +
+                       gain * (outcome - _target_accept);
+    _scales[index] = std::clamp(
+        std::exp(log_scale),
+        min_scale,
+        index < _bounded_count ? 1.0 : max_scale);
+  } else if (covariance_ready()) {
+    _block_trials += 1;
+    double gain =
+        std::pow(static_cast<double>(_block_trials), -adaptation_decay);
+    _block_scale *= std::exp(gain * (outcome - block_target_accept));
+    _block_scale  = std::clamp(_block_scale, min_scale, max_scale);
+  }
+
+  if (_learn_covariance) { update_covariance(params); }
+}
+
+/**
+ * Welford style running update of the mean and covariance of the chain states.
+ * The Cholesky factor of the proposal covariance is refreshed periodically,
+ * once there are at least twice as many states as parameters.
+ */
+void adaptive_proposal_t::update_covariance(const params_t &params) {
+  _states_seen += 1;
+  auto     n = static_cast<double>(_states_seen);
+  vector_t delta(params.size());
+  for (size_t i = 0; i < params.size(); ++i) {
+    delta[i]  = params[i] - _mean[i];
+    _mean[i] += delta[i] / n;
+  }
+  for (size_t i = 0; i < params.size(); ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      _covariance[i][j] += delta[i] * (params[j] - _mean[j]);
+    }
+  }
+
+  size_t min_states = std::max(2 * params.size(), cholesky_update_interval);
+  if (_states_seen >= min_states &&
+      _states_seen % cholesky_update_interval == 0) {
+    update_cholesky();
+  }
+}
+
+void adaptive_proposal_t::update_cholesky() {
+  size_t   d            = _mean.size();
+  double   optimal_size = 2.38 * 2.38 / static_cast<double>(d);
+  auto     n            = static_cast<double>(_states_seen - 1);
+  matrix_t l(d, vector_t(d, 0.0));
+
+  for (size_t i = 0; i < d; ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      double sum = optimal_size * _covariance[i][j] / n;
+      if (i == j) { sum += covariance_regularizer; }
+      for (size_t k = 0; k < j; ++k) { sum -= l[i][k] * l[j][k]; }
+      if (i == j) {
+        /* Not positive definite, keep the previous factor */
+        if (!(sum > 0.0)) { return; }
+        l[i][i] = std::sqrt(sum);
+      } else {
+        l[i][j] = sum / l[j][j];
+      }
+    }
+  }
+  _cholesky = std::move(l);
+  _block_draws.resize(d);
+}
+
+auto adaptive_proposal_t::save() const -> std::string {
+  std::ostringstream os;
+  write_binary_vector(os, _scales);
+  write_binary_vector(os, _trials);
+  write_binary_value(os, _frozen);
+  write_binary_vector(os, _mean);
+  write_binary_value<uint64_t>(os, _covariance.size());
+  for (const auto &row : _covariance) { write_binary_vector(os, row); }
+  write_binary_value<uint64_t>(os, _cholesky.size());
+  for (const auto &row : _cholesky) { write_binary_vector(os, row); }
+  write_binary_value(os, _states_seen);
+  write_binary_value(os, _block_scale);
+  write_binary_value(os, _block_trials);
+  return os.str();
+}
+
+void adaptive_proposal_t::restore(const std::string &state) {
+  std::istringstream is(state);
+  auto               scales = read_binary_vector<double>(is);
+  if (scales.size() != _scales.size()) {
+    throw std::runtime_error{"Proposal state has the wrong parameter count"};
+  }
+  _scales = std::move(scales);
+  _trials = read_binary_vector<size_t>(is);
+  _frozen = read_binary_value<bool>(is);
+  _mean   = read_binary_vector<double>(is);
+  _covariance.resize(read_binary_value<uint64_t>(is));
+  for (auto &row : _covariance) { row = read_binary_vector<double>(is); }
+  _cholesky.resize(read_binary_value<uint64_t>(is));
+  for (auto &row : _cholesky) { row = read_binary_vector<double>(is); }
+  _block_draws.resize(_cholesky.size());
+  _states_seen  = read_binary_value<size_t>(is);
+  _block_scale  = read_binary_value<double>(is);
+  _block_trials = read_binary_value<size_t>(is);
+}
@@ -0,0 +1,114 @@
+#ifndef PROPOSAL_HPP
+#define PROPOSAL_HPP
+
+#include "util.hpp"
+#include <cstddef>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A random walk proposal which tunes itself during burnin.
+ *
+ * Each proposal moves a single parameter by a normal step with a per-parameter
+ * scale. While adapting, the scale of the moved parameter is nudged after
+ * every step (Robbins-Monro on the log scale) so that its acceptance rate
+ * approaches `target_accept`.
+ *
+ * Optionally, the covariance of the chain states is also learned, in the
+ * style of the adaptive Metropolis algorithm of Haario et al. Once enough
+ * states have been seen, half of the proposals are block moves of every
+ * parameter, drawn from a normal with the learned covariance scaled by
+ * `2.38^2 / d`. The block scale is tuned towards an acceptance rate of 0.234.
+ *
+ * Once `freeze` is called, the proposal no longer changes, so that the samples
+ * after burnin come from a proper Markov chain.
+ */
+class adaptive_proposal_t {
+public:
+  /**
+   * @param bounded_count The number of leading parameters which are
+   * restricted to [0, 1]. Single parameter moves are reflected back into the
+   * interval. Block moves which leave it are given a Hastings ratio of 0, so
+   * they are rejected.
+   */
+  adaptive_proposal_t(size_t param_count,
+                      size_t bounded_count,
+                      double target_accept,
+                      bool   learn_covariance,
+                      double initial_scale = 0.1);
+
+  /**
+   * Propose a new set of parameters. The proposal is symmetric, so the
+   * Hastings ratio is 1, unless a block move left the bounds.
+   */
+  auto operator()(const params_t &params, random_engine_t &gen)
+      -> std::pair<params_t, double>;
+
+  /**
+   * Propose in place, for `metropolis_kernel_t`. Draws the same random numbers
+   * as `operator()`, but does not allocate once adaptation is over.
+   */
+  auto propose(const params_t  &params,
+               params_t        &proposed,
+               random_engine_t &gen) -> proposal_move_t;
+
+  /**
+   * Adapt to the outcome of the last proposal.
+   *
+   * @param params The state of the chain after the accept/reject step.
+   *
+   * @param changed The index of the parameter that was moved, or nothing for
+   * a block move.
+   */
+  void adapt(const params_t              &params,
+             const std::optional<size_t> &changed,
+             bool                         accepted);
+
+  void freeze() { _frozen = true; }
+
+  /**
+   * Serialize the adapted state, for checkpoints.
+   */
+  [[nodiscard]] auto save() const -> std::string;
+
+  /**
+   * Restore a state produced by `save`, of a proposal with the same settings.
+   */
+  void restore(const std::string &state);
+
+  [[nodiscard]] auto frozen() const -> bool { return _frozen; }
+
+  [[nodiscard]] auto scales() const -> const params_t & { return _scales; }
+
+  [[nodiscard]] auto block_scale() const -> double { return _block_scale; }
+
+  [[nodiscard]] auto covariance_ready() const -> bool {
+    return !_cholesky.empty();
+  }
+
+private:
+  void update_covariance(const params_t &params);
+  void update_cholesky();
+
+  params_t            _scales;
+  std::vector<size_t> _trials;
+  double              _target_accept;
+  size_t              _bounded_count;
+  bool                _learn_covariance;
+  bool                _frozen{false};
+
+  params_t _mean;
+  matrix_t _covariance;
+  matrix_t _cholesky;
+  size_t   _states_seen{0};
+  double   _block_scale{1.0};
+  size_t   _block_trials{0};
+
+  std::normal_distribution<double> _normal{0.0, 1.0};
+  vector_t                         _block_draws;
+};
+
+#endif
@@ -1,7 +1,10 @@
 #include "results.hpp"
 
+#include "debug.h"
+#include <cstring>
 #include <fstream>
 #include <iterator>
+#include <stdexcept>
 #include <string>
 
 auto operator<<(std::ostream &os, const result_t &r) -> std::ostream & {
@@ -31,15 +34,33 @@ inline std::string make_csv_row(Iterator begin, Iterator end) {
          "\n";
 }
 
-results_t &results_t::add_file_output(const std::filesystem::path &prefix) {
-  _params_outfile = std::ofstream(params_filename(prefix));
-  auto tmp        = _all_teams;
+static auto open_output(const std::filesystem::path &path,
+                        bool                         append,
+                        std::ios::openmode           mode = std::ios::out)
+    -> std::ofstream {
+  return std::ofstream(path, mode | (append ? std::ios::app : std::ios::trunc));
+}
+
+results_t &results_t::add_file_output(const std::filesystem::path &prefix,
+                                      bool                         append) {
+  _params_outfile = open_output(params_filename(prefix), append);
+  _probs_outfile  = open_output(probs_filename(prefix), append);
+  _params_binary_outfile = open_output(
+      params_binary_filename(prefix), append, std::ios::out | std::ios::binary);
+  _params_binary_header = append;
+  _output_paths.push_back(params_filename(prefix));
+  _output_paths.push_back(probs_filename(prefix));
+  _output_paths.push_back(params_binary_filename(prefix));
+  if (append) { return *this; }
+
+  auto tmp = _all_teams;
   tmp.push_back("llh");
+  if (_tag_chains) { tmp.push_back("chain"); }
   *_params_outfile << make_csv_row(tmp.begin(), tmp.end());
 
-  _probs_outfile = std::ofstream(probs_filename(prefix));
-  tmp            = _bracket_teams;
+  tmp = _bracket_teams;
   tmp.push_back("llh");
+  if (_tag_chains) { tmp.push_back("chain"); }
   *_probs_outfile << make_csv_row(tmp.begin(), tmp.end());
 
   return *this;
@@ -50,17 +71,36 @@ results_t &results_t::enable_memory_save() {
   return *this;
 }
 
-results_t &results_t::add_node_probs_output(const std::filesystem::path &prefix) {
-  _node_probs_outfile = std::ofstream(node_probs_filename(prefix));
+results_t &results_t::enable_chain_tagging() {
+  _tag_chains = true;
+  return *this;
+}
+
+results_t &
+results_t::add_node_probs_output(const std::filesystem::path &prefix,
+                                 bool                         append) {
+  _node_probs_outfile = open_output(node_probs_filename(prefix), append);
+  _output_paths.push_back(node_probs_filename(prefix));
+  if (append) { return *this; }
 
   std::vector<std::string> tmp{"node"};
   for (const auto &n : _bracket_teams) { tmp.push_back(n); }
   tmp.push_back("llh");
+  if (_tag_chains) { tmp.push_back("chain"); }
   *_node_probs_outfile << make_csv_row(tmp.begin(), tmp.end());
 
   return *this;
 }
 
+results_t &results_t::enable_diagnostics(stopping_rule_t rule,
+                                         size_t          report_interval) {
+  auto names = _bracket_teams;
+  names.emplace_back("llh");
+  _monitor.emplace(std::move(names), rule);
+  _report_interval = report_interval;
+  return *this;
+}
+
 template <typename T>
 std::vector<std::string>
 make_temporary_vector(const std::vector<T>      vals,
@@ -75,11 +115,13 @@ make_temporary_vector(const std::vector<T>      vals,
 
 void results_t::write_params_line(const result_t &r) {
   auto tmp = make_temporary_vector(r.params, _all_team_index_map, r.llh);
+  if (_tag_chains) { tmp.push_back(std::to_string(r.chain)); }
   *_params_outfile << make_csv_row(tmp.begin(), tmp.end());
 }
 
 void results_t::write_probs_line(const result_t &r) {
   auto tmp = make_temporary_vector(r.win_prob, _bracket_team_index_map, r.llh);
+  if (_tag_chains) { tmp.push_back(std::to_string(r.chain)); }
   *_probs_outfile << make_csv_row(tmp.begin(), tmp.end());
 }
 
@@ -89,23 +131,135 @@ void results_t::write_node_probs_line(const result_t &r) {
     tmp.push_back(kv.first);
     for (auto f : kv.second) { tmp.push_back(std::to_string(f)); }
     tmp.push_back(std::to_string(r.llh));
+    if (_tag_chains) { tmp.push_back(std::to_string(r.chain)); }
 
     *_node_probs_outfile << make_csv_row(tmp.begin(), tmp.end());
   }
 }
 
+void results_t::write_params_record(const result_t &r) {
+  auto &os = *_params_binary_outfile;
+  if (!_params_binary_header) {
+    os.write(sample_reader_t::magic, sizeof(sample_reader_t::magic) - 1);
+    uint64_t param_count = r.params.size();
+    os.write(reinterpret_cast<const char *>(&param_count),
+             sizeof(param_count));
+    _params_binary_header = true;
+  }
+  uint64_t chain = r.chain;
+  os.write(reinterpret_cast<const char *>(&r.llh), sizeof(r.llh));
+  os.write(reinterpret_cast<const char *>(&chain), sizeof(chain));
+  os.write(reinterpret_cast<const char *>(r.params.data()),
+           static_cast<std::streamsize>(r.params.size() * sizeof(double)));
+}
+
 void results_t::write_result_to_outfiles(const result_t &r) {
   write_params_line(r);
   write_probs_line(r);
+  if (_params_binary_outfile.has_value()) { write_params_record(r); }
   if (_node_probs_outfile.has_value()) { write_node_probs_line(r); }
 }
 
+/**
+ * Checking the stopping rule is cheap, but not free, so it is only checked
+ * every so many samples.
+ */
+constexpr size_t stopping_check_interval = 100;
+
+void results_t::update_diagnostics(const result_t &r) {
+  std::vector<double> values;
+  values.reserve(_bracket_team_index_map.size() + 1);
+  for (auto index : _bracket_team_index_map) {
+    values.push_back(r.win_prob[index]);
+  }
+  values.push_back(r.llh);
+  _monitor->add(r.chain, values);
+
+  if (_report_interval != 0 && _sample_count % _report_interval == 0) {
+    _monitor->report();
+  }
+  if (_sample_count % stopping_check_interval == 0 && !_stop_requested &&
+      _monitor->converged()) {
+    debug_print(EMIT_LEVEL_PROGRESS,
+                "Stopping rule met after %lu samples",
+                _sample_count);
+    _stop_requested = true;
+  }
+}
+
 void results_t::add_result(result_t &&r) {
+  std::lock_guard<std::mutex> lock(_add_mutex);
   _sample_count += 1;
 
+  if (_monitor.has_value()) { update_diagnostics(r); }
+
   if (_params_outfile.has_value() && _probs_outfile.has_value()) {
     write_result_to_outfiles(r);
   }
 
   if (_result_list.has_value()) { _result_list->push_back(r); }
 }
+
+auto results_t::flush() -> std::vector<std::filesystem::path> {
+  std::lock_guard<std::mutex> lock(_add_mutex);
+  for (auto *f : {&_params_outfile,
+                  &_probs_outfile,
+                  &_params_binary_outfile,
+                  &_node_probs_outfile}) {
+    if (f->has_value()) { (*f)->flush(); }
+  }
+  return _output_paths;
+}
+
+void results_t::write_diagnostics(const std::filesystem::path &prefix) {
+  std::lock_guard<std::mutex> lock(_add_mutex);
+  if (!_monitor.has_value()) { return; }
+  _monitor->report();
+  std::ofstream outfile(diagnostics_filename(prefix));
+  _monitor->write_json(outfile);
+  outfile << "\n";
+}
+
+sample_reader_t::sample_reader_t(const std::filesystem::path &path) :
+    _infile{path, std::ios::binary} {
+  if (!_infile) {
+    throw std::runtime_error{"Failed to open the samples file " +
+                             path.string()};
+  }
+  char file_magic[sizeof(magic) - 1];
+  _infile.read(file_magic, sizeof(file_magic));
+  uint64_t param_count = 0;
+  _infile.read(reinterpret_cast<char *>(&param_count), sizeof(param_count));
+  if (!_infile || std::memcmp(file_magic, magic, sizeof(file_magic)) != 0) {
+    throw std::runtime_error{path.string() + " is not a samples file"};
+  }
+  _param_count = param_count;
+}
+
+auto sample_reader_t::record_size() const -> std::streamoff {
+  return static_cast<std::streamoff>(sizeof(double) + sizeof(uint64_t) +
+                                     _param_count * sizeof(double));
+}
+
+auto sample_reader_t::next() -> std::optional<sample_record_t> {
+  sample_record_t record{params_t(_param_count), 0.0, 0};
+  uint64_t        chain = 0;
+  _infile.read(reinterpret_cast<char *>(&record.llh), sizeof(record.llh));
+  _infile.read(reinterpret_cast<char *>(&chain), sizeof(chain));
+  _infile.read(reinterpret_cast<char *>(record.params.data()),
+               static_cast<std::streamsize>(_param_count * sizeof(double)));
+  if (!_infile) { return {}; }
+  record.chain = chain;
+  return record;
+}
+
+void sample_reader_t::skip(size_t count) {
+  auto position = _infile.tellg();
+  _infile.seekg(0, std::ios::end);
+  auto end    = _infile.tellg();
+  auto target = position + static_cast<std::streamoff>(count) * record_size();
+  if (target > end) {
+    throw std::runtime_error{"Samples file has fewer samples than skipped"};
+  }
+  _infile.seekg(target);
+}
@@ -1,12 +1,17 @@
 #pragma once
 
+#include "diagnostics.hpp"
 #include "mcmc.hpp"
 #include "program_options.hpp"
 #include "util.hpp"
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
 struct result_t {
   vector_t                                                 win_prob;
@@ -14,6 +19,7 @@ struct result_t {
   std::optional<matrix_t>                                  prob_matrix;
   std::optional<std::unordered_map<std::string, vector_t>> node_probs;
   double                                                   llh;
+  size_t                                                   chain{0};
 };
 auto operator<<(std::ostream &os, const result_t &r) -> std::ostream &;
 
@@ -29,18 +35,76 @@ public:
     _run_type = rt;
     return *this;
   }
-  results_t &add_file_output(const std::filesystem::path &prefix);
+  /**
+   * Write the samples to csv files, and to a binary file of the full
+   * parameters which can be read back with `sample_reader_t`. If `append` is
+   * set, the files are assumed to have been written by an earlier run, and are
+   * appended to.
+   */
+  results_t &add_file_output(const std::filesystem::path &prefix,
+                             bool                         append = false);
   results_t &enable_memory_save();
-  results_t &add_node_probs_output(const std::filesystem::path & prefix);
 
+  /**
+   * Add a chain column to the sample files, so that the samples of concurrent
+   * chains can be told apart. Must be called before `add_file_output`.
+   */
+  results_t &enable_chain_tagging();
+  results_t &add_node_probs_output(const std::filesystem::path &prefix,
+                                   bool                         append = false);
+
+  /**
+   * Track convergence diagnostics of the win probability of every bracket team
+   * and of the log likelihood, and log a summary every `report_interval`
+   * samples. If `rule` has a target, `stop_requested` becomes true once every
+   * quantity meets it.
+   */
+  results_t &enable_diagnostics(stopping_rule_t rule, size_t report_interval);
+
+  /**
+   * True once the stopping rule is met. Chains should stop sampling.
+   */
+  [[nodiscard]] auto stop_requested() const -> bool { return _stop_requested; }
+
+  /**
+   * Log the final diagnostics, and write them to a json file. Does nothing
+   * unless `enable_diagnostics` was called.
+   */
+  void write_diagnostics(const std::filesystem::path &prefix);
+
+  /**
+   * Flush the output files, and return their paths. After a flush, every
+   * result added so far has been completely written.
+   */
+  auto flush() -> std::vector<std::filesystem::path>;
+
+  /**
+   * Add a result. Safe to call from several chains at once.
+   */
   void   add_result(result_t &&r);
   size_t sample_count() const { return _sample_count; }
 
+  /**
+   * Restore the sample count of an interrupted run which is being resumed.
+   */
+  void restore_sample_count(size_t count) { _sample_count = count; }
+
+  /**
+   * The results kept in memory, in the order they were added. Empty unless
+   * `enable_memory_save` was called.
+   */
+  [[nodiscard]] auto saved_results() const
+      -> const std::optional<std::vector<result_t>> & {
+    return _result_list;
+  }
+
 private:
   void write_result_to_outfiles(const result_t &r);
   void write_params_line(const result_t &r);
   void write_probs_line(const result_t &r);
   void write_node_probs_line(const result_t &r);
+  void write_params_record(const result_t &r);
+  void update_diagnostics(const result_t &r);
 
   inline std::filesystem::path
   params_filename(const std::filesystem::path &prefix) {
@@ -60,6 +124,15 @@ private:
     return tmp;
   }
 
+  inline std::filesystem::path
+  params_binary_filename(const std::filesystem::path &prefix) {
+    auto tmp = prefix;
+    tmp += ".";
+    tmp += describe_run_type(_run_type.value());
+    tmp += ".samples.params.bin";
+    return tmp;
+  }
+
   inline std::filesystem::path
   node_probs_filename(const std::filesystem::path &prefix) {
     auto tmp = prefix;
@@ -69,6 +142,15 @@ private:
     return tmp;
   }
 
+  inline std::filesystem::path
+  diagnostics_filename(const std::filesystem::path &prefix) {
+    auto tmp = prefix;
+    tmp += ".";
+    tmp += describe_run_type(_run_type.value());
+    tmp += ".diagnostics.json";
+    return tmp;
+  }
+
   inline void init() {
     _all_teams.reserve(_team_name_map.size());
     _all_team_index_map.reserve(_team_name_map.size());
@@ -84,7 +166,9 @@ private:
     }
   }
 
-  size_t _sample_count = 0;
+  size_t     _sample_count = 0;
+  bool       _tag_chains   = false;
+  std::mutex _add_mutex;
 
   std::optional<std::vector<result_t>> _result_list;
 
@@ -92,12 +176,63 @@ private:
 
   std::optional<std::ofstream> _params_outfile;
   std::optional<std::ofstream> _probs_outfile;
+  std::optional<std::ofstream> _params_binary_outfile;
+  bool                         _params_binary_header{false};
 
   std::optional<std::ofstream> _node_probs_outfile;
 
+  std::vector<std::filesystem::path> _output_paths;
+
+  std::optional<convergence_monitor_t> _monitor;
+  size_t                               _report_interval{0};
+  std::atomic<bool>                    _stop_requested{false};
+
   std::vector<std::string> _bracket_teams;
   std::vector<std::string> _all_teams;
   team_name_map_t          _team_name_map;
   std::vector<size_t>      _all_team_index_map;
   std::vector<size_t>      _bracket_team_index_map;
 };
+
+/**
+ * A sample read back from a binary params file.
+ */
+struct sample_record_t {
+  params_t params;
+  double   llh;
+  size_t   chain;
+};
+
+/**
+ * Streams the samples of a binary params file, as written by `results_t`.
+ *
+ * The layout is the magic string "PHYSAMP1" and the parameter count as a
+ * little endian uint64, followed by a record for each sample. A record is the
+ * log likelihood as a double, the chain as a uint64, and then the parameters as
+ * doubles.
+ */
+class sample_reader_t {
+public:
+  explicit sample_reader_t(const std::filesystem::path &path);
+
+  /**
+   * The next sample, or nothing at the end of the file. A truncated final
+   * record is treated as the end of the file.
+   */
+  auto next() -> std::optional<sample_record_t>;
+
+  /**
+   * Skip `count` samples. Throws if the file has fewer samples.
+   */
+  void skip(size_t count);
+
+  [[nodiscard]] auto param_count() const -> size_t { return _param_count; }
+
+  static constexpr char magic[] = "PHYSAMP1";
+
+private:
+  [[nodiscard]] auto record_size() const -> std::streamoff;
+
+  std::ifstream _infile;
+  size_t        _param_count{0};
+};
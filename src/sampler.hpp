@@ -1,17 +1,27 @@
 #ifndef SAMPLER_HPP
 #define SAMPLER_HPP
 
+#include "checkpoint.hpp"
 #include "debug.h"
+#include "evaluation_pipeline.hpp"
+#include "laplace.hpp"
+#include "metropolis.hpp"
 #include "model.hpp"
+#include "proposal.hpp"
 #include "results.hpp"
 #include "tournament.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <random>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -44,71 +54,485 @@ public:
                  uint64_t                                       seed,
                  const std::function<std::pair<params_t, double>(
                      const params_t &, random_engine_t &gen)>  &update_func,
-                 const std::function<double(const params_t &)> &prior,
+                 const log_prior_t                             &prior,
                  bool sample_matrix = false,
                  bool node_probs    = false) {
+    function_proposal_t proposal{update_func};
+    run_metropolis(results,
+                   iters,
+                   burnin_iters,
+                   seed,
+                   proposal,
+                   prior,
+                   sample_matrix,
+                   node_probs);
+  }
+
+  /**
+   * Run a chain with an in-place proposal, such as
+   * `win_probs_beta_with_scale_proposal_t`. The proposal and the prior are
+   * called directly, so the steps between samples do not allocate.
+   */
+  template <typename Proposal, typename Prior>
+  void run_inplace_chain(results_t   &results,
+                         size_t       iters,
+                         size_t       burnin_iters,
+                         uint64_t     seed,
+                         Proposal    &proposal,
+                         const Prior &prior,
+                         bool         sample_matrix = false,
+                         bool         node_probs    = false) {
+    run_metropolis(results,
+                   iters,
+                   burnin_iters,
+                   seed,
+                   proposal,
+                   prior,
+                   sample_matrix,
+                   node_probs);
+  }
+
+  /**
+   * Run a chain with a proposal which tunes itself during burnin. The first
+   * `burnin_iters` sampling intervals are spent adapting the proposal, and are
+   * not recorded. The proposal is then frozen, and `iters` samples are taken.
+   */
+  void run_adaptive_chain(results_t           &results,
+                          size_t               iters,
+                          size_t               burnin_iters,
+                          uint64_t             seed,
+                          adaptive_proposal_t &proposal,
+                          const log_prior_t   &prior,
+                          bool                 sample_matrix = false,
+                          bool                 node_probs    = false) {
+    run_metropolis(results,
+                   iters,
+                   burnin_iters,
+                   seed,
+                   proposal,
+                   prior,
+                   sample_matrix,
+                   node_probs);
+  }
+
+  /**
+   * Run a parallel tempering (Metropolis coupled) chain. Each temperature in
+   * the ladder has a replica which targets the posterior with the likelihood
+   * raised to `1 / temperature`. Every `swap_interval` steps, adjacent
+   * replicas propose to exchange their states, alternating between the even
+   * and odd pairs. When built with OpenMP, the replicas are updated in
+   * parallel between exchanges.
+   *
+   * Every replica takes in-place steps with its own copy of `proposal`, like
+   * `run_inplace_chain`. The likelihood model is shared, and does not start
+   * parallel regions of its own inside the parallel replica updates.
+   *
+   * Only the cold replica is recorded into `results`.
+   *
+   * @param temperatures The temperature ladder. The first temperature must be
+   * 1, and the rest should be increasing.
+   *
+   * @param swap_interval Steps between exchanges. Must divide the sampling
+   * interval of 100 steps.
+   */
+  template <typename Proposal, typename Prior>
+  void run_tempered_chain(results_t                 &results,
+                          size_t                     iters,
+                          size_t                     burnin_iters,
+                          uint64_t                   seed,
+                          const Proposal            &proposal,
+                          const Prior               &prior,
+                          const std::vector<double> &temperatures,
+                          size_t                     swap_interval,
+                          bool                       sample_matrix = false,
+                          bool                       node_probs    = false) {
 
     constexpr size_t waiting_time = 100;
 
     if (iters == 0) {
       throw std::runtime_error{"Iters should be greater than 0"};
     }
+    if (temperatures.empty() || temperatures.front() != 1.0) {
+      throw std::runtime_error{"The first temperature should be 1"};
+    }
+    if (swap_interval == 0 || waiting_time % swap_interval != 0) {
+      throw std::runtime_error{"Swap interval should divide 100"};
+    }
 
     if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    auto pipeline_scope = start_pipeline(results, sample_matrix, node_probs);
+
+    random_engine_t                  swap_gen(seed);
+    std::uniform_real_distribution<> coin(0.0, 1.0);
+
+    /* The kernels refer to the proposals, so these are not resized */
+    std::vector<Proposal> proposals(temperatures.size(), proposal);
+
+    std::vector<metropolis_kernel_t<Proposal, Prior>> replicas;
+    std::vector<random_engine_t>                      gens;
+    replicas.reserve(temperatures.size());
+    gens.reserve(temperatures.size());
+    for (size_t k = 0; k < temperatures.size(); ++k) {
+      replicas.emplace_back(*_lh_model,
+                            proposals[k],
+                            prior,
+                            initial_params(),
+                            1.0 / temperatures[k]);
+      gens.emplace_back(swap_gen());
+    }
+
+    std::vector<size_t>             successes(replicas.size());
+    std::vector<size_t>             swap_attempts(replicas.size());
+    std::vector<size_t>             swap_successes(replicas.size());
+    std::vector<std::exception_ptr> errors(replicas.size());
+
+    size_t samples = 0;
+    for (size_t i = 0, round = 0;
+         samples < iters && !results.stop_requested();
+         ++round) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+      for (size_t k = 0; k < replicas.size(); ++k) {
+        try {
+          for (size_t s = 0; s < swap_interval; ++s) {
+            if (replicas[k].step(gens[k])) { successes[k] += 1; }
+          }
+          if ((i + swap_interval) % waiting_time == 0) {
+            replicas[k].refresh_log_likelihood();
+          }
+        } catch (...) { errors[k] = std::current_exception(); }
+      }
+      for (const auto &e : errors) {
+        if (e) { std::rethrow_exception(e); }
+      }
+      i += swap_interval;
+
+      for (size_t k = round % 2; k + 1 < replicas.size(); k += 2) {
+        auto  &cold      = replicas[k];
+        auto  &hot       = replicas[k + 1];
+        double log_ratio = (cold.inv_temp() - hot.inv_temp()) *
+                           (hot.log_likelihood() - cold.log_likelihood());
+        swap_attempts[k] += 1;
+        if (coin(swap_gen) < std::exp(log_ratio)) {
+          cold.swap_state(hot);
+          swap_successes[k] += 1;
+        }
+      }
+
+      const auto &cold = replicas.front();
+      if (i % waiting_time == 0 && record_sample(results,
+                                                 cold.params(),
+                                                 cold.log_likelihood(),
+                                                 successes.front(),
+                                                 i,
+                                                 samples,
+                                                 iters,
+                                                 burnin_iters,
+                                                 sample_matrix,
+                                                 node_probs)) {
+        samples += 1;
+      }
+    }
+    finish_pipeline();
+
+    for (size_t k = 0; k + 1 < replicas.size(); ++k) {
+      debug_print(EMIT_LEVEL_INFO,
+                  "Swap ratio between temperatures %f and %f: %f",
+                  temperatures[k],
+                  temperatures[k + 1],
+                  static_cast<double>(swap_successes[k]) /
+                      static_cast<double>(swap_attempts[k]));
+    }
+  }
+
+  /**
+   * Run a Hamiltonian Monte Carlo chain, using the gradient of the likelihood
+   * model. Each iteration simulates a trajectory of `leapfrog_steps` steps with
+   * an identity mass matrix, and every iteration after burnin is recorded.
+   *
+   * The bounded parameters of the model are kept in [0, 1], as they are by the
+   * random walk proposals, by reflecting the trajectory off the bounds (Neal
+   * 2011, section 5.1). This keeps the dynamics reversible and volume
+   * preserving, and keeps the posterior proper, as the likelihood does not
+   * change when every team strength is shifted by the same amount.
+   *
+   * During the `burnin_iters` burnin iterations, the step size is tuned with
+   * dual averaging (Hoffman and Gelman 2014) to reach an acceptance rate of
+   * `target_accept`. The step size is then fixed to the averaged value.
+   */
+  void run_hmc_chain(results_t         &results,
+                     size_t             iters,
+                     size_t             burnin_iters,
+                     uint64_t           seed,
+                     const log_prior_t &prior,
+                     size_t             leapfrog_steps,
+                     double             target_accept = 0.8,
+                     bool               sample_matrix = false,
+                     bool               node_probs    = false) {
+    if (iters == 0) {
+      throw std::runtime_error{"Iters should be greater than 0"};
+    }
+    if (!_lh_model->has_gradient()) {
+      throw std::runtime_error{"HMC requires a likelihood with a gradient"};
+    }
+    if (!prior.log_density_term_derivative) {
+      throw std::runtime_error{"HMC requires a prior with a derivative"};
+    }
+    if (leapfrog_steps == 0) {
+      throw std::runtime_error{"HMC needs at least one leapfrog step"};
+    }
+
+    if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    auto pipeline_scope = start_pipeline(results, sample_matrix, node_probs);
 
-    params_t                         params(_lh_model->param_count(), 0.5);
-    params_t                         temp_params{params};
     random_engine_t                  gen(seed);
     std::uniform_real_distribution<> coin(0.0, 1.0);
+    std::normal_distribution<>       normal(0.0, 1.0);
 
-    // params = update_func(params, gen);
+    auto log_posterior = [this, &prior](const params_t &q, params_t &grad) {
+      double lp = _lh_model->log_likelihood_gradient(q, grad) + prior(q);
+      prior.add_gradient(q, grad);
+      return lp;
+    };
 
-    size_t successes = 0;
+    params_t q = initial_params();
+    params_t grad;
+    double   log_post = log_posterior(q, grad);
 
-    double cur_lh = _lh_model->log_likelihood(params);
-    for (size_t i = 0; results.sample_count() < iters; ++i) {
+    params_t q_new, grad_new, momentum(q.size());
+    size_t   bounded = _lh_model->bounded_param_count();
 
-      double hastings_ratio;
-      std::tie(temp_params, hastings_ratio) = update_func(params, gen);
+    /* Dual averaging constants, as recommended by Hoffman and Gelman */
+    constexpr double gamma = 0.05;
+    constexpr double t0    = 10.0;
+    constexpr double kappa = 0.75;
 
-      double next_lh = _lh_model->log_likelihood(temp_params);
-      debug_print(
-          EMIT_LEVEL_DEBUG, "tmp_params: %s", to_string(temp_params).c_str());
-      if (std::isnan(next_lh)) { throw std::runtime_error("next_lh is nan"); }
+    double step_size    = 0.1;
+    double mu           = std::log(10 * step_size);
+    double h_bar        = 0.0;
+    double log_step_bar = 0.0;
+    size_t successes    = 0;
+    size_t samples      = 0;
 
-      double prior_ratio = prior(temp_params) / prior(params);
+    for (size_t i = 1; samples < iters && !results.stop_requested(); ++i) {
+      for (auto &p : momentum) { p = normal(gen); }
+      double kinetic = 0.0;
+      for (auto p : momentum) { kinetic += 0.5 * p * p; }
+      double start_energy = -log_post + kinetic;
 
-      debug_print(EMIT_LEVEL_DEBUG,
-                  "next_lh : %f, cur_lh:%f, prior ratio: %f, hastings ratio: "
-                  "%f, acceptance ratio: %f",
-                  next_lh,
-                  cur_lh,
-                  prior_ratio,
-                  hastings_ratio,
-                  std::exp(next_lh - cur_lh) * prior_ratio);
-
-      if (coin(gen) <
-          std::exp(next_lh - cur_lh) * prior_ratio * hastings_ratio) {
-        std::swap(next_lh, cur_lh);
-        std::swap(temp_params, params);
+      q_new           = q;
+      grad_new        = grad;
+      double new_post = log_post;
+      for (size_t l = 0; l < leapfrog_steps; ++l) {
+        for (size_t k = 0; k < q.size(); ++k) {
+          momentum[k] += 0.5 * step_size * grad_new[k];
+          q_new[k]    += step_size * momentum[k];
+        }
+        /* Fold the position back into [0, 1]. Every crossing of a bound is a
+         * reflection, so the momentum flips if it crossed an odd number */
+        for (size_t k = 0; k < bounded; ++k) {
+          double crossings = std::floor(q_new[k]);
+          if (crossings == 0.0) { continue; }
+          q_new[k] -= crossings;
+          if (std::fmod(crossings, 2.0) != 0.0) {
+            q_new[k]    = 1.0 - q_new[k];
+            momentum[k] = -momentum[k];
+          }
+        }
+        new_post = log_posterior(q_new, grad_new);
+        if (!std::isfinite(new_post)) { break; }
+        for (size_t k = 0; k < q.size(); ++k) {
+          momentum[k] += 0.5 * step_size * grad_new[k];
+        }
+      }
+
+      kinetic = 0.0;
+      for (auto p : momentum) { kinetic += 0.5 * p * p; }
+      double end_energy = -new_post + kinetic;
+
+      double accept = std::exp(start_energy - end_energy);
+      if (!std::isfinite(new_post) || std::isnan(accept)) { accept = 0.0; }
+      accept = std::min(accept, 1.0);
+
+      if (coin(gen) < accept) {
+        std::swap(q, q_new);
+        std::swap(grad, grad_new);
+        log_post   = new_post;
         successes += 1;
       }
-      if (i % waiting_time == 0 && i != 0) {
-        record_sample(results,
-                      params,
-                      cur_lh,
-                      successes,
-                      i,
-                      iters,
-                      burnin_iters,
-                      sample_matrix,
-                      node_probs);
+
+      if (i <= burnin_iters) {
+        auto   m        = static_cast<double>(i);
+        double w        = 1.0 / (m + t0);
+        h_bar           = (1 - w) * h_bar + w * (target_accept - accept);
+        double log_step = mu - std::sqrt(m) / gamma * h_bar;
+        double eta      = std::pow(m, -kappa);
+        log_step_bar    = eta * log_step + (1 - eta) * log_step_bar;
+        step_size       = std::exp(log_step);
+        if (i == burnin_iters) {
+          step_size = std::exp(log_step_bar);
+          debug_print(EMIT_LEVEL_PROGRESS,
+                      "HMC burnin complete, step size: %f",
+                      step_size);
+        }
+        continue;
+      }
+
+      if (record_sample(results,
+                        q,
+                        _lh_model->log_likelihood(q),
+                        successes,
+                        i,
+                        samples,
+                        iters,
+                        0,
+                        sample_matrix,
+                        node_probs)) {
+        samples += 1;
       }
     }
+    finish_pipeline();
+  }
+
+  /**
+   * Evaluate up to `count` samples from `reader`, which were taken by an
+   * earlier run, instead of running a chain. The samples keep the chain they
+   * were taken by. Returns the number of samples evaluated, which is less than
+   * `count` at the end of the file.
+   */
+  auto evaluate_samples(results_t       &results,
+                        sample_reader_t &reader,
+                        size_t           count,
+                        bool             sample_matrix = false,
+                        bool             node_probs    = false) -> size_t {
+    if (reader.param_count() != _lh_model->param_count()) {
+      throw std::runtime_error{
+          "The samples file does not match the parameters of the model"};
+    }
+    if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    auto pipeline_scope = start_pipeline(results, sample_matrix, node_probs);
+
+    size_t evaluated = 0;
+    for (; evaluated < count; ++evaluated) {
+      auto sample = reader.next();
+      if (!sample.has_value()) { break; }
+      if (_pipeline) {
+        _pipeline->push(std::move(sample->params), sample->llh, sample->chain);
+      } else {
+        results.add_result(evaluate_sample(_tournament,
+                                           _cache,
+                                           sample->params,
+                                           sample->llh,
+                                           sample->chain,
+                                           sample_matrix,
+                                           node_probs));
+      }
+    }
+    finish_pipeline();
+    return evaluated;
+  }
+
+  /**
+   * Take `samples` independent draws from `approximation`, such as a Laplace
+   * approximation of the posterior, instead of running a chain. The draws are
+   * recorded like the samples of a chain.
+   */
+  void run_independent_samples(results_t               &results,
+                               size_t                   samples,
+                               uint64_t                 seed,
+                               gaussian_approximation_t approximation,
+                               bool                     sample_matrix = false,
+                               bool                     node_probs    = false) {
+    if (samples == 0) {
+      throw std::runtime_error{"Samples should be greater than 0"};
+    }
+    if (approximation.mean().size() != _lh_model->param_count()) {
+      throw std::runtime_error{
+          "The approximation does not match the parameters of the model"};
+    }
+    if (approximation.bounded_param_count() !=
+        _lh_model->bounded_param_count()) {
+      throw std::runtime_error{
+          "The approximation does not keep to the bounds of the model"};
+    }
+    if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    auto pipeline_scope = start_pipeline(results, sample_matrix, node_probs);
+
+    random_engine_t gen(seed);
+    params_t        params;
+    for (size_t i = 0; i < samples && !results.stop_requested(); ++i) {
+      approximation.draw(gen, params);
+      double llh = _lh_model->log_likelihood(params);
+      record_sample(results,
+                    params,
+                    llh,
+                    i + 1,
+                    i + 1,
+                    i,
+                    samples,
+                    0,
+                    sample_matrix,
+                    node_probs);
+    }
+    finish_pipeline();
+  }
+
+  /**
+   * Write a checkpoint of the chain to `path` every `interval` samples, so an
+   * interrupted run can be resumed. Only supported by `run_chain` and
+   * `run_adaptive_chain`.
+   */
+  void set_checkpointing(const std::filesystem::path &path, size_t interval) {
+    _checkpoint_path     = path;
+    _checkpoint_interval = interval;
+  }
+
+  /**
+   * Continue the next chain from `checkpoint` instead of from the start. The
+   * output files of `results` should already have been cut back to the
+   * checkpoint, and opened for appending.
+   */
+  void resume_from(chain_checkpoint_t checkpoint) {
+    _resume = std::move(checkpoint);
+  }
+
+  /**
+   * Start the chains from `params`, such as the maximum likelihood parameters,
+   * instead of from every parameter at 0.5. The bounded parameters of the
+   * model must be in [0, 1], as the proposals never move a parameter from
+   * outside it.
+   */
+  void set_initial_params(params_t params) {
+    if (params.size() != _lh_model->param_count()) {
+      throw std::runtime_error{
+          "The initial parameters do not match the parameters of the model"};
+    }
+    for (size_t i = 0; i < _lh_model->bounded_param_count(); ++i) {
+      if (!(params[i] >= 0.0 && params[i] <= 1.0)) {
+        throw std::runtime_error{
+            "The initial parameters are outside the bounds of the model"};
+      }
+    }
+    _initial_params = std::move(params);
+  }
+
+  /**
+   * The tournament win probabilities of a single set of parameters.
+   */
+  auto evaluate_params(const params_t &params) -> vector_t {
+    if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    return run_simulation(_tournament, compute_win_probs(params));
   }
 
   void set_simulation_iterations(size_t s) { _simulation_iterations = s; }
 
+  /**
+   * Set the chain index that is attached to every sample from this sampler.
+   * Used to tell apart the samples of concurrent chains.
+   */
+  void set_chain(size_t chain) { _chain = chain; }
+
   void set_bestofs(const std::vector<size_t> &bestofs) {
     auto tips = _tournament.tip_count();
     if (tips != std::pow(2, bestofs.size())) {
@@ -116,6 +540,20 @@ public:
                    "Mismatch in the bestof size vs tournament size");
     }
     _tournament.set_bestof(bestofs);
+    _bestofs = bestofs;
+  }
+
+  /**
+   * Evaluate recorded samples on `threads` worker threads instead of on the
+   * chain's thread. Each worker evaluates samples with its own tournament,
+   * made with `make_tournament`. Setting 0 threads evaluates samples on the
+   * chain's thread.
+   */
+  void set_evaluation_threads(
+      size_t                                  threads,
+      const std::function<tournament_t<T>()> &make_tournament) {
+    _evaluation_threads = threads;
+    _make_tournament    = make_tournament;
   }
 
   auto get_tournament() const -> tournament_t<T> const&{
@@ -123,69 +561,346 @@ public:
   }
 
 private:
-  vector_t run_simulation(const matrix_t & /*params*/);
-  matrix_t compute_win_probs(const params_t &params) {
+  /**
+   * Random walk Metropolis-Hastings loop shared by `run_chain`,
+   * `run_inplace_chain` and `run_adaptive_chain`. An `adaptive_proposal_t` is
+   * adapted for the first `burnin_iters` sampling intervals, and then frozen.
+   */
+  template <typename Proposal, typename Prior>
+  void run_metropolis(results_t   &results,
+                      size_t       iters,
+                      size_t       burnin_iters,
+                      uint64_t     seed,
+                      Proposal    &proposal,
+                      const Prior &prior,
+                      bool         sample_matrix,
+                      bool         node_probs) {
+
+    constexpr size_t waiting_time = 100;
+    constexpr bool   adaptive = std::is_same_v<Proposal, adaptive_proposal_t>;
+
+    if (iters == 0) {
+      throw std::runtime_error{"Iters should be greater than 0"};
+    }
+
+    if (_team_indicies.empty()) { generate_default_team_indicies(); }
+    auto pipeline_scope = start_pipeline(results, sample_matrix, node_probs);
+
+    metropolis_kernel_t<Proposal, Prior> kernel{
+        *_lh_model, proposal, prior, initial_params()};
+    random_engine_t gen(seed);
+
+    size_t successes = 0;
+    size_t samples   = 0;
+    size_t start     = 0;
+
+    if (_resume.has_value()) {
+      if (_resume->iters != iters || _resume->burnin_iters != burnin_iters) {
+        throw std::runtime_error{
+            "The checkpoint was taken by a run with different settings"};
+      }
+      kernel.restore(_resume->params, _resume->cur_lh);
+      start     = _resume->step;
+      successes = _resume->successes;
+      samples   = _resume->samples;
+      restore_engine(gen, _resume->rng_state);
+      if constexpr (adaptive) { proposal.restore(_resume->proposal_state); }
+      results.restore_sample_count(_resume->result_count);
+      debug_print(EMIT_LEVEL_IMPORTANT,
+                  "Resuming the chain after %lu samples",
+                  samples);
+      _resume.reset();
+    }
+
+    size_t checkpoint_burnin = burnin_iters;
+    size_t adapt_steps       = 0;
+    if constexpr (adaptive) {
+      adapt_steps  = burnin_iters * waiting_time;
+      burnin_iters = 0;
+    }
+
+    for (size_t i = start; samples < iters && !results.stop_requested();
+         ++i) {
+      bool accepted = kernel.step(gen);
+      debug_print(EMIT_LEVEL_DEBUG,
+                  "params: %s, llh: %f, accepted: %d",
+                  to_string(kernel.params()).c_str(),
+                  kernel.log_likelihood(),
+                  accepted);
+      if (accepted) { successes += 1; }
+      if (i % waiting_time == 0) { kernel.refresh_log_likelihood(); }
+
+      if constexpr (adaptive) {
+        if (i < adapt_steps) {
+          proposal.adapt(kernel.params(), kernel.last_move().changed, accepted);
+          if (i + 1 == adapt_steps) {
+            proposal.freeze();
+            debug_print(EMIT_LEVEL_PROGRESS,
+                        "Proposal adaptation complete, acceptance ratio: %f",
+                        static_cast<double>(successes) /
+                            static_cast<double>(adapt_steps));
+            debug_print(EMIT_LEVEL_INFO,
+                        "Adapted proposal scales: %s",
+                        to_string(proposal.scales()).c_str());
+            successes = 0;
+          }
+          continue;
+        }
+      }
+
+      size_t step = i - adapt_steps;
+      if (step % waiting_time == 0 && step != 0 &&
+          record_sample(results,
+                        kernel.params(),
+                        kernel.log_likelihood(),
+                        successes,
+                        step,
+                        samples,
+                        iters,
+                        burnin_iters,
+                        sample_matrix,
+                        node_probs)) {
+        samples += 1;
+        if (_checkpoint_interval > 0 && samples % _checkpoint_interval == 0) {
+          std::string proposal_state;
+          if constexpr (adaptive) { proposal_state = proposal.save(); }
+          write_checkpoint(results,
+                           {iters,
+                            checkpoint_burnin,
+                            kernel.params(),
+                            kernel.log_likelihood(),
+                            save_engine(gen),
+                            i + 1,
+                            successes,
+                            samples,
+                            proposal_state,
+                            0,
+                            {}});
+        }
+      }
+    }
+    finish_pipeline();
+  }
+
+  auto initial_params() const -> params_t {
+    return _initial_params.value_or(params_t(_lh_model->param_count(), 0.5));
+  }
+
+  /**
+   * Complete a checkpoint with the state of the results, and write it. Samples
+   * still being evaluated are waited for, so that the outputs include every
+   * sample recorded before the checkpoint.
+   */
+  void write_checkpoint(results_t &results, chain_checkpoint_t &&checkpoint) {
+    if (_pipeline) { _pipeline->drain(); }
+    checkpoint.result_count = results.sample_count();
+    for (const auto &path : results.flush()) {
+      checkpoint.outputs.emplace_back(path.string(),
+                                      std::filesystem::file_size(path));
+    }
+    checkpoint.write(_checkpoint_path);
+    debug_print(EMIT_LEVEL_INFO,
+                "Wrote checkpoint after %lu samples",
+                static_cast<size_t>(checkpoint.samples));
+  }
+
+  vector_t run_simulation(tournament_t<T> &tournament,
+                          const matrix_t & /*params*/);
+  matrix_t compute_win_probs(const params_t &params) const {
     return _lh_model->generate_win_probs(params, _team_indicies);
   }
 
-  void record_sample(results_t      &results,
+  /**
+   * The last sample evaluated with a tournament, and its win probabilities.
+   */
+  struct evaluation_cache_t {
+    bool                    valid{false};
+    params_t                params;
+    matrix_t                win_probs;
+    std::optional<result_t> result;
+  };
+
+  /**
+   * Compute the tournament results for a set of parameters with `tournament`.
+   * Only the win probabilities of teams whose parameters changed since the
+   * last sample evaluated with `cache` are recomputed, and a sample which did
+   * not change at all reuses the results of the last one. Simulated
+   * tournaments are always run again, as every run is a new estimate.
+   *
+   * Only reads the state of the sampler, so it can be called by several
+   * evaluation workers at once, as long as they use different tournaments and
+   * caches.
+   */
+  auto evaluate_sample(tournament_t<T>    &tournament,
+                       evaluation_cache_t &cache,
+                       const params_t     &params,
+                       double              llh,
+                       size_t              chain,
+                       bool                sample_matrix,
+                       bool                node_probs) -> result_t {
+    constexpr bool simulated = std::is_same_v<T, simulation_node_t>;
+    if (!simulated && cache.result.has_value() && cache.params == params) {
+      result_t result = cache.result.value();
+      result.llh      = llh;
+      result.chain    = chain;
+      return result;
+    }
+
+    bool valid  = cache.valid;
+    cache.valid = false;
+    cache.result.reset();
+    if (valid) {
+      _lh_model->update_win_probs(
+          cache.params, params, _team_indicies, cache.win_probs);
+    } else {
+      cache.win_probs = compute_win_probs(params);
+    }
+    cache.params = params;
+    cache.valid  = true;
+
+    auto sim_results = run_simulation(tournament, cache.win_probs);
+
+    result_t result{
+        sim_results,
+        params,
+        sample_matrix ? cache.win_probs : std::optional<matrix_t>(),
+        node_probs
+            ? tournament.get_node_results()
+            : std::optional<std::unordered_map<std::string, vector_t>>(),
+        llh,
+        chain};
+    if (!simulated) { cache.result = result; }
+    return result;
+  }
+
+  /**
+   * Stops the evaluation pipeline of a run when it goes out of scope, including
+   * when a chain fails.
+   */
+  struct pipeline_scope_t {
+    sampler_t *sampler;
+    ~pipeline_scope_t() { sampler->_pipeline.reset(); }
+  };
+
+  /**
+   * Start the evaluation workers for a run, if evaluation threads were
+   * requested.
+   */
+  auto start_pipeline(results_t &results, bool sample_matrix, bool node_probs)
+      -> pipeline_scope_t {
+    constexpr size_t queue_depth_per_thread = 16;
+    _cache = {};
+    if (_evaluation_threads == 0) { return {this}; }
+
+    _worker_tournaments.clear();
+    _worker_caches.assign(_evaluation_threads, {});
+    for (size_t w = 0; w < _evaluation_threads; ++w) {
+      _worker_tournaments.push_back(_make_tournament());
+      if (!_bestofs.empty()) {
+        _worker_tournaments.back().set_bestof(_bestofs);
+      }
+    }
+    _pipeline = std::make_unique<evaluation_pipeline_t>(
+        results,
+        _evaluation_threads,
+        queue_depth_per_thread * _evaluation_threads,
+        [this, sample_matrix, node_probs](size_t                  worker,
+                                          const pending_sample_t &sample) {
+          return evaluate_sample(_worker_tournaments[worker],
+                                 _worker_caches[worker],
+                                 sample.params,
+                                 sample.llh,
+                                 sample.chain,
+                                 sample_matrix,
+                                 node_probs);
+        });
+    return {this};
+  }
+
+  /**
+   * Wait for the evaluation workers to finish the samples of a run.
+   */
+  void finish_pipeline() {
+    if (_pipeline) { _pipeline->finish(); }
+  }
+
+  /**
+   * Record a sample, unless still in burnin. Returns true if a sample was
+   * recorded. `recorded` is the number of samples this chain recorded before,
+   * which the progress is reported against, as the results can be shared by
+   * several chains.
+   */
+  auto record_sample(results_t      &results,
                      const params_t &params,
                      double          llh,
                      size_t          successes,
                      size_t          trials,
+                     size_t          recorded,
                      size_t          iters,
                      size_t          burnin_iters,
                      bool            sample_matrix = false,
-                     bool            node_probs    = false) {
+                     bool            node_probs    = false) -> bool {
 
-    if (iters < burnin_iters) { return; }
+    if (iters < burnin_iters) { return false; }
     if (iters == burnin_iters && iters != 0) {
       debug_string(EMIT_LEVEL_PROGRESS, "Burnin Complete");
-      return;
+      return false;
     }
-    auto prob_matrix = compute_win_probs(params);
-    auto sim_results = run_simulation(prob_matrix);
-
-    result_t r{sim_results,
-               params,
-               sample_matrix ? prob_matrix : std::optional<matrix_t>(),
-               node_probs
-                   ? _tournament.get_node_results()
-                   : std::optional<std::unordered_map<std::string, vector_t>>(),
-               llh};
-
-    results.add_result(std::move(r));
-    if (results.sample_count() % 1000 == 0) {
+    if (_pipeline) {
+      _pipeline->push(params, llh, _chain);
+    } else {
+      results.add_result(evaluate_sample(
+          _tournament, _cache, params, llh, _chain, sample_matrix, node_probs));
+    }
+    size_t sample_count = recorded + 1;
+    if (sample_count % 1000 == 0) {
 #ifndef JOKE_BUILD
       debug_print(EMIT_LEVEL_PROGRESS,
                   "%lu samples, ratio: %f, ETC: %.2f hours",
-                  results.sample_count(),
+                  sample_count,
                   static_cast<double>(successes) / trials,
-                  progress_macro(results.sample_count(), iters));
+                  progress_macro(sample_count, iters));
 #else
       debug_print(EMIT_LEVEL_PROGRESS,
                   "%lu samples, ratio: %f, ETC: %.10f millifortnights",
-                  results.sample_count(),
+                  sample_count,
                   static_cast<double>(successes) / trials,
-                  progress_macro(results.sample_count(), iters));
+                  progress_macro(sample_count, iters));
 #endif
     }
+    return true;
   }
 
   std::unique_ptr<likelihood_model_t> _lh_model;
   tournament_t<T>                     _tournament;
   std::vector<size_t>                 _team_indicies;
   size_t                              _simulation_iterations{0};
+  size_t                              _chain{0};
+  std::vector<size_t>                 _bestofs;
+
+  size_t                                 _evaluation_threads{0};
+  std::function<tournament_t<T>()>       _make_tournament;
+  std::vector<tournament_t<T>>           _worker_tournaments;
+  std::vector<evaluation_cache_t>        _worker_caches;
+  evaluation_cache_t                     _cache;
+  std::unique_ptr<evaluation_pipeline_t> _pipeline;
+
+  std::filesystem::path             _checkpoint_path;
+  size_t                            _checkpoint_interval{0};
+  std::optional<chain_checkpoint_t> _resume;
+  std::optional<params_t>           _initial_params;
 };
 
 template <typename T1>
-auto sampler_t<T1>::run_simulation(const matrix_t &prob_matrix) -> vector_t {
-  _tournament.reset_win_probs(prob_matrix);
-  return _tournament.eval();
+auto sampler_t<T1>::run_simulation(tournament_t<T1> &tournament,
+                                   const matrix_t   &prob_matrix) -> vector_t {
+  tournament.reset_win_probs(prob_matrix);
+  return tournament.eval();
 }
 
 template <>
 vector_t
-sampler_t<simulation_node_t>::run_simulation(const matrix_t &prob_matrix);
+sampler_t<simulation_node_t>::run_simulation(tournament_t<simulation_node_t> &,
+                                             const matrix_t &prob_matrix);
 
 #endif
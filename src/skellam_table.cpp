@@ -0,0 +1,128 @@
+#include "skellam_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+auto skellam_match_outcome(double d) -> skellam_outcome_t {
+  return skellam_outcome_probs(std::exp(d), std::exp(-d));
+}
+
+monotone_cubic_t::monotone_cubic_t(vector_t values,
+                                   double   step,
+                                   double   slope_at_zero) :
+    _values{std::move(values)}, _step{step} {
+  if (_values.size() < 2 || !(step > 0.0)) {
+    throw std::runtime_error{"A cubic needs at least two points"};
+  }
+  size_t points = _values.size();
+  _max_x        = static_cast<double>(points - 1) * _step;
+
+  vector_t secants(points - 1);
+  for (size_t i = 0; i + 1 < points; ++i) {
+    secants[i] = (_values[i + 1] - _values[i]) / _step;
+  }
+
+  _slopes.resize(points);
+  _slopes[0]          = slope_at_zero;
+  _slopes[points - 1] = secants[points - 2];
+  for (size_t i = 1; i + 1 < points; ++i) {
+    _slopes[i] = (secants[i - 1] + secants[i]) / 2.0;
+  }
+
+  for (size_t i = 0; i + 1 < points; ++i) {
+    if (secants[i] == 0.0) {
+      _slopes[i]     = 0.0;
+      _slopes[i + 1] = 0.0;
+      continue;
+    }
+    double a = std::max(0.0, _slopes[i] / secants[i]);
+    double b = std::max(0.0, _slopes[i + 1] / secants[i]);
+    double r = a * a + b * b;
+    if (r > 9.0) {
+      double tau  = 3.0 / std::sqrt(r);
+      a          *= tau;
+      b          *= tau;
+    }
+    _slopes[i]     = a * secants[i];
+    _slopes[i + 1] = b * secants[i];
+  }
+}
+
+auto monotone_cubic_t::operator()(double x) const -> double {
+  if (!(x < _max_x)) { return _values.back(); }
+  if (x <= 0.0) { return _values.front(); }
+
+  double pos = x / _step;
+  auto   i   = std::min(static_cast<size_t>(pos), _values.size() - 2);
+  double t   = pos - static_cast<double>(i);
+  double u   = 1.0 - t;
+
+  return (1.0 + 2.0 * t) * u * u * _values[i] +
+         t * u * u * _step * _slopes[i] +
+         t * t * (3.0 - 2.0 * t) * _values[i + 1] -
+         t * t * u * _step * _slopes[i + 1];
+}
+
+static auto tabulate_outcomes(double max_difference, size_t steps_per_unit)
+    -> std::vector<skellam_outcome_t> {
+  if (!(max_difference > 0.0) || steps_per_unit == 0) {
+    throw std::runtime_error{"The Skellam table must not be empty"};
+  }
+  double step   = 1.0 / static_cast<double>(steps_per_unit);
+  auto   points = static_cast<size_t>(std::ceil(max_difference / step)) + 1;
+
+  std::vector<skellam_outcome_t> outcomes(points);
+  for (size_t i = 0; i < points; ++i) {
+    outcomes[i] = skellam_match_outcome(static_cast<double>(i) * step);
+  }
+  return outcomes;
+}
+
+static auto win_cubic(const std::vector<skellam_outcome_t> &outcomes,
+                      double step) -> monotone_cubic_t {
+  vector_t values(outcomes.size());
+  for (size_t i = 0; i < outcomes.size(); ++i) {
+    values[i] = outcomes[i].win + outcomes[i].tie / 2.0;
+  }
+  /* Symmetric about (0, 1/2), so the point before the first is 1 - values[1] */
+  double slope = (2.0 * values[1] - 1.0) / (2.0 * step);
+  return {std::move(values), step, slope};
+}
+
+static auto draw_cubic(const std::vector<skellam_outcome_t> &outcomes,
+                       double step) -> monotone_cubic_t {
+  vector_t values(outcomes.size());
+  for (size_t i = 0; i < outcomes.size(); ++i) { values[i] = outcomes[i].tie; }
+  /* Symmetric about 0, so it is flat there */
+  return {std::move(values), step, 0.0};
+}
+
+skellam_table_t::skellam_table_t(double max_difference,
+                                 size_t steps_per_unit) :
+    skellam_table_t(tabulate_outcomes(max_difference, steps_per_unit),
+                    1.0 / static_cast<double>(steps_per_unit)) {}
+
+skellam_table_t::skellam_table_t(
+    const std::vector<skellam_outcome_t> &outcomes, double step) :
+    _win{win_cubic(outcomes, step)}, _draw{draw_cubic(outcomes, step)} {}
+
+auto skellam_table_t::max_win_error(size_t samples) const -> double {
+  double error = 0.0;
+  auto   steps = static_cast<size_t>(std::round(_win.max_x() / _win.step()));
+  for (size_t i = 0; i < steps * samples; ++i) {
+    double d = static_cast<double>(i) * _win.step() /
+               static_cast<double>(samples);
+    auto outcome = skellam_match_outcome(d);
+    error        = std::max(
+        error, std::abs(win_prob(d) - (outcome.win + outcome.tie / 2.0)));
+  }
+  return error;
+}
+
+auto skellam_table() -> const skellam_table_t & {
+  static const skellam_table_t table{8.0, 128};
+  return table;
+}
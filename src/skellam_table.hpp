@@ -0,0 +1,83 @@
+#ifndef SKELLAM_TABLE_HPP
+#define SKELLAM_TABLE_HPP
+
+#include "util.hpp"
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/**
+ * The outcome of a match between two teams, where the first is `d` stronger
+ * than the second, under the Poisson model: the goal rates are `exp(d)` and
+ * `exp(-d)`.
+ */
+auto skellam_match_outcome(double d) -> skellam_outcome_t;
+
+/**
+ * An interpolating cubic through values on an even grid, starting at 0. The
+ * slopes are limited as in Fritsch and Carlson (1980), so that the cubic is
+ * monotone wherever the values are. Outside of the grid, the value at the
+ * nearest end is returned.
+ */
+class monotone_cubic_t {
+public:
+  /**
+   * `slope_at_zero` is the slope at the first point, as the slope there can
+   * not be estimated from the points on both sides.
+   */
+  monotone_cubic_t(vector_t values, double step, double slope_at_zero);
+
+  [[nodiscard]] auto operator()(double x) const -> double;
+
+  [[nodiscard]] auto step() const -> double { return _step; }
+  [[nodiscard]] auto max_x() const -> double { return _max_x; }
+
+private:
+  vector_t _values;
+  vector_t _slopes;
+  double   _step;
+  double   _max_x;
+};
+
+/**
+ * The probabilities that a match between two teams, where the first is `d`
+ * stronger, is won by the first team, with draws split evenly between the
+ * teams, and that it ends in a draw. Both are tabulated for differences from
+ * 0 to `max_difference`, as the win probability at `-d` is one minus that at
+ * `d`, and the draw probability is the same at `-d` and `d`.
+ */
+class skellam_table_t {
+public:
+  skellam_table_t(double max_difference, size_t steps_per_unit);
+
+  [[nodiscard]] auto win_prob(double d) const -> double {
+    return d < 0.0 ? 1.0 - _win(-d) : _win(d);
+  }
+
+  [[nodiscard]] auto draw_prob(double d) const -> double {
+    return _draw(std::abs(d));
+  }
+
+  /**
+   * The largest difference between the tabulated win probabilities and
+   * `skellam_match_outcome`, over `samples` points in every step of the grid.
+   */
+  [[nodiscard]] auto max_win_error(size_t samples) const -> double;
+
+private:
+  skellam_table_t(const std::vector<skellam_outcome_t> &outcomes,
+                  double                                step);
+
+  monotone_cubic_t _win;
+  monotone_cubic_t _draw;
+};
+
+/**
+ * The table used by the Poisson model. It is built on first use, and covers
+ * differences of up to 8 in steps of 1/128. Its win probabilities are within
+ * 6e-9 of the series. Beyond a difference of 4, the win probability is 1 and
+ * the draw probability is below 1e-23, so the ends of the table are used.
+ */
+auto skellam_table() -> const skellam_table_t &;
+
+#endif
@@ -0,0 +1,76 @@
+#include "subtree_cache.hpp"
+#include "tournament.hpp"
+#include "tournament_node.hpp"
+#include <stdexcept>
+
+void subtree_cache_t::bind(const matrix_t &win_probs) {
+  if (win_probs == _win_probs) { return; }
+  clear();
+  _win_probs = win_probs;
+}
+
+auto subtree_cache_t::find(const std::string &key) -> const vector_t * {
+  auto it = _index.find(key);
+  if (it == _index.end()) {
+    _misses += 1;
+    return nullptr;
+  }
+  _hits += 1;
+  _entries.splice(_entries.begin(), _entries, it->second);
+  return &it->second->second;
+}
+
+void subtree_cache_t::insert(const std::string &key, vector_t wpv) {
+  if (_capacity == 0) { return; }
+
+  auto it = _index.find(key);
+  if (it != _index.end()) {
+    it->second->second = std::move(wpv);
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return;
+  }
+
+  if (_entries.size() >= _capacity) {
+    _index.erase(_entries.back().first);
+    _entries.pop_back();
+  }
+
+  _entries.emplace_front(key, std::move(wpv));
+  _index[key] = _entries.begin();
+}
+
+void subtree_cache_t::clear() {
+  _entries.clear();
+  _index.clear();
+  _hits   = 0;
+  _misses = 0;
+}
+
+auto evaluate_brackets(tournament_t<tournament_node_t>        &tournament,
+                       const matrix_t                         &win_probs,
+                       const std::vector<std::vector<size_t>> &brackets,
+                       subtree_cache_t                        &cache)
+    -> std::vector<vector_t> {
+  cache.bind(win_probs);
+
+  size_t tip_count = tournament.tip_count();
+
+  std::vector<vector_t> results;
+  results.reserve(brackets.size());
+
+  matrix_t bracket_probs(tip_count, vector_t(tip_count));
+  for (const auto &bracket : brackets) {
+    if (bracket.size() != tip_count) {
+      throw std::runtime_error{"Bracket is the wrong size for the tournament"};
+    }
+    for (size_t i = 0; i < tip_count; ++i) {
+      for (size_t j = 0; j < tip_count; ++j) {
+        bracket_probs[i][j] = win_probs.at(bracket[i]).at(bracket[j]);
+      }
+    }
+    tournament.reset_win_probs(bracket_probs);
+    results.push_back(tournament.eval(cache, bracket));
+  }
+
+  return results;
+}
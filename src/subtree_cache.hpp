@@ -0,0 +1,93 @@
+#ifndef SUBTREE_CACHE_HPP
+#define SUBTREE_CACHE_HPP
+
+#include "util.hpp"
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class tournament_node_t;
+template <typename T> class tournament_t;
+
+/**
+ * A bounded, least recently used cache of subtree WPVs. Entries are keyed by
+ * a canonical string for the subtree, which encodes the shape of the subtree,
+ * the ordered (global) team indices at the tips, and the bestof of every
+ * match. Because the key is canonical, the same sub-bracket appearing in two
+ * different brackets will share a single entry.
+ *
+ * The stored WPVs are compact: they have one entry per tip of the subtree, in
+ * the order that the tips appear in the key.
+ *
+ * Entries are only valid for a single global win probability matrix. Calling
+ * `bind` with a different matrix will clear the cache.
+ */
+class subtree_cache_t {
+public:
+  subtree_cache_t() = delete;
+  explicit subtree_cache_t(size_t capacity) : _capacity{capacity} {}
+
+  /**
+   * Associate the cache with a global win probability matrix. If the matrix is
+   * different than the one previously bound, all entries are discarded.
+   */
+  void bind(const matrix_t &win_probs);
+
+  /**
+   * Lookup a subtree. Returns `nullptr` if the key is not present. A
+   * successful lookup marks the entry as the most recently used.
+   */
+  auto find(const std::string &key) -> const vector_t *;
+
+  /**
+   * Insert a compact WPV for a subtree, evicting the least recently used entry
+   * if the cache is full.
+   */
+  void insert(const std::string &key, vector_t wpv);
+
+  void clear();
+
+  [[nodiscard]] auto size() const -> size_t { return _entries.size(); }
+  [[nodiscard]] auto capacity() const -> size_t { return _capacity; }
+  [[nodiscard]] auto hits() const -> size_t { return _hits; }
+  [[nodiscard]] auto misses() const -> size_t { return _misses; }
+
+private:
+  using entry_t = std::pair<std::string, vector_t>;
+
+  std::list<entry_t>                                             _entries;
+  std::unordered_map<std::string, std::list<entry_t>::iterator> _index;
+  matrix_t                                                       _win_probs;
+
+  size_t _capacity;
+  size_t _hits   = 0;
+  size_t _misses = 0;
+};
+
+/**
+ * Evaluate a list of brackets against the same global win probability matrix,
+ * sharing the results of identical subtrees between brackets.
+ *
+ * @param tournament The shape of the brackets. The bestofs should already be
+ * set. The tips of the tournament will be assigned the teams of each bracket
+ * in turn.
+ *
+ * @param win_probs Pairwise win probabilities, indexed by global team index.
+ *
+ * @param brackets Each bracket is a list of global team indices in bracket
+ * order (the order of the tips of `tournament`).
+ *
+ * @param cache The cache to use. It will be bound to `win_probs`.
+ *
+ * @return A WPV for each bracket, in bracket order.
+ */
+auto evaluate_brackets(tournament_t<tournament_node_t>        &tournament,
+                       const matrix_t                         &win_probs,
+                       const std::vector<std::vector<size_t>> &brackets,
+                       subtree_cache_t                        &cache)
+    -> std::vector<vector_t>;
+
+#endif
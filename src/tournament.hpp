@@ -2,6 +2,7 @@
 #define TOURNAMENT_HPP
 
 #include "simulation_node.hpp"
+#include "subtree_cache.hpp"
 #include "tournament_node.hpp"
 #include "util.hpp"
 #include <cstddef>
@@ -119,6 +120,63 @@ public:
     return ret;
   }
 
+  /**
+   * Compute the WPV for the tournament, and the probabilities that each pair of
+   * teams meet in each round. The meeting probabilities are computed in the
+   * same pass as the WPV.
+   *
+   * @param[out] meetings Will be resized to fit the tournament.
+   */
+  auto eval(meeting_probs_t &meetings) -> vector_t {
+    return eval(&meetings, nullptr);
+  }
+
+  /**
+   * Compute an approximate WPV for the tournament, dropping WPV entries below
+   * `pruning.epsilon` at every match. See `pruning_t` for the error bound.
+   *
+   * @param[in,out] pruning The dropped mass is added to `pruning.discarded`.
+   */
+  auto eval(pruning_t &pruning) -> vector_t { return eval(nullptr, &pruning); }
+
+  /**
+   * Compute the WPV for the tournament, with optional meeting probabilities
+   * and pruning. Either pointer may be null.
+   */
+  auto eval(meeting_probs_t *meetings, pruning_t *pruning) -> vector_t {
+    if (!check_matrix_size(_win_probs)) {
+      throw std::runtime_error("Initialize the win probs before calling eval");
+    }
+
+    if (meetings != nullptr) {
+      *meetings = meeting_probs_t{tip_count(), _head->height()};
+    }
+    _head->reset_saved_evals();
+    return _head->eval(
+        _win_probs, tip_count(), pruning, meetings, _head->height() - 1);
+  }
+
+  /**
+   * Compute the WPV for the tournament, sharing subtree results through
+   * `cache`. Only makes sense for the dynamic mode.
+   *
+   * @param team_ids The global team index of each tip, used to identify
+   * subtrees that are shared between different brackets.
+   */
+  auto eval(subtree_cache_t &cache, const std::vector<size_t> &team_ids)
+      -> vector_t {
+    if (!check_matrix_size(_win_probs)) {
+      throw std::runtime_error("Initialize the win probs before calling eval");
+    }
+    if (team_ids.size() != tip_count()) {
+      throw std::runtime_error("Team ids are the wrong size for the tournament");
+    }
+
+    _head->reset_saved_evals();
+    _head->build_subtree_keys(team_ids);
+    return _head->eval(_win_probs, tip_count(), cache);
+  }
+
   auto eval_debug(const std::string &prefix) -> vector_t {
     if (!check_matrix_size(_win_probs)) {
       throw std::runtime_error("Initialize the win probs before calling eval");
@@ -136,6 +194,40 @@ public:
 
   vector_t eval(size_t iters);
 
+  /**
+   * Compute the expected bracket pool score of `picks`. The score for a correct
+   * pick in round `r` is `round_points[r]`, where the first round is round 0.
+   */
+  auto expected_pool_score(const bracket_picks_t     &picks,
+                           const std::vector<double> &round_points) -> double {
+    eval();
+    return _head->expected_pool_score(picks, round_points);
+  }
+
+  /**
+   * Find the bracket which has the largest expected pool score.
+   *
+   * @return The bracket, and its expected score.
+   */
+  auto optimal_pool_bracket(const std::vector<double> &round_points)
+      -> std::pair<bracket_picks_t, double> {
+    eval();
+    bracket_picks_t picks;
+    double          score = _head->optimal_pool_picks(round_points, picks);
+    return {picks, score};
+  }
+
+  /**
+   * Internal labels of the matches, grouped by round. The first round is at
+   * index 0, and the labels in each round are ordered left to right.
+   */
+  [[nodiscard]] auto round_labels() const
+      -> std::vector<std::vector<std::string>> {
+    std::vector<std::vector<std::string>> labels;
+    _head->round_labels(labels);
+    return labels;
+  }
+
   [[nodiscard]] auto dump_state_graphviz() const -> std::string {
     std::ostringstream oss;
     dump_state_graphviz(oss);
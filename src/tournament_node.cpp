@@ -1,7 +1,13 @@
 #include "tournament_node.hpp"
 #include "debug.h"
 #include "factorial.hpp"
+#include "subtree_cache.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <string>
 
@@ -48,6 +54,170 @@ void tournament_node_t::store_node_results(
   }
 }
 
+auto tournament_node_t::height() const -> size_t {
+  if (is_tip()) { return 0; }
+  return std::max(children().left->height(), children().right->height()) + 1;
+}
+
+void tournament_node_t::round_labels(
+    std::vector<std::vector<std::string>> &labels) const {
+  if (is_tip()) { return; }
+  labels.resize(height());
+  round_labels(labels, height() - 1);
+}
+
+/**
+ * The children of a match in round `round` play in the round before, even if
+ * one of them is shallower than the other, as its teams had a bye.
+ */
+void tournament_node_t::round_labels(
+    std::vector<std::vector<std::string>> &labels, size_t round) const {
+  if (is_tip()) { return; }
+  children().left->round_labels(labels, round - 1);
+  children().right->round_labels(labels, round - 1);
+  labels[round].push_back(internal_label());
+}
+
+static auto round_points_for(const std::vector<double> &round_points,
+                             size_t                     round) -> double {
+  if (round >= round_points.size()) {
+    throw std::runtime_error{"Not enough rounds in the pool scoring"};
+  }
+  return round_points[round];
+}
+
+auto tournament_node_t::expected_pool_score(
+    const bracket_picks_t &picks, const std::vector<double> &round_points) const
+    -> double {
+  if (is_tip()) { return 0.0; }
+  return expected_pool_score(picks, round_points, height() - 1);
+}
+
+auto tournament_node_t::expected_pool_score(
+    const bracket_picks_t     &picks,
+    const std::vector<double> &round_points,
+    size_t                     round) const -> double {
+  if (is_tip()) { return 0.0; }
+  if (!is_simple()) {
+    throw std::runtime_error{
+        "Pool scoring is only supported for single elimination brackets"};
+  }
+  if (!eval_saved()) {
+    throw std::runtime_error{"Tried to score an unevaluated tournament"};
+  }
+
+  auto pick_it = picks.find(internal_label());
+  if (pick_it == picks.end()) {
+    throw std::runtime_error{"Bracket is missing a pick for match " +
+                             internal_label()};
+  }
+  size_t pick = pick_it->second;
+
+  const auto &from = children().left->is_member(pick) ? children().left
+                                                      : children().right;
+  if (!from->is_member(pick)) {
+    throw std::runtime_error{"Picked team is not in match " + internal_label()};
+  }
+  if (!from->is_tip() && picks.at(from->internal_label()) != pick) {
+    throw std::runtime_error{"Bracket picks are inconsistent at match " +
+                             internal_label()};
+  }
+
+  return round_points_for(round_points, round) * _memoized_values[pick] +
+         children().left->expected_pool_score(picks, round_points, round - 1) +
+         children().right->expected_pool_score(picks, round_points, round - 1);
+}
+
+static auto argmax(const vector_t &v) -> size_t {
+  return static_cast<size_t>(
+      std::distance(v.begin(), std::max_element(v.begin(), v.end())));
+}
+
+/**
+ * Computes, for each team, the best expected score obtainable in this subtree
+ * given that the team is picked to win this node. Teams not in the subtree get
+ * negative infinity.
+ *
+ * Because the expected score is a sum over matches, the best bracket for a
+ * node which picks team t is the best bracket for the child containing t that
+ * also picks t, plus the best bracket for the other child, whatever it picks.
+ */
+auto tournament_node_t::pool_pick_scores(
+    const std::vector<double>                 &round_points,
+    size_t                                     round,
+    size_t                                     tip_count,
+    std::unordered_map<std::string, vector_t> &best) const -> vector_t {
+  vector_t scores(tip_count, -std::numeric_limits<double>::infinity());
+  if (is_tip()) {
+    scores[team().index] = 0.0;
+    return scores;
+  }
+
+  auto l_scores = children().left->pool_pick_scores(
+      round_points, round - 1, tip_count, best);
+  auto r_scores = children().right->pool_pick_scores(
+      round_points, round - 1, tip_count, best);
+
+  double l_best = *std::max_element(l_scores.begin(), l_scores.end());
+  double r_best = *std::max_element(r_scores.begin(), r_scores.end());
+  double points = round_points_for(round_points, round);
+
+  for (size_t t = 0; t < tip_count; ++t) {
+    if (std::isfinite(l_scores[t])) {
+      scores[t] = l_scores[t] + r_best + points * _memoized_values[t];
+    } else if (std::isfinite(r_scores[t])) {
+      scores[t] = r_scores[t] + l_best + points * _memoized_values[t];
+    }
+  }
+
+  best[internal_label()] = scores;
+  return scores;
+}
+
+void tournament_node_t::assign_pool_picks(
+    size_t                                           pick,
+    const std::unordered_map<std::string, vector_t> &best,
+    bracket_picks_t                                 &picks) const {
+  if (is_tip()) { return; }
+  picks[internal_label()] = pick;
+
+  auto other_pick = [&best](const tournament_edge_t &e) -> size_t {
+    if (e->is_tip()) { return e->get_team_index(); }
+    return argmax(best.at(e->internal_label()));
+  };
+
+  if (children().left->is_member(pick)) {
+    children().left->assign_pool_picks(pick, best, picks);
+    children().right->assign_pool_picks(
+        other_pick(children().right), best, picks);
+  } else {
+    children().right->assign_pool_picks(pick, best, picks);
+    children().left->assign_pool_picks(
+        other_pick(children().left), best, picks);
+  }
+}
+
+auto tournament_node_t::optimal_pool_picks(
+    const std::vector<double> &round_points, bracket_picks_t &picks) const
+    -> double {
+  if (is_tip()) { return 0.0; }
+  if (!is_simple()) {
+    throw std::runtime_error{
+        "Pool scoring is only supported for single elimination brackets"};
+  }
+  if (!eval_saved()) {
+    throw std::runtime_error{"Tried to score an unevaluated tournament"};
+  }
+
+  std::unordered_map<std::string, vector_t> best;
+
+  auto scores = pool_pick_scores(
+      round_points, height() - 1, _memoized_values.size(), best);
+  size_t winner = argmax(scores);
+  assign_pool_picks(winner, best, picks);
+  return scores[winner];
+}
+
 void tournament_node_t::label_map(
     std::vector<std::pair<std::string, size_t>> &lm) const {
   if (is_tip()) {
@@ -73,8 +243,11 @@ auto tournament_node_t::is_member(size_t index) const -> bool {
          children().right->is_member(index);
 }
 
-auto tournament_node_t::eval(const matrix_t &pmatrix,
-                             size_t          tip_count) -> vector_t {
+auto tournament_node_t::eval(const matrix_t  &pmatrix,
+                             size_t           tip_count,
+                             pruning_t       *pruning,
+                             meeting_probs_t *meetings,
+                             size_t           round) -> vector_t {
 
   if (is_tip()) {
     vector_t wpv(tip_count);
@@ -84,10 +257,16 @@ auto tournament_node_t::eval(const matrix_t &pmatrix,
 
   if (eval_saved()) { return _memoized_values; }
 
-  auto l_wpv  = children().left.eval(pmatrix, tip_count);
-  auto r_wpv  = children().right.eval(pmatrix, tip_count);
+  auto l_wpv =
+      children().left.eval(pmatrix, tip_count, pruning, meetings, round - 1);
+  auto r_wpv =
+      children().right.eval(pmatrix, tip_count, pruning, meetings, round - 1);
   auto bestof = children().bestof;
 
+  if (meetings != nullptr) {
+    add_meeting_probs(l_wpv, r_wpv, round, *meetings);
+  }
+
   auto fold_a = fold(l_wpv, r_wpv, bestof, pmatrix);
   debug_print(EMIT_LEVEL_DEBUG, "fold_a: %s", to_string(fold_a).c_str());
   auto fold_b = fold(r_wpv, l_wpv, bestof, pmatrix);
@@ -95,11 +274,153 @@ auto tournament_node_t::eval(const matrix_t &pmatrix,
   for (size_t i = 0; i < fold_a.size(); ++i) { fold_a[i] += fold_b[i]; }
   debug_print(EMIT_LEVEL_DEBUG, "eval result: %s", to_string(fold_a).c_str());
 
+  if (pruning != nullptr) {
+    for (auto &f : fold_a) {
+      if (f != 0.0 && f < pruning->epsilon) {
+        pruning->discarded += f;
+        f                   = 0.0;
+      }
+    }
+  }
+
+  _memoized_values = fold_a;
+
+  return fold_a;
+}
+
+/**
+ * The two teams meet at this node if they arrive from opposite children, so
+ * the probability of the meeting is the product of the children's WPV entries.
+ * This is the same order of work as a fold.
+ */
+void tournament_node_t::add_meeting_probs(const vector_t  &l_wpv,
+                                          const vector_t  &r_wpv,
+                                          size_t           round,
+                                          meeting_probs_t &meetings) const {
+  for (size_t i = 0; i < l_wpv.size(); ++i) {
+    if (l_wpv[i] == 0.0) { continue; }
+    for (size_t j = 0; j < r_wpv.size(); ++j) {
+      if (r_wpv[j] == 0.0 || i == j) { continue; }
+      double p = l_wpv[i] * r_wpv[j];
+      meetings(round, i, j) += p;
+      meetings(round, j, i) += p;
+    }
+  }
+}
+
+/**
+ * Write `value` as 8 bytes, least significant first, whatever the byte order
+ * of the host.
+ */
+static void write_little_endian(std::ostream &os, uint64_t value) {
+  char bytes[sizeof(value)];
+  for (auto &b : bytes) {
+    b       = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+  os.write(bytes, sizeof(bytes));
+}
+
+void meeting_probs_t::write_binary(std::ostream &os) const {
+  constexpr char magic[] = "PHYMEET1";
+  os.write(magic, sizeof(magic) - 1);
+
+  write_little_endian(os, team_count);
+  write_little_endian(os, round_count);
+  for (double p : probs) {
+    uint64_t bits;
+    std::memcpy(&bits, &p, sizeof(bits));
+    write_little_endian(os, bits);
+  }
+}
+
+/**
+ * Cached version of eval. The subtree keys must have been built with
+ * `build_subtree_keys` before calling this function. If the subtree is found
+ * in the cache, then the children are not visited at all.
+ */
+auto tournament_node_t::eval(const matrix_t  &pmatrix,
+                             size_t           tip_count,
+                             subtree_cache_t &cache) -> vector_t {
+  if (is_tip()) {
+    vector_t wpv(tip_count);
+    wpv[team().index] = 1.0;
+    return wpv;
+  }
+
+  if (eval_saved()) { return _memoized_values; }
+
+  std::vector<size_t> tips;
+  if (!_subtree_key.empty()) {
+    subtree_tips(tips);
+    if (const auto *compact = cache.find(_subtree_key)) {
+      vector_t wpv(tip_count);
+      for (size_t i = 0; i < tips.size(); ++i) { wpv[tips[i]] = (*compact)[i]; }
+      _memoized_values = wpv;
+      return wpv;
+    }
+  }
+
+  auto l_wpv  = children().left->eval(pmatrix, tip_count, cache);
+  auto r_wpv  = children().right->eval(pmatrix, tip_count, cache);
+  auto bestof = children().bestof;
+
+  auto fold_a = fold(l_wpv, r_wpv, bestof, pmatrix);
+  auto fold_b = fold(r_wpv, l_wpv, bestof, pmatrix);
+  for (size_t i = 0; i < fold_a.size(); ++i) { fold_a[i] += fold_b[i]; }
+
+  if (!_subtree_key.empty()) {
+    vector_t compact(tips.size());
+    for (size_t i = 0; i < tips.size(); ++i) { compact[i] = fold_a[tips[i]]; }
+    cache.insert(_subtree_key, std::move(compact));
+  }
+
   _memoized_values = fold_a;
 
   return fold_a;
 }
 
+/**
+ * Build the cache keys for every node in the subtree. The key of a node is made
+ * from the keys of its children, so this is cheap to do bottom up. Nodes which
+ * have a loss edge below them are not cached, as the result of such a node
+ * depends on more than its own subtree. For these nodes the key is left empty.
+ *
+ * @param team_ids Map from tip index to a global team index.
+ */
+auto tournament_node_t::build_subtree_keys(const std::vector<size_t> &team_ids)
+    -> const std::string & {
+  if (is_tip()) {
+    _subtree_key = std::to_string(team_ids.at(team().index));
+    return _subtree_key;
+  }
+
+  const auto &l_key = children().left->build_subtree_keys(team_ids);
+  const auto &r_key = children().right->build_subtree_keys(team_ids);
+
+  if (children().left.is_win() && children().right.is_win() &&
+      !l_key.empty() && !r_key.empty()) {
+    _subtree_key =
+        "(" + l_key + "," + r_key + ")" + std::to_string(children().bestof);
+  } else {
+    _subtree_key.clear();
+  }
+  return _subtree_key;
+}
+
+/**
+ * Collect the tip indices of the subtree, in the same left to right order that
+ * is used to build the subtree key.
+ */
+void tournament_node_t::subtree_tips(std::vector<size_t> &tips) const {
+  if (is_tip()) {
+    tips.push_back(team().index);
+    return;
+  }
+  children().left->subtree_tips(tips);
+  children().right->subtree_tips(tips);
+}
+
 /**
  * A "fold" what I call each term of the main formula for evaluation. In the
  * expression
@@ -125,9 +446,18 @@ auto tournament_node_t::fold(const vector_t &x,
                              uint64_t        bestof,
                              const matrix_t &pmatrix) -> vector_t {
   vector_t r(x.size());
+
+  /* Only visit the support of y, which is small for deep nodes, and for
+   * pruned WPVs */
+  std::vector<size_t> y_support;
+  y_support.reserve(y.size());
+  for (size_t m2 = 0; m2 < y.size(); ++m2) {
+    if (y[m2] != 0.0) { y_support.push_back(m2); }
+  }
+
   for (size_t m1 = 0; m1 < x.size(); ++m1) {
     if (x[m1] == 0.0) { continue; }
-    for (size_t m2 = 0; m2 < y.size(); ++m2) {
+    for (auto m2 : y_support) {
       if (m1 == m2) { continue; }
       r[m1] += bestof_n(pmatrix[m1][m2], pmatrix[m2][m1], bestof) * y[m2];
     }
@@ -148,9 +478,17 @@ auto tournament_node_t::fold(const vector_t &x,
   return r;
 }
 
-auto tournament_edge_t::eval(const matrix_t &pmatrix,
-                             size_t          tip_count) const -> vector_t {
-  auto r = _node->eval(pmatrix, tip_count);
+/**
+ * Nodes below a loss edge are also the winner of another match, where their
+ * meetings are counted, so the meetings are only passed down the win edges.
+ */
+auto tournament_edge_t::eval(const matrix_t  &pmatrix,
+                             size_t           tip_count,
+                             pruning_t       *pruning,
+                             meeting_probs_t *meetings,
+                             size_t           round) const -> vector_t {
+  auto r = _node->eval(
+      pmatrix, tip_count, pruning, is_win() ? meetings : nullptr, round);
   return r;
 }
 
@@ -16,6 +16,12 @@ struct team_t {
   size_t      index{};
 };
 
+/**
+ * A filled out bracket, as used in a bracket pool. Maps the internal label of
+ * each match to the index of the team picked to win that match.
+ */
+using bracket_picks_t = std::unordered_map<std::string, size_t>;
+
 struct scratchpad_t {
   scratchpad_t() {}
   double fold_l = 0.0;
@@ -28,6 +34,52 @@ struct scratchpad_t {
 };
 
 class tournament_node_t;
+class subtree_cache_t;
+
+/**
+ * Dense tensor of the probabilities that two teams meet in a given round.
+ * Indexed by [round][team1][team2], where round 0 is the first round. The
+ * tensor is symmetric in the teams.
+ */
+struct meeting_probs_t {
+  meeting_probs_t() = default;
+  meeting_probs_t(size_t teams, size_t rounds) :
+      team_count{teams}, round_count{rounds}, probs(rounds * teams * teams) {}
+
+  auto operator()(size_t round, size_t t1, size_t t2) -> double & {
+    return probs[(round * team_count + t1) * team_count + t2];
+  }
+  auto operator()(size_t round, size_t t1, size_t t2) const -> double {
+    return probs[(round * team_count + t1) * team_count + t2];
+  }
+
+  /**
+   * Write the tensor in a dense binary form. The layout is the magic string
+   * "PHYMEET1", the team count and the round count as little endian uint64s,
+   * followed by the probabilities as little endian IEEE 754 doubles in
+   * [round][team1][team2] order.
+   */
+  void write_binary(std::ostream &os) const;
+
+  size_t   team_count  = 0;
+  size_t   round_count = 0;
+  vector_t probs;
+};
+
+/**
+ * Settings and bookkeeping for approximate evaluation. WPV entries below
+ * `epsilon` are dropped at every match, and the dropped probability is summed
+ * into `discarded`.
+ *
+ * Every fold is monotone in the WPVs of the children, so dropping an entry of
+ * mass `d` lowers the total of the final WPV by at most `d`. Hence, for a
+ * tournament of only win edges, `discarded` is an upper bound on the L1 error
+ * of the approximate WPV, and every entry is an underestimate.
+ */
+struct pruning_t {
+  double epsilon   = 0.0;
+  double discarded = 0.0;
+};
 
 /**
  * A class representing the edge of a tournament. It has 2 "colors", win or
@@ -70,8 +122,12 @@ public:
   [[nodiscard]] inline auto is_loss() const -> bool { return !is_win(); }
   [[nodiscard]] auto        is_simple() const -> bool;
 
-  [[nodiscard]] inline auto eval(const matrix_t &pmatrix,
-                                 size_t          tip_count) const -> vector_t;
+  [[nodiscard]] inline auto eval(const matrix_t  &pmatrix,
+                                 size_t           tip_count,
+                                 pruning_t       *pruning  = nullptr,
+                                 meeting_probs_t *meetings = nullptr,
+                                 size_t           round    = 0) const
+      -> vector_t;
 
   [[nodiscard]] inline auto single_eval(const matrix_t   &pmatrix,
                                         size_t            eval_index,
@@ -154,9 +210,67 @@ public:
 
   void store_node_results(std::unordered_map<std::string, vector_t>& res_map);
 
+  /**
+   * The number of matches between this node and the tips. Tips have a height
+   * of 0, and first round matches have a height of 1.
+   */
+  [[nodiscard]] auto height() const -> size_t;
+
+  /**
+   * Collect the internal labels of the matches by round, with this node as
+   * the final. Rounds are counted back from the final, which is round
+   * `height() - 1`, so that teams with a bye skip the early rounds. The labels
+   * of each round are ordered left to right.
+   */
+  void round_labels(std::vector<std::vector<std::string>> &labels) const;
+
+  /**
+   * Compute the expected bracket pool score of a complete bracket, with this
+   * node as the final. A correct pick for a match in round `r`, numbered as in
+   * `round_labels`, is worth `round_points[r]`. Requires that the node has
+   * been evaluated.
+   */
+  [[nodiscard]] auto
+  expected_pool_score(const bracket_picks_t     &picks,
+                      const std::vector<double> &round_points) const -> double;
+
+  /**
+   * Find the bracket which maximizes the expected pool score. Requires that
+   * the node has been evaluated.
+   *
+   * @param[out] picks The best bracket.
+   *
+   * @return The expected score of the best bracket.
+   */
+  auto optimal_pool_picks(const std::vector<double> &round_points,
+                          bracket_picks_t           &picks) const -> double;
+
   void reset_saved_evals();
 
-  auto        eval(const matrix_t &pmatrix, size_t tip_count) -> vector_t;
+  /**
+   * Evaluate the WPV of this node. If `pruning` is given, small entries of the
+   * result are dropped, see `pruning_t`.
+   *
+   * If `meetings` is given, the probability that each pair of teams meets at
+   * each match is added to it, in the same pass. This node is played in round
+   * `round`, numbered as in `round_labels`, so the final is given
+   * `height() - 1`.
+   */
+  auto eval(const matrix_t  &pmatrix,
+            size_t           tip_count,
+            pruning_t       *pruning  = nullptr,
+            meeting_probs_t *meetings = nullptr,
+            size_t           round    = 0) -> vector_t;
+
+  /**
+   * Evaluate the WPV, using `cache` to share the results of subtrees which have
+   * already been computed (possibly for a different bracket).
+   */
+  auto eval(const matrix_t &pmatrix, size_t tip_count, subtree_cache_t &cache)
+      -> vector_t;
+
+  auto build_subtree_keys(const std::vector<size_t> &team_ids)
+      -> const std::string &;
   static auto fold(const vector_t &x,
                    const vector_t &y,
                    uint64_t        bestof,
@@ -313,6 +427,32 @@ protected:
   inline auto team() -> team_t & { return std::get<team_t>(_children); }
 
 private:
+  void subtree_tips(std::vector<size_t> &tips) const;
+
+  void round_labels(std::vector<std::vector<std::string>> &labels,
+                    size_t                                 round) const;
+
+  [[nodiscard]] auto
+  expected_pool_score(const bracket_picks_t     &picks,
+                      const std::vector<double> &round_points,
+                      size_t                     round) const -> double;
+
+  void add_meeting_probs(const vector_t  &l_wpv,
+                         const vector_t  &r_wpv,
+                         size_t           round,
+                         meeting_probs_t &meetings) const;
+
+  auto pool_pick_scores(const std::vector<double>                 &round_points,
+                        size_t                                     round,
+                        size_t                                     tip_count,
+                        std::unordered_map<std::string, vector_t> &best) const
+      -> vector_t;
+
+  void assign_pool_picks(
+      size_t                                           pick,
+      const std::unordered_map<std::string, vector_t> &best,
+      bracket_picks_t                                 &picks) const;
+
   [[nodiscard]] auto eval_saved() const -> bool {
     return !_memoized_values.empty();
   }
@@ -324,6 +464,7 @@ private:
   vector_t                                 _memoized_values;
   tip_bitset_t                             _tip_bitset;
   std::string                              _internal_label;
+  std::string                              _subtree_key;
   scratchpad_t                             _scratchpad;
 };
 
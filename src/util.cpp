@@ -6,8 +6,10 @@
 #include <cmath>
 #include <cstdint>
 #include <iomanip>
+#include <limits>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 
 constexpr size_t JSON_PRECISION = 14;
 
@@ -212,6 +214,54 @@ auto update_win_probs_beta_with_scale(const params_t  &params,
   return {temp_params, ratio};
 }
 
+auto win_probs_uniform_proposal_t::propose(const params_t  &params,
+                                           params_t        &proposed,
+                                           random_engine_t &gen)
+    -> proposal_move_t {
+  double ratio = 1.0;
+  for (size_t j = 0; j < params.size(); ++j) {
+    auto [a, b] = make_ab(params[j], 5);
+    beta_distribution<double> bd(a, b);
+    proposed[j]  = bd(gen);
+    ratio       *= beta_pdf(a, b, proposed[j]);
+  }
+  return {{}, std::log(ratio)};
+}
+
+auto win_probs_beta_with_scale_proposal_t::propose(const params_t  &params,
+                                                   params_t        &proposed,
+                                                   random_engine_t &gen)
+    -> proposal_move_t {
+  constexpr double alpha = 1.5;
+  constexpr double beta  = 1.5;
+
+  std::uniform_int_distribution<size_t> picker(0, params.size() - 1);
+  size_t                                index = picker(gen);
+  if (index == params.size() - 1) {
+    _scale_step.reset();
+    proposed[index] += _scale_step(gen);
+    return {index, 0.0};
+  }
+  _strength.reset();
+  proposed[index] = _strength(gen);
+  return {index,
+          std::log(beta_pdf(alpha, beta, proposed[index]) /
+                   beta_pdf(alpha, beta, params[index]))};
+}
+
+auto poisson_step_proposal_t::propose(const params_t  &params,
+                                      params_t        &proposed,
+                                      random_engine_t &gen)
+    -> proposal_move_t {
+  std::uniform_int_distribution<size_t> picker(0, params.size() - 1);
+  _step.reset();
+  /* Same order of draws as `update_poission_model_factory` */
+  double step       = _step(gen);
+  size_t index      = picker(gen);
+  proposed[index]  += step;
+  return {index, 0.0};
+}
+
 auto skellam_pmf(int k, double u1, double u2) -> double {
   double           p       = 0.0;
   constexpr double epsilon = std::numeric_limits<double>::epsilon();
@@ -247,6 +297,73 @@ auto skellam_cmf(int k, double u1, double u2) -> double {
   return p;
 }
 
+/* The Poisson terms are kept unnormalised and scaled down whenever they grow
+ * past this, so that large rates neither overflow nor underflow */
+constexpr double skellam_rescale_limit = 1e150;
+
+/**
+ * Whether the terms of a Poisson distribution with rate `u`, from term `i`
+ * on, add up to less than epsilon of `total`. Past the mode, the terms fall
+ * by at least `u / (i + 1)` each, so the tail is bounded by a geometric series.
+ */
+static auto
+poisson_tail_negligible(double term, double total, double u, double i) -> bool {
+  constexpr double epsilon = std::numeric_limits<double>::epsilon();
+  double           ratio   = u / (i + 1);
+  return ratio < 1.0 && term < epsilon * total * (1.0 - ratio);
+}
+
+/* The sums run over the values `i` of the first draw, and compare them to the
+ * draws of the second below `i`, and the other way round, so every pair of
+ * values is counted once, and every term is positive. Both distributions are
+ * walked with the recurrence `p(i + 1) = p(i) * u / (i + 1)`, starting from an
+ * unnormalised `p(0) = 1`. The product of the two normalising constants is the
+ * sum of the three outcomes, so they are normalised together at the end */
+auto skellam_outcome_probs(double u1, double u2) -> skellam_outcome_t {
+  if (!(std::isfinite(u1) && std::isfinite(u2) && u1 >= 0.0 && u2 >= 0.0)) {
+    throw std::runtime_error{"Skellam rates must be finite and non-negative"};
+  }
+
+  double p1     = 1.0;
+  double p2     = 1.0;
+  double below1 = 0.0;
+  double below2 = 0.0;
+
+  skellam_outcome_t probs{0.0, 0.0, 0.0};
+  auto              rescale = [&probs](double &p, double &below) {
+    constexpr double scale = 1.0 / skellam_rescale_limit;
+    p          *= scale;
+    below      *= scale;
+    probs.win  *= scale;
+    probs.tie  *= scale;
+    probs.loss *= scale;
+  };
+
+  for (double i = 0.0;; i += 1.0) {
+    probs.win  += p1 * below2;
+    probs.tie  += p1 * p2;
+    probs.loss += p2 * below1;
+    below1     += p1;
+    below2     += p2;
+
+    p1 *= u1 / (i + 1);
+    p2 *= u2 / (i + 1);
+
+    if (poisson_tail_negligible(p1, below1, u1, i + 1) &&
+        poisson_tail_negligible(p2, below2, u2, i + 1)) {
+      break;
+    }
+    if (below1 > skellam_rescale_limit) { rescale(p1, below1); }
+    if (below2 > skellam_rescale_limit) { rescale(p2, below2); }
+  }
+
+  double total  = probs.win + probs.tie + probs.loss;
+  probs.win    /= total;
+  probs.tie    /= total;
+  probs.loss   /= total;
+  return probs;
+}
+
 auto update_poission_model_factory(double sigma)
     -> std::function<std::pair<params_t, double>(const params_t &,
                                                  random_engine_t &gen)> {
@@ -325,6 +442,54 @@ auto beta_prior_factory(double alpha, double beta)
   };
 }
 
+auto uniform_log_prior() -> log_prior_t {
+  return {[](double) -> double { return 0.0; },
+          [](double) -> double { return 0.0; }};
+}
+
+auto gamma_log_prior_factory(double alpha, double beta) -> log_prior_t {
+  const double log_norm = alpha * std::log(beta) - std::lgamma(alpha);
+  return {[alpha, beta, log_norm](double par) -> double {
+            return log_norm + (alpha - 1) * std::log(par) - beta * par;
+          },
+          [alpha, beta](double par) -> double {
+            return (alpha - 1) / par - beta;
+          }};
+}
+
+auto invgamma_log_prior_factory(double alpha, double beta) -> log_prior_t {
+  const double log_norm = alpha * std::log(beta) - std::lgamma(alpha);
+  return {[alpha, beta, log_norm](double par) -> double {
+            return log_norm + (-alpha - 1) * std::log(par) - beta / par;
+          },
+          [alpha, beta](double par) -> double {
+            return (-alpha - 1) / par + beta / (par * par);
+          }};
+}
+
+auto normal_log_prior_factory(double mu, double sigma) -> log_prior_t {
+  const double log_norm = -std::log(sigma) - 0.5 * std::log(2 * M_PI);
+  return {[mu, sigma, log_norm](double par) -> double {
+            double z = (par - mu) / sigma;
+            return log_norm - 0.5 * z * z;
+          },
+          [mu, sigma](double par) -> double {
+            return -(par - mu) / (sigma * sigma);
+          }};
+}
+
+auto beta_log_prior_factory(double alpha, double beta) -> log_prior_t {
+  const double log_norm =
+      std::lgamma(alpha + beta) - std::lgamma(alpha) - std::lgamma(beta);
+  return {[alpha, beta, log_norm](double par) -> double {
+            return log_norm + (alpha - 1) * std::log(par) +
+                   (beta - 1) * std::log1p(-par);
+          },
+          [alpha, beta](double par) -> double {
+            return (alpha - 1) / par - (beta - 1) / (1 - par);
+          }};
+}
+
 auto phylourny_prob_clamp(const double x) -> double {
 
   if (0.0 > x || x > 1.0) {
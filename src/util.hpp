@@ -2,6 +2,7 @@
 #define UTIL_HPP
 
 #include <functional>
+#include <optional>
 #include <random>
 #include <string>
 #include "sul/dynamic_bitset.hpp"
@@ -49,6 +50,16 @@ public:
 private:
   std::gamma_distribution<result_type> g1;
   std::gamma_distribution<result_type> g2;
+
+public:
+  /**
+   * Forget any cached normal deviates, so that the next draw does not depend
+   * on the previous ones.
+   */
+  void reset() {
+    g1.reset();
+    g2.reset();
+  }
 };
 
 /**
@@ -71,19 +82,141 @@ auto update_poission_model_factory(double sigma)
     -> std::function<std::pair<params_t, double>(const params_t &,
                                                  random_engine_t &)>;
 
+/**
+ * The outcome of an in-place proposal.
+ */
+struct proposal_move_t {
+  /* The only parameter that was changed, or nothing if several were */
+  std::optional<size_t> changed;
+  double                log_hastings;
+};
+
+/*
+ * In-place versions of the update functions above, for
+ * `metropolis_kernel_t`. `propose` is given the current parameters, and a
+ * copy of them in `proposed`, which it changes. The distributions are kept
+ * between calls, but reset on every call, so the random numbers drawn are the
+ * same as those drawn by the update functions.
+ */
+
+class win_probs_uniform_proposal_t {
+public:
+  auto propose(const params_t  &params,
+               params_t        &proposed,
+               random_engine_t &gen) -> proposal_move_t;
+};
+
+class win_probs_beta_with_scale_proposal_t {
+public:
+  auto propose(const params_t  &params,
+               params_t        &proposed,
+               random_engine_t &gen) -> proposal_move_t;
+
+private:
+  beta_distribution<double>        _strength{1.5, 1.5};
+  std::normal_distribution<double> _scale_step{0.0, 0.1};
+};
+
+class poisson_step_proposal_t {
+public:
+  explicit poisson_step_proposal_t(double sigma) : _step{0.0, sigma} {}
+
+  auto propose(const params_t  &params,
+               params_t        &proposed,
+               random_engine_t &gen) -> proposal_move_t;
+
+private:
+  std::normal_distribution<double> _step;
+};
+
 auto skellam_pmf(int k, double u1, double u2) -> double;
 auto skellam_cmf(int k, double u1, double u2) -> double;
 
+/**
+ * The probabilities that a draw from a Poisson distribution with rate `u1` is
+ * greater than, equal to, or less than an independent draw from one with rate
+ * `u2`. That is, `P(X > 0)`, `P(X = 0)` and `P(X < 0)` for a Skellam
+ * distributed `X`, as given by `skellam_pmf` and `skellam_cmf`. The time
+ * taken grows linearly with the larger rate.
+ */
+struct skellam_outcome_t {
+  double win;
+  double tie;
+  double loss;
+};
+
+auto skellam_outcome_probs(double u1, double u2) -> skellam_outcome_t;
+
 auto gamma_prior_factory(double alpha, double beta)
     -> std::function<double(const params_t &)>;
 auto beta_prior_factory(double alpha, double beta)
     -> std::function<double(const params_t &)>;
-auto normal_prior_factory(const params_t &)
+auto normal_prior_factory(double mu, double sigma)
     -> std::function<double(const params_t &)>;
 auto invgamma_prior_factory(double alpha, double beta)
     -> std::function<double(const params_t &)>;
 auto uniform_prior(const params_t &) -> double;
 
+/**
+ * A prior over independent parameters, evaluated in log space. The prior is
+ * the sum of `log_density_term` over the parameters, so a change to a single
+ * parameter can be evaluated in constant time with `delta`. Factories compute
+ * any normalising constants once, when the prior is made.
+ */
+struct log_prior_t {
+  std::function<double(double)> log_density_term;
+
+  /**
+   * Derivative of `log_density_term`, used by gradient based samplers.
+   */
+  std::function<double(double)> log_density_term_derivative;
+
+  auto operator()(const params_t &params) const -> double {
+    double lp = 0.0;
+    for (double p : params) { lp += log_density_term(p); }
+    return lp;
+  }
+
+  /**
+   * Change in the log prior going from `params` to `new_params`, which only
+   * differ in the parameter `index`.
+   */
+  [[nodiscard]] auto delta(const params_t &params,
+                           const params_t &new_params,
+                           size_t          index) const -> double {
+    return log_density_term(new_params[index]) -
+           log_density_term(params[index]);
+  }
+
+  /**
+   * Add the gradient of the log prior to `gradient`.
+   */
+  void add_gradient(const params_t &params, params_t &gradient) const {
+    for (size_t i = 0; i < params.size(); ++i) {
+      gradient[i] += log_density_term_derivative(params[i]);
+    }
+  }
+};
+
+/**
+ * A flat prior, which has the interface of `log_prior_t` but is free to
+ * evaluate.
+ */
+struct flat_log_prior_t {
+  auto operator()(const params_t &) const -> double { return 0.0; }
+
+  [[nodiscard]] auto delta(const params_t &, const params_t &, size_t) const
+      -> double {
+    return 0.0;
+  }
+};
+
+auto uniform_log_prior() -> log_prior_t;
+auto gamma_log_prior_factory(double alpha, double beta) -> log_prior_t;
+auto invgamma_log_prior_factory(double alpha, double beta) -> log_prior_t;
+auto normal_log_prior_factory(double mu, double sigma) -> log_prior_t;
+auto beta_log_prior_factory(double alpha, double beta) -> log_prior_t;
+
 auto phylourny_prob_clamp(const double x) -> double;
 
 #endif // UTIL_HPP
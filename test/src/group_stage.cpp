@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <group_stage.hpp>
+#include <numeric>
+#include <tournament_factory.hpp>
+#include <tuple>
+#include <util.hpp>
+
+/**
+ * The WPV of a group stage and knockout, by evaluating the knockout for every
+ * joint ordering of the groups, and every ordering of the groups by the points
+ * of their best placed team, that is consistent with the points.
+ */
+static auto brute_force_wpv(const std::vector<std::vector<size_t>> &groups,
+                            const std::vector<knockout_slot_t>     &slots,
+                            const matrix_t                         &wp,
+                            size_t best_placed_position) -> vector_t {
+  /* The orderings of each group, with the points of each position */
+  std::vector<std::vector<std::tuple<std::vector<size_t>,
+                                     std::vector<size_t>,
+                                     double>>>
+      orderings(groups.size());
+  for (size_t g = 0; g < groups.size(); ++g) {
+    auto standings = compute_group_standings(groups[g], wp, {});
+    for (const auto &[points, prob] : standings.point_tables) {
+      std::vector<size_t> order(points.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::vector<std::vector<size_t>> sorted;
+      do {
+        if (std::is_sorted(order.begin(), order.end(), [&](size_t a, size_t b) {
+              return points[a] > points[b];
+            })) {
+          sorted.push_back(order);
+        }
+      } while (std::next_permutation(order.begin(), order.end()));
+      for (const auto &o : sorted) {
+        std::vector<size_t> teams;
+        std::vector<size_t> placed;
+        for (auto t : o) {
+          teams.push_back(groups[g][t]);
+          placed.push_back(points[t]);
+        }
+        orderings[g].emplace_back(
+            teams, placed, prob / static_cast<double>(sorted.size()));
+      }
+    }
+  }
+
+  size_t best_placed_count = 0;
+  for (const auto &slot : slots) { best_placed_count += slot.best_placed; }
+
+  auto     knockout = tournament_factory(slots.size());
+  vector_t wpv(wp.size());
+  matrix_t knockout_probs(slots.size(), vector_t(slots.size()));
+  std::vector<size_t> choice(groups.size(), 0);
+  std::vector<size_t> slot_teams(slots.size());
+  while (true) {
+    double              prob = 1.0;
+    std::vector<size_t> group_order(groups.size());
+    std::iota(group_order.begin(), group_order.end(), 0);
+    auto placed_points = [&](size_t g) {
+      return std::get<1>(orderings[g][choice[g]])[best_placed_position];
+    };
+    for (size_t g = 0; g < groups.size(); ++g) {
+      prob *= std::get<2>(orderings[g][choice[g]]);
+    }
+
+    std::vector<std::vector<size_t>> ranked;
+    do {
+      if (best_placed_count == 0 ||
+          std::is_sorted(
+              group_order.begin(), group_order.end(), [&](size_t a, size_t b) {
+                return placed_points(a) > placed_points(b);
+              })) {
+        ranked.push_back(group_order);
+      }
+    } while (best_placed_count != 0 &&
+             std::next_permutation(group_order.begin(), group_order.end()));
+
+    for (auto &order : ranked) {
+      std::sort(order.begin(),
+                order.begin() + static_cast<ptrdiff_t>(best_placed_count));
+      for (size_t s = 0, i = 0; s < slots.size(); ++s) {
+        size_t group    = slots[s].group;
+        size_t position = slots[s].position;
+        if (slots[s].best_placed) {
+          group    = order[i++];
+          position = best_placed_position;
+        }
+        slot_teams[s] = std::get<0>(orderings[group][choice[group]])[position];
+      }
+      for (size_t i = 0; i < slots.size(); ++i) {
+        for (size_t j = 0; j < slots.size(); ++j) {
+          knockout_probs[i][j] = wp[slot_teams[i]][slot_teams[j]];
+        }
+      }
+      knockout.reset_win_probs(knockout_probs);
+      auto knockout_wpv = knockout.eval();
+      for (size_t i = 0; i < slots.size(); ++i) {
+        wpv[slot_teams[i]] += prob / static_cast<double>(ranked.size()) *
+                              knockout_wpv[i];
+      }
+    }
+
+    size_t g = 0;
+    for (; g < groups.size(); ++g) {
+      if (++choice[g] < orderings[g].size()) { break; }
+      choice[g] = 0;
+    }
+    if (g == groups.size()) { break; }
+  }
+  return wpv;
+}
+
+TEST_CASE("compute_group_standings", "[group_stage]") {
+  std::vector<size_t> teams{0, 1, 2, 3};
+
+  SECTION("Evenly matched teams") {
+    auto wp = uniform_matrix_factory(4);
+
+    SECTION("Without draws") {
+      auto standings = compute_group_standings(teams, wp, {});
+      for (size_t t = 0; t < 4; ++t) {
+        for (size_t p = 0; p < 4; ++p) {
+          CHECK(standings.position_probs[t][p] == Catch::Approx(0.25));
+        }
+      }
+    }
+
+    SECTION("With draws") {
+      matrix_t dp(4, vector_t(4, 0.3));
+      auto     standings = compute_group_standings(teams, wp, dp);
+      for (size_t t = 0; t < 4; ++t) {
+        for (size_t p = 0; p < 4; ++p) {
+          CHECK(standings.position_probs[t][p] == Catch::Approx(0.25));
+        }
+      }
+
+      double total = 0.0;
+      for (const auto &team_points : standings.placed_points[0]) {
+        total += std::accumulate(team_points.begin(), team_points.end(), 0.0);
+      }
+      CHECK(total == Catch::Approx(1.0));
+    }
+  }
+
+  SECTION("A dominant team always wins the group") {
+    auto wp = uniform_matrix_factory(4);
+    for (size_t t = 1; t < 4; ++t) {
+      wp[0][t] = 1.0;
+      wp[t][0] = 0.0;
+    }
+    auto standings = compute_group_standings(teams, wp, {});
+    CHECK(standings.position_probs[0][0] == Catch::Approx(1.0));
+    CHECK(standings.placed_points[0][0][9] == Catch::Approx(1.0));
+    for (size_t t = 1; t < 4; ++t) {
+      CHECK(standings.position_probs[t][0] == Catch::Approx(0.0));
+    }
+  }
+
+  SECTION("Groups that are too large are rejected") {
+    std::vector<size_t> big(9);
+    std::iota(big.begin(), big.end(), 0);
+    CHECK_THROWS(compute_group_standings(big, uniform_matrix_factory(9), {}));
+  }
+}
+
+TEST_CASE("group_tournament_t", "[group_stage]") {
+  SECTION("Two groups into a four team knockout") {
+    group_tournament_t gt{{{0, 1, 2, 3}, {4, 5, 6, 7}},
+                          {{0, 0, false},
+                           {1, 1, false},
+                           {1, 0, false},
+                           {0, 1, false}}};
+    auto wpv = gt.eval(uniform_matrix_factory(8));
+
+    REQUIRE(wpv.size() == 8);
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+    for (auto w : wpv) { CHECK(w == Catch::Approx(0.125)); }
+
+    CHECK(gt.team_count() == 8);
+    CHECK_THROWS(gt.eval(uniform_matrix_factory(6)));
+  }
+
+  SECTION("Best third placed slot") {
+    /* Within a group, the first team beats the second, which beats the third.
+     * Teams from different groups are evenly matched. */
+    matrix_t wp(9, vector_t(9));
+    for (size_t i = 0; i < 9; ++i) {
+      for (size_t j = 0; j < 9; ++j) {
+        if (i == j) { continue; }
+        if (i % 3 < j % 3) {
+          wp[i][j] = 1.0;
+        } else if (i % 3 > j % 3) {
+          wp[i][j] = 0.0;
+        } else {
+          wp[i][j] = 0.5;
+        }
+      }
+    }
+
+    group_tournament_t gt{{{0, 1, 2}, {3, 4, 5}, {6, 7, 8}},
+                          {{0, 0, false},
+                           {1, 0, false},
+                           {2, 0, false},
+                           {0, 0, true}}};
+    auto wpv = gt.eval(wp);
+
+    const auto &best_third = gt.slot_probs()[3];
+    CHECK(best_third[2] == Catch::Approx(1.0 / 3.0));
+    CHECK(best_third[5] == Catch::Approx(1.0 / 3.0));
+    CHECK(best_third[8] == Catch::Approx(1.0 / 3.0));
+
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+    CHECK(wpv[0] == Catch::Approx(0.25));
+    CHECK(wpv[3] == Catch::Approx(0.25));
+    CHECK(wpv[6] == Catch::Approx(0.5));
+  }
+
+  SECTION("The knockout is conditioned on the group results") {
+    /* Team 0 can not meet itself in the final, which it could if the slots
+     * were independent */
+    auto wp  = uniform_matrix_factory(4);
+    wp[0][1] = 0.9;
+    wp[1][0] = 0.1;
+    wp[2][3] = 0.9;
+    wp[3][2] = 0.1;
+
+    group_tournament_t gt{
+        {{0, 1}, {2, 3}},
+        {{0, 0, false}, {1, 1, false}, {1, 0, false}, {0, 1, false}}};
+    auto wpv = gt.eval(wp);
+    CHECK(wpv[0] == Catch::Approx(0.35));
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+  }
+
+  SECTION("The knockout matches a brute force evaluation") {
+    /* Four groups of three, with the two best third placed teams, so that the
+     * slots of some groups meet in the final */
+    std::vector<std::vector<size_t>> groups{
+        {0, 1, 2}, {3, 4, 5}, {6, 7, 8}, {9, 10, 11}};
+    std::vector<knockout_slot_t> slots{{0, 0, false},
+                                       {0, 0, true},
+                                       {2, 0, false},
+                                       {3, 1, false},
+                                       {1, 0, false},
+                                       {0, 0, true},
+                                       {3, 0, false},
+                                       {2, 1, false}};
+
+    matrix_t wp(12, vector_t(12));
+    for (size_t i = 0; i < 12; ++i) {
+      for (size_t j = i + 1; j < 12; ++j) {
+        wp[i][j] = 0.5 + 0.3 * std::sin(static_cast<double>(3 * i + 7 * j));
+        wp[j][i] = 1.0 - wp[i][j];
+      }
+    }
+
+    group_tournament_t gt{groups, slots};
+    auto               wpv      = gt.eval(wp);
+    auto               expected = brute_force_wpv(groups, slots, wp, 2);
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+    for (size_t t = 0; t < 12; ++t) {
+      CHECK(wpv[t] == Catch::Approx(expected[t]));
+    }
+
+    gt.set_bestof({5, 3, 1});
+    auto bestof_wpv = gt.eval(wp);
+    CHECK(std::accumulate(bestof_wpv.begin(), bestof_wpv.end(), 0.0) ==
+          Catch::Approx(1.0));
+    CHECK(bestof_wpv[0] != Catch::Approx(wpv[0]));
+    CHECK_THROWS(gt.set_bestof({1, 1}));
+  }
+
+  SECTION("Formats of the European Championship and the World Cup") {
+    auto make_groups = [](size_t count, size_t size) {
+      std::vector<std::vector<size_t>> groups(count);
+      for (size_t g = 0; g < count; ++g) {
+        for (size_t t = 0; t < size; ++t) { groups[g].push_back(size * g + t); }
+      }
+      return groups;
+    };
+
+    /* Six groups, with the four best third placed teams */
+    std::vector<knockout_slot_t> euro{{1, 0, false},
+                                      {0, 0, true},
+                                      {0, 0, false},
+                                      {2, 1, false},
+                                      {5, 0, false},
+                                      {0, 0, true},
+                                      {3, 1, false},
+                                      {4, 1, false},
+                                      {4, 0, false},
+                                      {0, 0, true},
+                                      {3, 0, false},
+                                      {5, 1, false},
+                                      {2, 0, false},
+                                      {0, 0, true},
+                                      {0, 1, false},
+                                      {1, 1, false}};
+    CHECK_NOTHROW(group_tournament_t{make_groups(6, 4), euro});
+
+    /* Groups of three keep the evaluation quick. Every team is as likely to
+     * win, as every group fills a winner, a runner up and on average 2/3 of
+     * a best third placed slot */
+    auto wpv =
+        group_tournament_t{make_groups(6, 3), euro}.eval(
+            uniform_matrix_factory(18));
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+    for (auto w : wpv) { CHECK(w == Catch::Approx(1.0 / 18.0)); }
+
+    /* Eight groups, with the winners and runners up crossed */
+    std::vector<knockout_slot_t> world_cup;
+    for (size_t g = 0; g < 8; g += 2) {
+      world_cup.push_back({g, 0, false});
+      world_cup.push_back({g + 1, 1, false});
+    }
+    for (size_t g = 0; g < 8; g += 2) {
+      world_cup.push_back({g + 1, 0, false});
+      world_cup.push_back({g, 1, false});
+    }
+    CHECK_NOTHROW(group_tournament_t{make_groups(8, 4), world_cup});
+
+    /* Twelve groups, with the eight best third placed teams, have too many
+     * groups feeding both halves of the bracket */
+    std::vector<knockout_slot_t> expanded;
+    for (size_t g = 0; g < 12; ++g) {
+      expanded.push_back({g, 0, false});
+      expanded.push_back({g, 1, false});
+    }
+    expanded.resize(32, {0, 0, true});
+    CHECK_THROWS(group_tournament_t{make_groups(12, 4), expanded});
+  }
+
+  SECTION("Best placed slots with ties on points") {
+    std::vector<std::vector<size_t>> groups{{0, 1, 2}, {3, 4, 5}, {6, 7, 8}};
+    matrix_t                         dp(9, vector_t(9, 0.3));
+
+    group_tournament_t gt{
+        groups, {{0, 0, false}, {0, 0, true}, {1, 0, false}, {0, 0, true}}};
+    auto wpv = gt.eval(uniform_matrix_factory(9), dp);
+    CHECK(std::accumulate(wpv.begin(), wpv.end(), 0.0) == Catch::Approx(1.0));
+
+    const auto &slot_probs = gt.slot_probs();
+    for (size_t s : {1, 3}) {
+      CHECK(std::accumulate(slot_probs[s].begin(), slot_probs[s].end(), 0.0) ==
+            Catch::Approx(1.0));
+    }
+    /* Two of the three evenly matched groups provide a best third */
+    for (const auto &group : groups) {
+      double qualified = 0.0;
+      for (auto t : group) { qualified += slot_probs[1][t] + slot_probs[3][t]; }
+      CHECK(qualified == Catch::Approx(2.0 / 3.0));
+    }
+  }
+
+  SECTION("Too many sets of groups for the best placed slots") {
+    std::vector<std::vector<size_t>> groups(16);
+    std::vector<knockout_slot_t>     slots;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      groups[g] = {3 * g, 3 * g + 1, 3 * g + 2};
+    }
+    /* The winners of half the groups, and the 8 best of 16 third placed
+     * teams, which come from one of 12870 sets of groups */
+    for (size_t g = 0; g < 8; ++g) { slots.push_back({g, 0, false}); }
+    slots.resize(16, {0, 0, true});
+    CHECK_THROWS(group_tournament_t{groups, slots});
+  }
+
+  SECTION("Slot counts that are not a power of 2") {
+    CHECK_THROWS(group_tournament_t{
+        {{0, 1, 2}, {3, 4, 5}},
+        {{0, 0, false}, {1, 0, false}, {0, 1, false}, {1, 1, false},
+         {0, 2, false}, {1, 2, false}}});
+  }
+
+  SECTION("Too many best placed slots") {
+    CHECK_THROWS(group_tournament_t{
+        {{0, 1, 2}},
+        {{0, 0, false}, {0, 0, true}, {0, 0, true}, {0, 0, true}}});
+  }
+}
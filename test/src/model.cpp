@@ -1,6 +1,12 @@
 #include <catch2/catch_all.hpp>
 #include <debug.h>
+#include <laplace.hpp>
+#include <match.hpp>
 #include <model.hpp>
+#include <optimizer.hpp>
+#include <poisson_kernel.hpp>
+#include <random>
+#include <util.hpp>
 
 TEST_CASE("simple cases",
           "[simple_likelihood_model_t][poisson_likelihood_model_t]") {
@@ -68,3 +74,456 @@ TEST_CASE("simple_likelihood_model_t slightly more complex cases",
     }
   }
 }
+
+TEST_CASE("simple_likelihood_model_t long histories",
+          "[simple_likelihood_model_t]") {
+  /* More games between a pair than fit in a factorial, and teams which never
+   * play */
+  std::vector<match_t> matches;
+  for (size_t k = 0; k < 200; ++k) {
+    matches.push_back({0,
+                       1,
+                       0,
+                       0,
+                       k < 120 ? match_winner_t::left : match_winner_t::right});
+  }
+  matches.push_back({3, 2, 0, 0, match_winner_t::left});
+  simple_likelihood_model_t lhm(matches, 6);
+
+  params_t params{0.3, 0.6, 0.45, 0.8, 0.0, 0.0};
+  double   expected = std::lgamma(201.0) - std::lgamma(81.0) -
+                    std::lgamma(121.0) + 80 * std::log(0.3 / 0.9) +
+                    120 * std::log(0.6 / 0.9) + std::log(0.45 / 1.25);
+  CHECK(lhm.log_likelihood(params) == Catch::Approx(expected));
+
+  params_t new_params{params};
+  new_params[1] = 0.5;
+  CHECK(lhm.delta_log_likelihood(params, new_params, 1) ==
+        Catch::Approx(lhm.log_likelihood(new_params) -
+                      lhm.log_likelihood(params)));
+  CHECK(lhm.delta_log_likelihood(params, new_params, 4) == 0.0);
+}
+
+TEST_CASE("delta_log_likelihood",
+          "[simple_likelihood_model_t][poisson_likelihood_model_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 3, 1, 1, match_winner_t::left});
+  matches.push_back({3, 0, 4, 0, match_winner_t::left});
+  matches.push_back({0, 2, 1, 2, match_winner_t::right});
+
+  SECTION("Simple likelihood model") {
+    simple_likelihood_model_t lhm(matches);
+    params_t                  params{0.3, 0.6, 0.45, 0.8};
+    for (size_t k = 0; k < params.size(); ++k) {
+      params_t new_params{params};
+      new_params[k] = 0.2;
+      CHECK(lhm.delta_log_likelihood(params, new_params, k) ==
+            Catch::Approx(lhm.log_likelihood(new_params) -
+                          lhm.log_likelihood(params)));
+    }
+  }
+
+  SECTION("Poisson likelihood model") {
+    poisson_likelihood_model_t lhm(matches);
+    params_t                   params{0.1, -0.3, 0.5, 0.2, 0.05};
+    REQUIRE(params.size() == lhm.param_count());
+    for (size_t k = 0; k < params.size(); ++k) {
+      params_t new_params{params};
+      new_params[k] += 0.25;
+      CHECK(lhm.delta_log_likelihood(params, new_params, k) ==
+            Catch::Approx(lhm.log_likelihood(new_params) -
+                          lhm.log_likelihood(params)));
+    }
+  }
+}
+
+TEST_CASE("update_win_probs",
+          "[simple_likelihood_model_t][poisson_likelihood_model_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 3, 1, 1, match_winner_t::left});
+  matches.push_back({3, 0, 4, 0, match_winner_t::left});
+  std::vector<size_t> teams{3, 1, 0, 2};
+
+  auto check_updates = [&](const likelihood_model_t &lhm,
+                           const params_t           &params) {
+    for (size_t k = 0; k < params.size(); ++k) {
+      for (size_t l = k; l < params.size(); ++l) {
+        params_t new_params{params};
+        new_params[k] *= 0.5;
+        new_params[l] *= 0.5;
+        auto wp = lhm.generate_win_probs(params, teams);
+        lhm.update_win_probs(params, new_params, teams, wp);
+        CHECK(wp == lhm.generate_win_probs(new_params, teams));
+      }
+    }
+
+    matrix_t wp;
+    lhm.update_win_probs(params, params, teams, wp);
+    CHECK(wp == lhm.generate_win_probs(params, teams));
+  };
+
+  SECTION("Simple likelihood model") {
+    check_updates(simple_likelihood_model_t(matches), {0.3, 0.6, 0.45, 0.8});
+  }
+  SECTION("Poisson likelihood model") {
+    check_updates(poisson_likelihood_model_t(matches),
+                  {0.1, -0.3, 0.5, 0.2, 0.05});
+  }
+}
+
+TEST_CASE("poisson_likelihood_model_t gradient", "[poisson_likelihood_model_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 0, 1, 1, match_winner_t::left});
+
+  poisson_likelihood_model_t lhm(matches);
+  REQUIRE(lhm.has_gradient());
+
+  params_t params{0.1, -0.3, 0.5, 0.05};
+  params_t gradient;
+  double   llh = lhm.log_likelihood_gradient(params, gradient);
+  CHECK(llh == Catch::Approx(lhm.log_likelihood(params)));
+  REQUIRE(gradient.size() == params.size());
+
+  constexpr double h = 1e-6;
+  for (size_t k = 0; k < params.size(); ++k) {
+    params_t hi{params}, lo{params};
+    hi[k] += h;
+    lo[k] -= h;
+    double numeric = (lhm.log_likelihood(hi) - lhm.log_likelihood(lo)) / (2 * h);
+    CHECK(gradient[k] == Catch::Approx(numeric).epsilon(1e-5));
+  }
+
+  simple_likelihood_model_t simple(matches);
+  CHECK(!simple.has_gradient());
+}
+
+TEST_CASE("poisson_likelihood_model_t hessian", "[poisson_likelihood_model_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 0, 1, 1, match_winner_t::left});
+
+  poisson_likelihood_model_t lhm(matches);
+  REQUIRE(lhm.has_hessian());
+
+  params_t params{0.1, -0.3, 0.5, 0.05};
+  params_t gradient;
+  matrix_t hessian;
+  double   llh = lhm.log_likelihood_hessian(params, gradient, hessian);
+  CHECK(llh == Catch::Approx(lhm.log_likelihood(params)));
+  REQUIRE(hessian.size() == params.size());
+
+  constexpr double h = 1e-6;
+  for (size_t k = 0; k < params.size(); ++k) {
+    params_t hi{params}, lo{params}, hi_gradient, lo_gradient;
+    hi[k] += h;
+    lo[k] -= h;
+    (void)lhm.log_likelihood_gradient(hi, hi_gradient);
+    (void)lhm.log_likelihood_gradient(lo, lo_gradient);
+    for (size_t j = 0; j < params.size(); ++j) {
+      double numeric = (hi_gradient[j] - lo_gradient[j]) / (2 * h);
+      CHECK(hessian[j][k] == Catch::Approx(numeric).epsilon(1e-5));
+    }
+  }
+
+  simple_likelihood_model_t simple(matches);
+  CHECK(!simple.has_hessian());
+}
+
+TEST_CASE("find_mode", "[optimizer]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 0, 1, 1, match_winner_t::left});
+  matches.push_back({3, 0, 0, 2, match_winner_t::right});
+  matches.push_back({1, 3, 2, 1, match_winner_t::left});
+  matches.push_back({2, 3, 0, 2, match_winner_t::right});
+
+  SECTION("Poisson likelihood model") {
+    poisson_likelihood_model_t lhm(matches);
+    params_t                   start(lhm.param_count(), 0.5);
+    auto optimum = find_mode(lhm, uniform_log_prior(), start);
+    REQUIRE(optimum.converged);
+    CHECK(optimum.log_posterior >= lhm.log_likelihood(start));
+
+    params_t gradient;
+    (void)lhm.log_likelihood_gradient(optimum.params, gradient);
+    for (double g : gradient) { CHECK(std::abs(g) < 1e-6); }
+
+    for (size_t k = 0; k < optimum.params.size(); ++k) {
+      params_t moved{optimum.params};
+      moved[k] += 0.01;
+      CHECK(lhm.log_likelihood(moved) <= optimum.log_posterior);
+    }
+  }
+
+  SECTION("Poisson strengths stay in bounds") {
+    /* Unbounded, the strengths of these teams would be further apart than
+     * the width of [0, 1] */
+    std::vector<match_t> lopsided(20, {0, 1, 5, 0, match_winner_t::left});
+
+    poisson_likelihood_model_t lhm(lopsided);
+    auto optimum = find_mode(lhm, uniform_log_prior(), {-0.4, 1.3, 0.1});
+    REQUIRE(optimum.converged);
+    for (size_t k = 0; k < lhm.bounded_param_count(); ++k) {
+      CHECK(optimum.params[k] >= 0.0);
+      CHECK(optimum.params[k] <= 1.0);
+    }
+    CHECK(optimum.params[0] == 1.0);
+    CHECK(optimum.params[1] == 0.0);
+
+    params_t gradient;
+    (void)lhm.log_likelihood_gradient(optimum.params, gradient);
+    CHECK(gradient[0] > 0.0);
+    CHECK(gradient[1] < 0.0);
+    CHECK(std::abs(gradient[2]) < 1e-6);
+  }
+
+  SECTION("Simple likelihood model") {
+    simple_likelihood_model_t lhm(matches);
+    params_t                  start(lhm.param_count(), 0.5);
+    auto optimum = find_mode(lhm, uniform_log_prior(), start);
+    REQUIRE(optimum.converged);
+    CHECK(optimum.log_posterior > lhm.log_likelihood(start));
+    CHECK(optimum.log_posterior ==
+          Catch::Approx(lhm.log_likelihood(optimum.params)));
+
+    params_t next = lhm.maximization_step(optimum.params);
+    for (size_t k = 0; k < next.size(); ++k) {
+      CHECK(next[k] == Catch::Approx(optimum.params[k]).margin(1e-6));
+    }
+  }
+}
+
+TEST_CASE("laplace_approximation", "[laplace]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 0, 1, 1, match_winner_t::left});
+  matches.push_back({3, 0, 0, 2, match_winner_t::right});
+  matches.push_back({1, 3, 2, 1, match_winner_t::left});
+  matches.push_back({2, 3, 0, 2, match_winner_t::right});
+
+  poisson_likelihood_model_t lhm(matches);
+  auto                       prior = uniform_log_prior();
+  auto                       mode =
+      find_mode(lhm, prior, params_t(lhm.param_count(), 0.5)).params;
+  auto approximation = laplace_approximation(lhm, prior, mode);
+
+  SECTION("The covariance inverts the curvature") {
+    /* Shifting every strength is flat, everything else is not */
+    CHECK(approximation.flat_directions() == 1);
+
+    params_t gradient;
+    matrix_t precision;
+    (void)lhm.log_likelihood_hessian(mode, gradient, precision);
+    size_t n = mode.size();
+    for (auto &row : precision) {
+      for (auto &f : row) { f = -f; }
+    }
+
+    /* With the flat direction, the covariance is the pseudo-inverse of the
+     * precision, so precision * covariance * precision == precision */
+    const auto &scale = approximation.scale();
+    matrix_t    covariance(n, params_t(n, 0.0));
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        for (size_t k = 0; k < n; ++k) {
+          covariance[i][j] += scale[i][k] * scale[j][k];
+        }
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        double product = 0.0;
+        for (size_t k = 0; k < n; ++k) {
+          for (size_t l = 0; l < n; ++l) {
+            product += precision[i][k] * covariance[k][l] * precision[l][j];
+          }
+        }
+        CHECK(product == Catch::Approx(precision[i][j]).margin(1e-8));
+      }
+    }
+  }
+
+  SECTION("Unbounded draws are centered on the mode") {
+    /* Reflecting draws off the bounds moves their mean away from the mode */
+    gaussian_approximation_t unbounded{approximation.mean(),
+                                       approximation.scale()};
+    constexpr size_t         draws = 20000;
+    random_engine_t          gen(Catch::rngSeed());
+    params_t                 params;
+    vector_t                 mean(mode.size(), 0.0);
+    for (size_t d = 0; d < draws; ++d) {
+      unbounded.draw(gen, params);
+      for (size_t i = 0; i < mode.size(); ++i) { mean[i] += params[i] / draws; }
+    }
+    for (size_t i = 0; i < mode.size(); ++i) {
+      CHECK(mean[i] == Catch::Approx(mode[i]).margin(0.05));
+    }
+  }
+
+  SECTION("Draws stay in bounds") {
+    /* The unbounded mode of these strengths is further apart than the width
+     * of [0, 1], so the bounded mode is on the bounds */
+    std::vector<match_t> lopsided(20, {0, 1, 5, 0, match_winner_t::left});
+    poisson_likelihood_model_t lopsided_lhm(lopsided);
+    auto                       bounded_mode =
+        find_mode(lopsided_lhm, prior, {0.5, 0.5, 0.5}).params;
+    auto bounded_approximation =
+        laplace_approximation(lopsided_lhm, prior, bounded_mode);
+    CHECK(bounded_approximation.bounded_param_count() == 2);
+
+    random_engine_t gen(Catch::rngSeed());
+    params_t        params;
+    for (size_t d = 0; d < 1000; ++d) {
+      bounded_approximation.draw(gen, params);
+      for (size_t i = 0; i < 2; ++i) {
+        CHECK(params[i] >= 0.0);
+        CHECK(params[i] <= 1.0);
+      }
+    }
+  }
+
+  SECTION("Needs a Hessian") {
+    simple_likelihood_model_t simple(matches);
+    params_t                  start(simple.param_count(), 0.5);
+    CHECK_THROWS(laplace_approximation(simple, prior, start));
+  }
+}
+
+TEST_CASE("Models of bootstrap replicates", "[bootstrap]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 2, 0, 3, match_winner_t::right});
+  matches.push_back({2, 0, 1, 1, match_winner_t::left});
+  matches.push_back({3, 0, 0, 2, match_winner_t::right});
+
+  SECTION("Replicates are reproducible") {
+    auto a = generate_bootstrap(matches, 7);
+    auto b = generate_bootstrap(matches, 7);
+    REQUIRE(a.size() == matches.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+      CHECK(a[i].l_team == b[i].l_team);
+      CHECK(a[i].r_team == b[i].r_team);
+    }
+  }
+
+  SECTION("Teams missing from a replicate keep their parameters") {
+    std::vector<match_t> replicate{matches[0], matches[0], matches[1]};
+    poisson_likelihood_model_t full(matches);
+    poisson_likelihood_model_t poisson(replicate, count_teams(matches));
+    CHECK(poisson.param_count() == full.param_count());
+    CHECK(poisson_likelihood_model_t(replicate).param_count() <
+          full.param_count());
+
+    simple_likelihood_model_t simple(replicate, count_teams(matches));
+    CHECK(simple.param_count() ==
+          simple_likelihood_model_t(matches).param_count());
+
+    params_t start(full.param_count(), 0.5);
+    auto     optimum = find_mode(poisson, uniform_log_prior(), start);
+    CHECK(optimum.params[3] == 0.5);
+  }
+}
+
+TEST_CASE("poisson_likelihood_model_t repeated fixtures",
+          "[poisson_likelihood_model_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 2, 1, match_winner_t::left});
+  matches.push_back({1, 0, 0, 3, match_winner_t::right});
+  matches.push_back({0, 1, 1, 1, match_winner_t::left});
+  matches.push_back({2, 1, 15, 0, match_winner_t::left});
+  matches.push_back({1, 2, 1, 2, match_winner_t::right});
+
+  poisson_likelihood_model_t lhm(matches);
+  params_t                   params{0.1, -0.3, 0.5, 0.2};
+
+  double expected = 0.0;
+  for (const auto &m : matches) {
+    double lambda_l = std::exp(params[m.l_team] - params[m.r_team] + params[3]);
+    double lambda_r = std::exp(params[m.r_team] - params[m.l_team] + params[3]);
+    expected += std::log(std::pow(lambda_l, m.l_goals) * std::exp(-lambda_l) /
+                         std::tgamma(m.l_goals + 1.0));
+    expected += std::log(std::pow(lambda_r, m.r_goals) * std::exp(-lambda_r) /
+                         std::tgamma(m.r_goals + 1.0));
+  }
+  CHECK(lhm.log_likelihood(params) == Catch::Approx(expected));
+
+  params_t new_params{params};
+  new_params[1] = 0.4;
+  CHECK(lhm.delta_log_likelihood(params, new_params, 1) ==
+        Catch::Approx(lhm.log_likelihood(new_params) -
+                      lhm.log_likelihood(params)));
+}
+
+TEST_CASE("poisson_pairs_log_likelihood", "[poisson_kernel]") {
+  constexpr size_t teams = 12;
+  random_engine_t  gen(Catch::rngSeed());
+  std::uniform_real_distribution<double> strength(-3.0, 3.0);
+  std::uniform_int_distribution<int>     goals(0, 20);
+
+  poisson_pairs_t pairs;
+  for (size_t i = 0; i < teams; ++i) {
+    for (size_t j = i; j < teams; ++j) {
+      pairs.l_team.push_back(static_cast<int32_t>(i));
+      pairs.r_team.push_back(static_cast<int32_t>(j));
+      pairs.matches.push_back(1.0 + goals(gen) % 4);
+      pairs.l_goals.push_back(goals(gen));
+      pairs.r_goals.push_back(goals(gen));
+    }
+  }
+  params_t team_strs(teams + 1);
+  for (auto &f : team_strs) { f = strength(gen); }
+
+  std::vector<simd_level_t> levels{simd_level_t::scalar};
+  if (detect_simd_level() != simd_level_t::scalar) {
+    levels.push_back(simd_level_t::avx2);
+  }
+  if (detect_simd_level() == simd_level_t::avx512) {
+    levels.push_back(simd_level_t::avx512);
+  }
+
+  SECTION("Every instruction set agrees") {
+    double expected = poisson_pairs_log_likelihood(
+        pairs, team_strs, 0, pairs.size(), simd_level_t::scalar);
+    for (auto level : levels) {
+      for (size_t begin : {0, 3}) {
+        double scalar = poisson_pairs_log_likelihood(
+            pairs, team_strs, begin, pairs.size(), simd_level_t::scalar);
+        CHECK(poisson_pairs_log_likelihood(
+                  pairs, team_strs, begin, pairs.size(), level) ==
+              Catch::Approx(scalar).epsilon(1e-13));
+      }
+      CHECK(poisson_pairs_log_likelihood(
+                pairs, team_strs, 0, pairs.size(), level) ==
+            Catch::Approx(expected).epsilon(1e-13));
+    }
+  }
+
+  SECTION("Rates which overflow or underflow") {
+    team_strs[0] = 800.0;
+    for (auto level : levels) {
+      CHECK(poisson_pairs_log_likelihood(
+                pairs, team_strs, 0, pairs.size(), level) ==
+            -std::numeric_limits<double>::infinity());
+    }
+
+    team_strs[0]     = 0.0;
+    team_strs[teams] = -800.0;
+    double expected  = poisson_pairs_log_likelihood(
+        pairs, team_strs, 0, pairs.size(), simd_level_t::scalar);
+    CHECK(std::isfinite(expected));
+    for (auto level : levels) {
+      CHECK(poisson_pairs_log_likelihood(
+                pairs, team_strs, 0, pairs.size(), level) ==
+            Catch::Approx(expected).epsilon(1e-13));
+    }
+  }
+}
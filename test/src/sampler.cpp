@@ -1,12 +1,19 @@
 #include <algorithm>
+#include <chrono>
 #include <catch2/catch_all.hpp>
+#include <checkpoint.hpp>
 #include <cmath>
 #include <debug.h>
+#include <diagnostics.hpp>
+#include <evaluation_pipeline.hpp>
+#include <filesystem>
 #include <math.h>
 #include <mcmc.hpp>
+#include <metropolis.hpp>
 #include <memory>
 #include <numeric>
 #include <sampler.hpp>
+#include <thread>
 #include <tournament_factory.hpp>
 #include <util.hpp>
 
@@ -35,7 +42,7 @@ TEST_CASE("sampler_t simple case", "[sampler_t]") {
                     0,
                     Catch::rngSeed(),
                     update_win_probs_uniform,
-                    uniform_prior);
+                    uniform_log_prior());
         CHECK(r.sample_count() > 0);
         CHECK(r.sample_count() <= 100);
       }
@@ -54,12 +61,553 @@ TEST_CASE("sampler_t simple case", "[sampler_t]") {
                     0,
                     Catch::rngSeed(),
                     update_poission_model_factory(0.1),
-                    uniform_prior);
+                    uniform_log_prior());
         CHECK(r.sample_count() > 0);
         CHECK(r.sample_count() <= 100);
       }
     }
   }
+  SECTION("Several chains sharing results") {
+    results_t r{teams, team_name_map};
+    for (size_t c = 0; c < 2; ++c) {
+      sampler_t s{std::make_unique<simple_likelihood_model_t>(
+                      simple_likelihood_model_t(matches)),
+                  tournament_factory(2)};
+      s.set_chain(c);
+      s.run_chain(r,
+                  50,
+                  0,
+                  Catch::rngSeed() + c,
+                  update_win_probs_uniform,
+                  uniform_log_prior());
+    }
+    CHECK(r.sample_count() == 100);
+  }
+  SECTION("Hamiltonian Monte Carlo") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t r{teams, team_name_map};
+    s.run_hmc_chain(r, 100, 50, Catch::rngSeed(), uniform_log_prior(), 10);
+    CHECK(r.sample_count() == 100);
+
+    sampler_t simple{std::make_unique<simple_likelihood_model_t>(
+                         simple_likelihood_model_t(matches)),
+                     tournament_factory(2)};
+    CHECK_THROWS(simple.run_hmc_chain(
+        r, 100, 50, Catch::rngSeed(), uniform_log_prior(), 10));
+  }
+  SECTION("Hamiltonian Monte Carlo keeps the strengths in bounds") {
+    /* The likelihood alone pushes the strengths of these teams apart by more
+     * than the width of [0, 1] */
+    std::vector<match_t> lopsided(20, {0, 1, 5, 0, match_winner_t::left});
+
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(lopsided)),
+                tournament_factory(2)};
+    results_t r{teams, team_name_map};
+    r.enable_memory_save();
+    s.run_hmc_chain(r, 200, 100, Catch::rngSeed(), uniform_log_prior(), 10);
+    REQUIRE(r.sample_count() == 200);
+    for (const auto &result : r.saved_results().value()) {
+      for (size_t k = 0; k < 2; ++k) {
+        CHECK(result.params[k] >= 0.0);
+        CHECK(result.params[k] <= 1.0);
+      }
+      CHECK(result.params[0] > result.params[1]);
+    }
+  }
+  SECTION("In-place proposal") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t                            r{teams, team_name_map};
+    win_probs_beta_with_scale_proposal_t proposal;
+    s.run_inplace_chain(
+        r, 100, 0, Catch::rngSeed(), proposal, flat_log_prior_t{});
+    CHECK(r.sample_count() == 100);
+  }
+  SECTION("Warm start") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    CHECK_THROWS(s.set_initial_params({0.1, 0.2}));
+    CHECK_THROWS(s.set_initial_params({-0.4, 0.3, 0.1}));
+    CHECK_THROWS(s.set_initial_params({0.4, 1.3, 0.1}));
+
+    params_t initial{0.2, 0.7, 0.1};
+    s.set_initial_params(initial);
+    auto wp = s.evaluate_params(initial);
+    REQUIRE(wp.size() == 2);
+    CHECK(wp[0] + wp[1] == Catch::Approx(1.0));
+    CHECK(wp[1] > wp[0]);
+
+    results_t r{teams, team_name_map};
+    r.enable_memory_save();
+    win_probs_beta_with_scale_proposal_t proposal;
+    s.run_inplace_chain(
+        r, 200, 0, Catch::rngSeed(), proposal, flat_log_prior_t{});
+    REQUIRE(r.sample_count() == 200);
+    for (size_t k = 0; k < initial.size(); ++k) {
+      bool moved = false;
+      for (const auto &result : r.saved_results().value()) {
+        if (result.params[k] != initial[k]) { moved = true; }
+      }
+      CHECK(moved);
+    }
+  }
+  SECTION("Independent samples") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t r{teams, team_name_map};
+    r.enable_memory_save();
+    gaussian_approximation_t approximation{
+        {0.05, 0.3, 0.1},
+        {{0.1, 0.0, 0.0}, {0.0, 0.1, 0.0}, {0.0, 0.0, 0.0}},
+        2};
+    CHECK(approximation.flat_directions() == 1);
+    s.run_independent_samples(r, 100, Catch::rngSeed(), approximation);
+    REQUIRE(r.sample_count() == 100);
+    for (const auto &result : r.saved_results().value()) {
+      CHECK(result.params[0] >= 0.0);
+      CHECK(result.params[0] <= 1.0);
+      CHECK(result.params[2] == 0.1);
+    }
+
+    CHECK_THROWS(s.run_independent_samples(
+        r, 100, Catch::rngSeed(), {{0.0, 0.0}, {{1.0, 0.0}, {0.0, 1.0}}}));
+    CHECK_THROWS(s.run_independent_samples(
+        r,
+        100,
+        Catch::rngSeed(),
+        {{0.05, 0.3, 0.1},
+         {{0.1, 0.0, 0.0}, {0.0, 0.1, 0.0}, {0.0, 0.0, 0.0}}}));
+    CHECK_THROWS(gaussian_approximation_t{
+        {-0.4, 0.3, 0.1},
+        {{0.1, 0.0, 0.0}, {0.0, 0.1, 0.0}, {0.0, 0.0, 0.0}},
+        2});
+  }
+  SECTION("Adaptive proposal") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t           r{teams, team_name_map};
+    adaptive_proposal_t proposal{3, 2, 0.44, false};
+    s.run_adaptive_chain(
+        r, 100, 20, Catch::rngSeed(), proposal, uniform_log_prior());
+    CHECK(r.sample_count() == 100);
+    CHECK(proposal.frozen());
+  }
+  SECTION("Evaluation threads") {
+    results_t serial{teams, team_name_map};
+    results_t threaded{teams, team_name_map};
+    serial.enable_memory_save();
+    threaded.enable_memory_save();
+
+    for (size_t threads : {0, 3}) {
+      sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                      poisson_likelihood_model_t(matches)),
+                  tournament_factory(2)};
+      s.set_evaluation_threads(threads, []() { return tournament_factory(2); });
+      s.run_chain(threads == 0 ? serial : threaded,
+                  100,
+                  0,
+                  Catch::rngSeed(),
+                  update_poission_model_factory(0.1),
+                  uniform_log_prior());
+    }
+
+    REQUIRE(threaded.sample_count() == 100);
+    const auto &expected = serial.saved_results().value();
+    const auto &actual   = threaded.saved_results().value();
+    for (size_t i = 0; i < expected.size(); ++i) {
+      CHECK(actual[i].params == expected[i].params);
+      CHECK(actual[i].win_prob == expected[i].win_prob);
+    }
+  }
+  SECTION("Evaluating the samples of an earlier run") {
+    auto prefix = std::filesystem::temp_directory_path() /
+                  ("phylourny_samples_" + std::to_string(Catch::rngSeed()));
+    results_t original{teams, team_name_map};
+    original.set_run_type(run_mode_e::dynamic)
+        .add_file_output(prefix)
+        .enable_memory_save();
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    s.run_chain(original,
+                50,
+                0,
+                Catch::rngSeed(),
+                update_poission_model_factory(0.1),
+                uniform_log_prior());
+    original.flush();
+
+    auto bin_path = prefix;
+    bin_path += ".dynamic.samples.params.bin";
+    sample_reader_t reader{bin_path};
+    CHECK(reader.param_count() == 3);
+    reader.skip(20);
+
+    results_t rescored{teams, team_name_map};
+    rescored.enable_memory_save();
+    s.set_evaluation_threads(2, []() { return tournament_factory(2); });
+    CHECK(s.evaluate_samples(rescored, reader, 100) == 30);
+
+    const auto &expected = original.saved_results().value();
+    const auto &actual   = rescored.saved_results().value();
+    REQUIRE(actual.size() == 30);
+    for (size_t i = 0; i < actual.size(); ++i) {
+      CHECK(actual[i].params == expected[i + 20].params);
+      CHECK(actual[i].llh == expected[i + 20].llh);
+      CHECK(actual[i].win_prob == expected[i + 20].win_prob);
+    }
+
+    CHECK_THROWS(reader.skip(1));
+
+    for (const auto &path : original.flush()) {
+      std::filesystem::remove(path);
+    }
+  }
+  SECTION("Checkpoint and resume") {
+    auto checkpoint_path =
+        std::filesystem::temp_directory_path() /
+        ("phylourny_checkpoint_" + std::to_string(Catch::rngSeed()));
+    auto make_sampler = [&matches]() {
+      return sampler_t{std::make_unique<poisson_likelihood_model_t>(
+                           poisson_likelihood_model_t(matches)),
+                       tournament_factory(2)};
+    };
+
+    results_t full{teams, team_name_map};
+    full.enable_memory_save();
+    auto s = make_sampler();
+    s.set_checkpointing(checkpoint_path, 40);
+    s.run_chain(full,
+                60,
+                0,
+                Catch::rngSeed(),
+                update_poission_model_factory(0.1),
+                uniform_log_prior());
+
+    results_t resumed{teams, team_name_map};
+    resumed.enable_memory_save();
+    auto checkpoint = chain_checkpoint_t::read(checkpoint_path);
+    CHECK(checkpoint.samples == 40);
+    auto r = make_sampler();
+    r.resume_from(checkpoint);
+    r.run_chain(resumed,
+                60,
+                0,
+                Catch::rngSeed() + 1,
+                update_poission_model_factory(0.1),
+                uniform_log_prior());
+
+    CHECK(resumed.sample_count() == 60);
+    const auto &expected = full.saved_results().value();
+    const auto &actual   = resumed.saved_results().value();
+    REQUIRE(actual.size() == 20);
+    for (size_t i = 0; i < actual.size(); ++i) {
+      CHECK(actual[i].params == expected[i + 40].params);
+      CHECK(actual[i].llh == expected[i + 40].llh);
+    }
+
+    r.resume_from(checkpoint);
+    CHECK_THROWS(r.run_chain(resumed,
+                             80,
+                             0,
+                             Catch::rngSeed(),
+                             update_poission_model_factory(0.1),
+                             uniform_log_prior()));
+    std::filesystem::remove(checkpoint_path);
+  }
+  SECTION("Stopping rule") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t r{teams, team_name_map};
+    r.enable_diagnostics({100.0, {}}, 0);
+    s.run_chain(r,
+                100'000,
+                0,
+                Catch::rngSeed(),
+                update_poission_model_factory(0.1),
+                uniform_log_prior());
+    CHECK(r.stop_requested());
+    CHECK(r.sample_count() < 100'000);
+  }
+  SECTION("Parallel tempering") {
+    sampler_t s{std::make_unique<poisson_likelihood_model_t>(
+                    poisson_likelihood_model_t(matches)),
+                tournament_factory(2)};
+    results_t r{teams, team_name_map};
+    s.run_tempered_chain(r,
+                         100,
+                         0,
+                         Catch::rngSeed(),
+                         poisson_step_proposal_t{0.1},
+                         uniform_log_prior(),
+                         {1.0, 2.0, 4.0},
+                         10);
+    CHECK(r.sample_count() == 100);
+
+    CHECK_THROWS(s.run_tempered_chain(r,
+                                      100,
+                                      0,
+                                      Catch::rngSeed(),
+                                      poisson_step_proposal_t{0.1},
+                                      uniform_log_prior(),
+                                      {2.0, 4.0},
+                                      10));
+  }
+}
+
+TEST_CASE("evaluation_pipeline_t", "[evaluation_pipeline_t]") {
+  std::vector<std::string> teams{"a", "b"};
+  team_name_map_t          team_name_map{{"a", 0}, {"b", 1}};
+  results_t                r{teams, team_name_map};
+  r.enable_memory_save();
+
+  SECTION("Results are added in the order they were pushed") {
+    evaluation_pipeline_t pipeline{
+        r, 4, 8, [](size_t, const pending_sample_t &sample) {
+          /* Make early samples finish last */
+          std::this_thread::sleep_for(
+              std::chrono::microseconds(100 * (50 - sample.index % 50)));
+          return result_t{{}, sample.params, {}, {}, sample.llh};
+        }};
+    for (size_t i = 0; i < 200; ++i) {
+      pipeline.push({static_cast<double>(i)}, static_cast<double>(i), 0);
+    }
+    pipeline.finish();
+
+    const auto &list = r.saved_results().value();
+    REQUIRE(list.size() == 200);
+    for (size_t i = 0; i < list.size(); ++i) {
+      CHECK(list[i].llh == static_cast<double>(i));
+    }
+  }
+
+  SECTION("Worker errors are rethrown") {
+    evaluation_pipeline_t pipeline{
+        r, 2, 4, [](size_t, const pending_sample_t &sample) -> result_t {
+          if (sample.index == 3) { throw std::runtime_error{"failed"}; }
+          return result_t{{}, sample.params, {}, {}, sample.llh};
+        }};
+    CHECK_THROWS([&]() {
+      for (size_t i = 0; i < 100; ++i) { pipeline.push({0.0}, 0.0, 0); }
+      pipeline.finish();
+    }());
+  }
+}
+
+TEST_CASE("convergence_monitor_t", "[convergence_monitor_t]") {
+  random_engine_t            gen(Catch::rngSeed());
+  std::normal_distribution<> normal(0.0, 1.0);
+
+  SECTION("Independent samples have an ESS close to the sample count") {
+    convergence_monitor_t monitor{{"x"}, {}};
+    for (size_t i = 0; i < 20'000; ++i) { monitor.add(0, {normal(gen)}); }
+    auto d = monitor.diagnostics().front();
+    CHECK(d.ess > 10'000);
+    CHECK(d.ess < 40'000);
+    CHECK(std::abs(d.autocorrelation) < 0.05);
+    CHECK(d.mcse == Catch::Approx(1.0 / std::sqrt(20'000.0)).epsilon(0.3));
+  }
+
+  SECTION("Autocorrelated samples have a lower ESS") {
+    convergence_monitor_t monitor{{"x"}, {}};
+    double                x = 0.0;
+    for (size_t i = 0; i < 20'000; ++i) {
+      x = 0.9 * x + normal(gen);
+      monitor.add(0, {x});
+    }
+    auto d = monitor.diagnostics().front();
+    /* The ESS of an AR(1) process is n (1 - phi) / (1 + phi) */
+    CHECK(d.ess < 3'000);
+    CHECK(d.autocorrelation == Catch::Approx(0.9).margin(0.05));
+  }
+
+  SECTION("Split R-hat detects chains that disagree") {
+    convergence_monitor_t agree{{"x"}, {}};
+    convergence_monitor_t disagree{{"x"}, {}};
+    for (size_t i = 0; i < 5'000; ++i) {
+      for (size_t c = 0; c < 2; ++c) {
+        agree.add(c, {normal(gen)});
+        disagree.add(c, {normal(gen) + 3.0 * c});
+      }
+    }
+    REQUIRE(agree.diagnostics().front().rhat.has_value());
+    CHECK(agree.diagnostics().front().rhat.value() < 1.01);
+    CHECK(disagree.diagnostics().front().rhat.value() > 1.5);
+  }
+
+  SECTION("Stopping rule") {
+    convergence_monitor_t monitor{{"x", "y"}, {1'000.0, {}}};
+    CHECK_FALSE(monitor.converged());
+    for (size_t i = 0; i < 5'000; ++i) {
+      monitor.add(0, {normal(gen), 1.0});
+    }
+    CHECK(monitor.converged());
+
+    convergence_monitor_t no_rule{{"x"}, {}};
+    for (size_t i = 0; i < 5'000; ++i) { no_rule.add(0, {normal(gen)}); }
+    CHECK_FALSE(no_rule.converged());
+  }
+}
+
+TEST_CASE("metropolis_kernel_t", "[metropolis_kernel_t]") {
+  std::vector<match_t> matches;
+  matches.push_back({0, 1, 1, 0, match_winner_t::left});
+  matches.push_back({0, 1, 0, 1, match_winner_t::right});
+  matches.push_back({0, 2, 2, 1, match_winner_t::left});
+  poisson_likelihood_model_t lhm(matches);
+
+  SECTION("In-place proposals match their update functions") {
+    random_engine_t gen1(Catch::rngSeed());
+    random_engine_t gen2(Catch::rngSeed());
+    params_t        params{0.3, 0.5, 0.7, 1.0};
+
+    win_probs_beta_with_scale_proposal_t beta;
+    poisson_step_proposal_t              step{0.1};
+    auto poisson_update = update_poission_model_factory(0.1);
+    for (size_t i = 0; i < 100; ++i) {
+      params_t proposed{params};
+      auto     move = beta.propose(params, proposed, gen1);
+      auto [expected, ratio] = update_win_probs_beta_with_scale(params, gen2);
+      CHECK(proposed == expected);
+      CHECK(move.log_hastings == Catch::Approx(std::log(ratio)));
+
+      proposed = params;
+      step.propose(params, proposed, gen1);
+      CHECK(proposed == poisson_update(params, gen2).first);
+    }
+  }
+
+  SECTION("Rejected proposals are reverted") {
+    win_probs_beta_with_scale_proposal_t proposal;
+    flat_log_prior_t                     prior;
+    metropolis_kernel_t kernel{lhm, proposal, prior, params_t(4, 0.5)};
+    random_engine_t     gen(Catch::rngSeed());
+    for (size_t i = 0; i < 1000; ++i) {
+      auto before   = kernel.params();
+      bool accepted = kernel.step(gen);
+      if (!accepted) { CHECK(kernel.params() == before); }
+      CHECK(kernel.log_likelihood() ==
+            Catch::Approx(lhm.log_likelihood(kernel.params())));
+    }
+  }
+
+  SECTION("Swapped states keep their temperatures") {
+    poisson_step_proposal_t proposal{0.1};
+    flat_log_prior_t        prior;
+    metropolis_kernel_t     cold{lhm, proposal, prior, params_t(4, 0.5)};
+    metropolis_kernel_t hot{lhm, proposal, prior, {0.2, 0.4, 0.6, 0.8}, 0.25};
+
+    double cold_lh = cold.log_likelihood();
+    double hot_lh  = hot.log_likelihood();
+    cold.swap_state(hot);
+    CHECK(cold.params() == params_t{0.2, 0.4, 0.6, 0.8});
+    CHECK(cold.log_likelihood() == hot_lh);
+    CHECK(cold.inv_temp() == 1.0);
+    CHECK(hot.params() == params_t(4, 0.5));
+    CHECK(hot.log_likelihood() == cold_lh);
+    CHECK(hot.inv_temp() == 0.25);
+
+    random_engine_t gen(Catch::rngSeed());
+    for (size_t i = 0; i < 100; ++i) {
+      hot.step(gen);
+      CHECK(hot.log_likelihood() ==
+            Catch::Approx(lhm.log_likelihood(hot.params())));
+    }
+  }
+}
+
+TEST_CASE("adaptive_proposal_t", "[adaptive_proposal_t]") {
+  random_engine_t gen(Catch::rngSeed());
+
+  SECTION("Rejections shrink the scale, acceptances grow it") {
+    adaptive_proposal_t proposal{2, 0, 0.44, false};
+    params_t            params{0.0, 0.0};
+    for (size_t i = 0; i < 100; ++i) {
+      proposal.adapt(params, 0, false);
+      proposal.adapt(params, 1, true);
+    }
+    CHECK(proposal.scales()[0] < 0.1);
+    CHECK(proposal.scales()[1] > 0.1);
+
+    proposal.freeze();
+    auto frozen_scales = proposal.scales();
+    proposal.adapt(params, 0, false);
+    CHECK(proposal.scales() == frozen_scales);
+  }
+
+  SECTION("Bounded proposals stay in the unit interval") {
+    adaptive_proposal_t proposal{3, 3, 0.44, false, 1.0};
+    params_t            params{0.01, 0.5, 0.99};
+    for (size_t i = 0; i < 1000; ++i) {
+      auto [next, ratio] = proposal(params, gen);
+      CHECK(ratio == 1.0);
+      for (auto p : next) {
+        CHECK(p >= 0.0);
+        CHECK(p <= 1.0);
+      }
+    }
+    CHECK_THROWS(adaptive_proposal_t{3, 4, 0.44, false});
+  }
+
+  SECTION("Only the leading parameters are bounded") {
+    adaptive_proposal_t proposal{2, 1, 0.44, false, 10.0};
+    params_t            params{0.5, 0.5};
+    bool                left_bounds = false;
+    for (size_t i = 0; i < 1000; ++i) {
+      auto [next, ratio] = proposal(params, gen);
+      CHECK(next[0] >= 0.0);
+      CHECK(next[0] <= 1.0);
+      left_bounds = left_bounds || next[1] < 0.0 || next[1] > 1.0;
+    }
+    CHECK(left_bounds);
+  }
+
+  SECTION("Block moves out of the bounds are rejected") {
+    adaptive_proposal_t      proposal{2, 1, 0.44, true};
+    std::normal_distribution normal(0.0, 1.0);
+    for (size_t i = 0; i < 200; ++i) {
+      proposal.adapt({normal(gen), normal(gen)}, {}, true);
+    }
+    REQUIRE(proposal.covariance_ready());
+
+    size_t rejected = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+      auto [next, ratio] = proposal({0.99, 0.0}, gen);
+      if (next[0] < 0.0 || next[0] > 1.0) {
+        CHECK(ratio == 0.0);
+        rejected += 1;
+      } else {
+        CHECK(ratio == 1.0);
+      }
+    }
+    CHECK(rejected > 0);
+  }
+
+  SECTION("Covariance learning enables block proposals") {
+    adaptive_proposal_t      proposal{2, 0, 0.44, true};
+    std::normal_distribution normal(0.0, 1.0);
+    for (size_t i = 0; i < 200; ++i) {
+      double x = normal(gen);
+      proposal.adapt({x, x + 0.1 * normal(gen)}, {}, true);
+    }
+    REQUIRE(proposal.covariance_ready());
+
+    size_t block_moves = 0;
+    for (size_t i = 0; i < 100; ++i) {
+      auto [next, ratio] = proposal({0.0, 0.0}, gen);
+      if (next[0] != 0.0 && next[1] != 0.0) { block_moves += 1; }
+    }
+    CHECK(block_moves > 0);
+    CHECK(block_moves < 100);
+  }
 }
 
 TEST_CASE("beta distribution", "[beta_distribution]") {
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <numeric>
+#include <subtree_cache.hpp>
+#include <tournament.hpp>
+#include <tournament_factory.hpp>
+#include <util.hpp>
+
+TEST_CASE("subtree_cache_t LRU behaviour", "[subtree_cache_t]") {
+  subtree_cache_t cache(2);
+
+  cache.insert("a", {1.0});
+  cache.insert("b", {2.0});
+  REQUIRE(cache.find("a") != nullptr);
+
+  cache.insert("c", {3.0});
+  CHECK(cache.size() == 2);
+  CHECK(cache.find("b") == nullptr);
+  REQUIRE(cache.find("a") != nullptr);
+  CHECK((*cache.find("a"))[0] == 1.0);
+  REQUIRE(cache.find("c") != nullptr);
+
+  SECTION("Binding a new matrix clears the cache") {
+    cache.bind(uniform_matrix_factory(2));
+    CHECK(cache.size() == 0);
+    cache.insert("a", {1.0});
+    cache.bind(uniform_matrix_factory(2));
+    CHECK(cache.size() == 1);
+  }
+}
+
+TEST_CASE("evaluate_brackets", "[subtree_cache_t]") {
+  constexpr size_t global_teams = 12;
+  constexpr size_t tsize        = 8;
+  auto             global_wp    = random_matrix_factory(global_teams, 0xdead);
+
+  std::vector<size_t> base(global_teams);
+  std::iota(base.begin(), base.end(), 0);
+
+  std::vector<std::vector<size_t>> brackets;
+  std::mt19937_64                  gen(0xbeef);
+  for (size_t i = 0; i < 16; ++i) {
+    std::shuffle(base.begin(), base.end(), gen);
+    brackets.emplace_back(base.begin(), base.begin() + tsize);
+  }
+  /* Brackets which only differ in the second half share the first half */
+  brackets.push_back(brackets[0]);
+  std::swap(brackets.back()[4], brackets.back()[6]);
+
+  auto            t = tournament_factory(tsize);
+  subtree_cache_t cache(64);
+  auto            results = evaluate_brackets(t, global_wp, brackets, cache);
+
+  REQUIRE(results.size() == brackets.size());
+  CHECK(cache.hits() > 0);
+  CHECK(cache.size() <= cache.capacity());
+
+  for (size_t b = 0; b < brackets.size(); ++b) {
+    matrix_t local(tsize, vector_t(tsize));
+    for (size_t i = 0; i < tsize; ++i) {
+      for (size_t j = 0; j < tsize; ++j) {
+        local[i][j] = global_wp[brackets[b][i]][brackets[b][j]];
+      }
+    }
+    auto direct = tournament_factory(tsize);
+    direct.reset_win_probs(local);
+    auto expected = direct.eval();
+    for (size_t i = 0; i < tsize; ++i) {
+      CHECK(results[b][i] == Catch::Approx(expected[i]));
+    }
+  }
+
+  SECTION("A tiny cache still gives the correct answer") {
+    subtree_cache_t small_cache(1);
+    auto small_results = evaluate_brackets(t, global_wp, brackets, small_cache);
+    CHECK(small_cache.size() == 1);
+    for (size_t b = 0; b < brackets.size(); ++b) {
+      for (size_t i = 0; i < tsize; ++i) {
+        CHECK(small_results[b][i] == Catch::Approx(results[b][i]));
+      }
+    }
+  }
+}
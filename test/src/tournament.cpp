@@ -3,6 +3,8 @@
 #include <factorial.hpp>
 #include <numeric>
 #include <random>
+#include <sstream>
+#include <string>
 #include <tournament.hpp>
 #include <tournament_factory.hpp>
 #include <tournament_node.hpp>
@@ -576,3 +578,194 @@ e -> a[style = solid]
     CHECK(r == graphiz_result_long);
   }
 }
+
+TEST_CASE("Bracket pool scoring", "[pool]") {
+  constexpr size_t          tsize = 8;
+  const std::vector<double> espn_points{10, 20, 40};
+
+  auto t = tournament_factory(tsize);
+  auto m = random_matrix_factory(tsize, 0x5eed);
+  t.reset_win_probs(m);
+  auto rounds = t.round_labels();
+  REQUIRE(rounds.size() == 3);
+  CHECK(rounds[0].size() == 4);
+  CHECK(rounds[2].size() == 1);
+
+  /* Each bit of the mask picks the left or right entrant of one match */
+  auto make_bracket = [&rounds](size_t mask) -> bracket_picks_t {
+    bracket_picks_t       picks;
+    std::vector<size_t>   entrants(tsize);
+    std::iota(entrants.begin(), entrants.end(), 0);
+    for (const auto &round : rounds) {
+      std::vector<size_t> winners;
+      for (size_t i = 0; i < round.size(); ++i) {
+        size_t winner = entrants[2 * i + (mask & 1)];
+        mask >>= 1;
+        picks[round[i]] = winner;
+        winners.push_back(winner);
+      }
+      entrants = winners;
+    }
+    return picks;
+  };
+
+  SECTION("Optimal bracket beats every other bracket") {
+    auto [best_picks, best_score] = t.optimal_pool_bracket(espn_points);
+    CHECK(t.expected_pool_score(best_picks, espn_points) ==
+          Catch::Approx(best_score));
+
+    double brute_best = 0.0;
+    for (size_t mask = 0; mask < (1u << (tsize - 1)); ++mask) {
+      double score = t.expected_pool_score(make_bracket(mask), espn_points);
+      CHECK(score <= best_score + 1e-9);
+      brute_best = std::max(brute_best, score);
+    }
+    CHECK(brute_best == Catch::Approx(best_score));
+  }
+
+  SECTION("Uniform matrix") {
+    t.reset_win_probs(uniform_matrix_factory(tsize));
+    /* Every bracket is worth 4 * 10 / 2 + 2 * 20 / 4 + 40 / 8 = 35 */
+    CHECK(t.expected_pool_score(make_bracket(0), espn_points) ==
+          Catch::Approx(35.0));
+    CHECK(t.optimal_pool_bracket(espn_points).second == Catch::Approx(35.0));
+  }
+
+  SECTION("Inconsistent brackets are rejected") {
+    auto picks          = make_bracket(0);
+    picks[rounds[2][0]] = 7;
+    CHECK_THROWS(t.expected_pool_score(picks, espn_points));
+  }
+
+  SECTION("Not enough rounds of points") {
+    CHECK_THROWS(t.optimal_pool_bracket({10, 20}));
+  }
+}
+
+TEST_CASE("Bracket pool scoring with byes", "[pool]") {
+  /* Teams 0 and 1 have a bye, and play each other in the semifinal */
+  auto t = tournament_factory(2, 4);
+  t.reset_win_probs(uniform_matrix_factory(6));
+  const std::vector<double> espn_points{10, 20, 40};
+
+  auto rounds = t.round_labels();
+  REQUIRE(rounds.size() == 3);
+  CHECK(rounds[0].size() == 2);
+  CHECK(rounds[1].size() == 2);
+  CHECK(rounds[2].size() == 1);
+
+  bracket_picks_t picks{{rounds[0][0], 2},
+                        {rounds[0][1], 4},
+                        {rounds[1][0], 0},
+                        {rounds[1][1], 2},
+                        {rounds[2][0], 0}};
+  /* 2 * 10 / 2 + 20 / 2 + 20 / 4 + 40 / 4 */
+  CHECK(t.expected_pool_score(picks, espn_points) == Catch::Approx(35.0));
+  CHECK(t.optimal_pool_bracket(espn_points).second == Catch::Approx(35.0));
+
+  meeting_probs_t meetings;
+  t.eval(meetings);
+  REQUIRE(meetings.round_count == 3);
+  CHECK(meetings(0, 0, 1) == Catch::Approx(0.0));
+  CHECK(meetings(1, 0, 1) == Catch::Approx(1.0));
+  CHECK(meetings(0, 2, 3) == Catch::Approx(1.0));
+  CHECK(meetings(2, 0, 2) == Catch::Approx(0.125));
+}
+
+TEST_CASE("Meeting probabilities", "[meetings]") {
+  SECTION("Uniform, 4 teams") {
+    auto t = tournament_factory(4);
+    t.reset_win_probs(uniform_matrix_factory(4));
+
+    meeting_probs_t meetings;
+    auto            r = t.eval(meetings);
+    REQUIRE(meetings.round_count == 2);
+    REQUIRE(meetings.team_count == 4);
+
+    CHECK(r[0] == Catch::Approx(0.25));
+    CHECK(meetings(0, 0, 1) == Catch::Approx(1.0));
+    CHECK(meetings(0, 1, 0) == Catch::Approx(1.0));
+    CHECK(meetings(0, 0, 2) == Catch::Approx(0.0));
+    CHECK(meetings(1, 0, 2) == Catch::Approx(0.25));
+    CHECK(meetings(1, 0, 1) == Catch::Approx(0.0));
+  }
+
+  SECTION("Binary layout") {
+    meeting_probs_t meetings{2, 1};
+    meetings(0, 0, 1) = 0.5;
+
+    std::ostringstream os;
+    meetings.write_binary(os);
+    auto bytes = os.str();
+    REQUIRE(bytes.size() == 8 + 2 * 8 + 4 * 8);
+    CHECK(bytes.substr(0, 8) == "PHYMEET1");
+    CHECK(bytes.substr(8, 8) == std::string("\x02\0\0\0\0\0\0\0", 8));
+    CHECK(bytes.substr(16, 8) == std::string("\x01\0\0\0\0\0\0\0", 8));
+    /* 0.5 is 0x3FE0000000000000 */
+    CHECK(bytes.substr(32, 8) ==
+          std::string("\0\0\0\0\0\0\xE0\x3F", 8));
+  }
+
+  SECTION("Random, 16 teams") {
+    constexpr size_t tsize = 16;
+    auto             t     = tournament_factory(tsize);
+    t.reset_win_probs(random_matrix_factory(tsize, 0x1234));
+
+    meeting_probs_t meetings;
+    auto            r = t.eval(meetings);
+    CHECK(std::accumulate(r.begin(), r.end(), 0.0) == Catch::Approx(1.0));
+
+    /* Each round has half as many matches as the last, and each match is
+     * counted twice since the tensor is symmetric */
+    size_t matches = tsize / 2;
+    for (size_t round = 0; round < meetings.round_count; ++round) {
+      double total = 0.0;
+      for (size_t i = 0; i < tsize; ++i) {
+        for (size_t j = 0; j < tsize; ++j) {
+          CHECK(meetings(round, i, j) == Catch::Approx(meetings(round, j, i)));
+          total += meetings(round, i, j);
+        }
+      }
+      CHECK(total == Catch::Approx(2.0 * static_cast<double>(matches)));
+      matches /= 2;
+    }
+
+    /* The probability that a team plays in the final is its probability of
+     * reaching the final */
+    auto   node_results = t.get_node_results();
+    auto   rounds       = t.round_labels();
+    double final_total  = 0.0;
+    for (size_t j = 0; j < tsize; ++j) {
+      final_total += meetings(meetings.round_count - 1, 0, j);
+    }
+    CHECK(final_total ==
+          Catch::Approx(node_results.at(rounds[rounds.size() - 2][0])[0]));
+  }
+}
+
+TEST_CASE("Pruned evaluation", "[pruning]") {
+  constexpr size_t tsize = 64;
+  auto             t     = tournament_factory(tsize);
+  t.reset_win_probs(random_matrix_factory(tsize, 0xfeed));
+  auto exact = t.eval();
+
+  SECTION("A zero threshold is exact") {
+    pruning_t pruning{0.0, 0.0};
+    auto      r = t.eval(pruning);
+    CHECK(pruning.discarded == 0.0);
+    for (size_t i = 0; i < tsize; ++i) { CHECK(r[i] == exact[i]); }
+  }
+
+  SECTION("The discarded mass bounds the error") {
+    pruning_t pruning{1e-2, 0.0};
+    auto      r = t.eval(pruning);
+    CHECK(pruning.discarded > 0.0);
+
+    double error = 0.0;
+    for (size_t i = 0; i < tsize; ++i) {
+      CHECK(r[i] <= exact[i] + 1e-12);
+      error += std::abs(exact[i] - r[i]);
+    }
+    CHECK(error <= pruning.discarded + 1e-12);
+  }
+}
@@ -1,5 +1,7 @@
 #include <catch2/catch_all.hpp>
+#include <cmath>
 #include <limits>
+#include <skellam_table.hpp>
 #include <util.hpp>
 
 TEST_CASE("skellam distribution calculators"
@@ -25,4 +27,92 @@ TEST_CASE("skellam distribution calculators"
     CHECK(skellam_cmf(-1, 1, 10) == Catch::Approx(0.9979162474528441));
     CHECK(skellam_cmf(-1, 1, 10) == Catch::Approx(0.9979162474528441));
   }
+  SECTION("Outcomes") {
+    std::vector<std::pair<double, double>> rates{
+        {1, 1}, {2, 1}, {1, 3}, {1, 10}, {0.05, 20}, {0.5, 0.5}};
+    for (auto [u1, u2] : rates) {
+      auto outcome = skellam_outcome_probs(u1, u2);
+      CHECK(outcome.tie == Catch::Approx(skellam_pmf(0, u1, u2)));
+      CHECK(outcome.loss == Catch::Approx(skellam_cmf(-1, u1, u2)));
+      CHECK(outcome.win == Catch::Approx(skellam_cmf(-1, u2, u1)));
+      CHECK(outcome.win + outcome.tie + outcome.loss == Catch::Approx(1.0));
+    }
+  }
+  SECTION("Outcomes with extreme rates") {
+    auto even = skellam_outcome_probs(2000, 2000);
+    CHECK(even.win == Catch::Approx(even.loss));
+    CHECK(even.tie ==
+          Catch::Approx(1 / std::sqrt(4 * M_PI * 2000)).epsilon(1e-3));
+
+    auto lopsided = skellam_outcome_probs(1000, 1e-3);
+    CHECK(lopsided.win == Catch::Approx(1.0));
+    CHECK(lopsided.tie >= 0.0);
+    CHECK(lopsided.loss >= 0.0);
+
+    auto scoreless = skellam_outcome_probs(0, 0);
+    CHECK(scoreless.tie == 1.0);
+    CHECK_THROWS(skellam_outcome_probs(-1, 1));
+  }
+}
+
+TEST_CASE("tabulated Skellam match outcomes", "[skellam]") {
+  const auto &table = skellam_table();
+
+  SECTION("Within the documented error") {
+    CHECK(table.max_win_error(16) < 6e-9);
+  }
+  SECTION("Matches the series") {
+    for (double d : {-3.7, -1.01, -0.2, 0.0, 0.3, 0.999, 2.5}) {
+      auto outcome = skellam_match_outcome(d);
+      CHECK(table.win_prob(d) ==
+            Catch::Approx(outcome.win + outcome.tie / 2).margin(1e-8));
+      CHECK(table.draw_prob(d) == Catch::Approx(outcome.tie).margin(1e-8));
+      CHECK(table.win_prob(d) + table.win_prob(-d) == Catch::Approx(1.0));
+    }
+  }
+  SECTION("Beyond the table") {
+    CHECK(table.win_prob(50.0) == 1.0);
+    CHECK(table.win_prob(-50.0) == 0.0);
+    CHECK(table.draw_prob(50.0) < 1e-23);
+  }
+  SECTION("Monotone between the points, up to rounding") {
+    constexpr double epsilon = std::numeric_limits<double>::epsilon();
+    skellam_table_t  coarse{8.0, 2};
+    double           last = coarse.win_prob(0.0);
+    for (double d = 0.01; d < 8.0; d += 0.01) {
+      double p = coarse.win_prob(d);
+      CHECK(p >= last - epsilon);
+      last = p;
+    }
+  }
+}
+
+TEST_CASE("log priors", "[prior]") {
+  params_t params{0.2, 0.5, 0.7};
+
+  SECTION("Match the density priors") {
+    CHECK(gamma_log_prior_factory(2.0, 3.0)(params) ==
+          Catch::Approx(std::log(gamma_prior_factory(2.0, 3.0)(params))));
+    CHECK(invgamma_log_prior_factory(2.0, 3.0)(params) ==
+          Catch::Approx(std::log(invgamma_prior_factory(2.0, 3.0)(params))));
+    CHECK(beta_log_prior_factory(1.5, 2.5)(params) ==
+          Catch::Approx(std::log(beta_prior_factory(1.5, 2.5)(params))));
+    CHECK(normal_log_prior_factory(0.0, 1.0)(params) ==
+          Catch::Approx(std::log(normal_prior_factory(0.0, 1.0)(params))));
+    CHECK(uniform_log_prior()(params) == 0.0);
+  }
+
+  SECTION("Single parameter deltas") {
+    auto     prior = gamma_log_prior_factory(2.0, 3.0);
+    params_t new_params{params};
+    new_params[1] = 0.9;
+    CHECK(prior.delta(params, new_params, 1) ==
+          Catch::Approx(prior(new_params) - prior(params)));
+  }
+
+  SECTION("No underflow with many parameters") {
+    params_t many(2000, 0.01);
+    CHECK(gamma_prior_factory(2.0, 3.0)(many) == 0.0);
+    CHECK(std::isfinite(gamma_log_prior_factory(2.0, 3.0)(many)));
+  }
 }